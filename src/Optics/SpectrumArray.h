@@ -147,6 +147,19 @@ namespace Optics
 			return false;
 		}
 
+		//the largest value of any colour
+		const ftype max()const
+		{
+			ftype out = data[0];
+			BEGIN_SPECTRUM_LOOP(i)
+				if (data[i] > out)
+				{
+					out = data[i];
+				}
+			END_SPECTRUM_LOOP
+			return out;
+		}
+
 		inline operator ftype* () { return data; }
 
 		inline const ftype* const get_data()const { return data; }
@@ -315,6 +328,19 @@ namespace Optics
 			return false;
 		}
 
+		//the largest value of any colour
+		const ftype max()const
+		{
+			ftype out = data[0];
+			BEGIN_SPECTRUM_LOOP(i)
+				if (data[i] > out)
+				{
+					out = data[i];
+				}
+			END_SPECTRUM_LOOP
+			return out;
+		}
+
 		inline operator const ftype* () { return data; }
 
 		inline const ftype *const get_data()const { return data; }
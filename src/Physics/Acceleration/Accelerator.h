@@ -0,0 +1,156 @@
+#ifndef ACCELERATOR_H
+#define ACCELERATOR_H
+
+#include "Surfaces/Surface.h"
+#include "Physics/Intersection.h"
+#include "Physics/RayInfo.h"
+#include "Physics/RayPacket.h"
+#include "PackedPrimitives.h"
+
+/*
+* The base class for the spatial structures that sit between a ray and the registered surfaces.
+* An accelerator is built from the SurfaceInfos held in Surface<ftype>::manager and must be able to:
+*
+*  find the first intersection of a ray with the scene
+*  tell whether anything blocks a ray before it has travelled a given distance (shadow rays)
+*
+* surfaces without finite bounds (planes) would ruin any spatial structure, so the base class keeps them
+* in a small list of their own. Every accelerator tests that list before its own structure: a nearby ground
+* plane then tightens the nearest-hit bound before any traversal starts, and usually answers a shadow
+* query without one.
+*
+* only one accelerator is active at a time; the interaction code queries it when it has been set,
+* and falls back to testing every surface otherwise. Accelerators are only read while rendering,
+* so the same one can be shared by all render threads.
+*/
+
+template<typename ftype>
+class Accelerator
+{
+public:
+	typedef Maths::Vector<ftype, 3> fvector;
+	typedef Geometry::Space<ftype, 1, 3> linef;
+private:
+	static const Accelerator* active;
+protected:
+	//runs jobs on the calling thread, for the builds and updates that aren't given a pool
+	struct SerialPool
+	{
+		inline size_t thread_count()const { return 1; }
+
+		template<typename job_type>
+		inline void run(const job_type& job) { job(0); }
+	};
+
+	PackedPrimitives<ftype> unbounded;
+
+	//packs every surface in infos[0, n) without finite bounds into the unbounded list, and gives the
+	//bounded ones to bounded_surface(info); builds should start with this
+	template<typename function_type>
+	void partition_surfaces(const typename Surface<ftype>::SurfaceInfo* infos, const size_t n, function_type bounded_surface)
+	{
+		const Surface<ftype>** surfaces = new const Surface<ftype>*[n];
+		size_t n_unbounded = 0;
+		for (size_t i = 0; i < n; i++)
+		{
+			const typename Surface<ftype>::SurfaceInfo& info = infos[i];
+			if (info.is_bounded())
+			{
+				bounded_surface(info);
+			}
+			else
+			{
+				surfaces[n_unbounded] = info.m_surface;
+				n_unbounded++;
+			}
+		}
+		unbounded.pack(surfaces, n_unbounded);
+		delete[] surfaces;
+	}
+
+	//the same over every registered surface
+	template<typename function_type>
+	void partition_surfaces(function_type bounded_surface)
+	{
+		partition_surfaces(Surface<ftype>::get_surface_infos(), Surface<ftype>::surface_count(), bounded_surface);
+	}
+
+	//the closest hit among the unbounded surfaces; bounded structures carry on from its upper bound
+	inline Intersection<ftype> unbounded_intersection(const linef& ray)const
+	{
+		Intersection<ftype> info;
+		unbounded.update(info, 0, unbounded.size(), ray);
+		return info;
+	}
+
+	//the same for every active lane of a packet; the lanes' hits must have been reset by RayPacket::add
+	inline void unbounded_intersection(RayPacket<ftype>& packet)const
+	{
+		unbounded.update(packet, 0, unbounded.size(), packet.active);
+	}
+
+	inline bool unbounded_occluded(const linef& ray, const ftype max_distance)const
+	{
+		return unbounded.occludes(0, unbounded.size(), ray, max_distance);
+	}
+
+public:
+	Accelerator() {}
+
+	Accelerator(const Accelerator& other) = delete;
+
+	virtual ~Accelerator()
+	{
+		if (active == this)
+		{
+			active = nullptr;
+		}
+	}
+
+	//(re)builds the structure from the surfaces currently registered
+	virtual void build() = 0;
+
+	//finds the closest surface the ray hits, following the tolerances of Intersection<ftype>.
+	//traversal must have been made from ray
+	virtual Intersection<ftype> first_intersection(const linef& ray, const TraversalRay<ftype>& traversal)const = 0;
+
+	//true if any surface is hit between Surface<ftype>::tolerance and max_distance; stops at the first one found
+	virtual bool occluded(const linef& ray, const TraversalRay<ftype>& traversal, const ftype max_distance)const = 0;
+
+	//finds the closest hit of every active lane of the packet and leaves it in packet.hits. the lanes are
+	//traced one at a time here; accelerators that can trace them together override this
+	virtual void first_intersection(RayPacket<ftype>& packet)const
+	{
+		RayPacket<ftype>::for_each_lane(packet.active, [this, &packet](const size_t lane)
+		{
+			packet.hits[lane] = first_intersection(packet.rays[lane], TraversalRay<ftype>(packet.rays[lane]));
+		});
+	}
+
+	inline Intersection<ftype> first_intersection(const linef& ray)const
+	{
+		return first_intersection(ray, TraversalRay<ftype>(ray));
+	}
+
+	inline bool occluded(const linef& ray, const ftype max_distance)const
+	{
+		return occluded(ray, TraversalRay<ftype>(ray), max_distance);
+	}
+
+	inline const size_t& unbounded_count()const { return unbounded.size(); }
+
+	inline static const Accelerator* get_active()
+	{
+		return active;
+	}
+
+	inline static void set_active(const Accelerator* accelerator)
+	{
+		active = accelerator;
+	}
+};
+
+template<typename ftype>
+const Accelerator<ftype>* Accelerator<ftype>::active = nullptr;
+
+#endif
@@ -0,0 +1,230 @@
+#ifndef ACCELERATOR_CACHE_H
+#define ACCELERATOR_CACHE_H
+
+#include "BoundingVolumeHierarchy.h"
+#include "WideBoundingVolumeHierarchy.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <typeinfo>
+
+/*
+* Keeps built hierarchies on disk between runs, so a scene that is rendered again (with another camera,
+* say) doesn't have to be built again.
+*
+* a cache file holds a header and the tree exactly as it is in memory: the nodes, then the packed
+* primitives and the unbounded list (see BoundingVolumeHierarchy::write). Surfaces are stored as their
+* position among the registered surfaces, and linked back to the surfaces of the current run when the
+* file is read, so reading is a handful of bulk reads into the tree's own arrays and no building at all.
+*
+* files are named after a hash of the registered surfaces (their kinds, order and geometry) and of the
+* builder, so a changed scene or another builder simply misses the cache and writes a file of its own.
+* The hash is taken once, before the tree is built, and the file is saved under it, so surfaces that
+* change while the tree is built or before it is saved can't give a file the wrong name.
+* The header repeats the hash along with the sizes of the types, and a file that doesn't match the
+* current scene and build of the program is never used. Old files are not cleaned up.
+*
+* any tree deriving from BoundingVolumeHierarchy can be cached, and wide trees through the binary tree
+* they are collapsed from.
+*/
+
+template<typename ftype>
+class AcceleratorCache
+{
+public:
+	typedef BoundingVolumeHierarchy<ftype> BinaryTree;
+	typedef typename Surface<ftype>::SurfaceInfo SurfaceInfo;
+
+	static constexpr uint32_t version = 1;
+private:
+	struct Header
+	{
+		char magic[4];
+		uint32_t version;
+		uint32_t ftype_size;
+		uint32_t node_size;
+		uint64_t scene_hash;
+		uint64_t n_surfaces;
+	};
+
+	//the position of each registered surface, looked up by address with open addressing
+	class SurfaceIndex
+	{
+		size_t mask;
+		const Surface<ftype>** keys;
+		uint32_t* values;
+
+		inline size_t slot(const Surface<ftype>* surface)const
+		{
+			return size_t((uintptr_t(surface) >> 4) * 11400714819323198485ULL) & mask;
+		}
+	public:
+		SurfaceIndex(const SurfaceInfo* infos, const size_t n)
+		{
+			size_t capacity = 16;
+			while (capacity < 2 * n)
+			{
+				capacity *= 2;
+			}
+			mask = capacity - 1;
+			keys = new const Surface<ftype>*[capacity]();
+			values = new uint32_t[capacity];
+			for (size_t i = 0; i < n; i++)
+			{
+				size_t s = slot(infos[i].m_surface);
+				while (keys[s])
+				{
+					s = (s + 1) & mask;
+				}
+				keys[s] = infos[i].m_surface;
+				values[s] = uint32_t(i);
+			}
+		}
+
+		SurfaceIndex(const SurfaceIndex& other) = delete;
+
+		~SurfaceIndex()
+		{
+			delete[] keys;
+			delete[] values;
+		}
+
+		//the position of surface among the registered surfaces, or PackedPrimitives::no_index if it isn't
+		//one of them (it was removed after the tree was built)
+		inline uint32_t operator()(const Surface<ftype>* surface)const
+		{
+			size_t s = slot(surface);
+			while (keys[s] != surface)
+			{
+				if (!keys[s])
+				{
+					return PackedPrimitives<ftype>::no_index;
+				}
+				s = (s + 1) & mask;
+			}
+			return values[s];
+		}
+	};
+
+	static const Header make_header(const uint64_t scene_hash)
+	{
+		Header header = { { 'R', 'T', '3', 'B' }, version, uint32_t(sizeof(ftype)),
+			uint32_t(sizeof(typename BinaryTree::Node)), scene_hash, Surface<ftype>::surface_count() };
+		return header;
+	}
+
+	static inline bool same_header(const Header& a, const Header& b)
+	{
+		return a.magic[0] == b.magic[0] && a.magic[1] == b.magic[1] && a.magic[2] == b.magic[2] && a.magic[3] == b.magic[3] &&
+			a.version == b.version && a.ftype_size == b.ftype_size && a.node_size == b.node_size &&
+			a.scene_hash == b.scene_hash && a.n_surfaces == b.n_surfaces;
+	}
+
+public:
+	AcceleratorCache() = delete;
+
+	//a hash of the registered surfaces in their current order and of the builder that made tree. take it
+	//before building the tree, and hand the same hash to make_filename, save and load
+	static uint64_t scene_hash(const BinaryTree& tree)
+	{
+		const size_t n = Surface<ftype>::surface_count();
+		const SurfaceInfo* infos = Surface<ftype>::get_surface_infos();
+		const Surface<ftype>** surfaces = new const Surface<ftype>*[n];
+		for (size_t i = 0; i < n; i++)
+		{
+			surfaces[i] = infos[i].m_surface;
+		}
+		PackedPrimitives<ftype> packed;
+		packed.pack(surfaces, n);
+		delete[] surfaces;
+
+		uint64_t h = packed.hash();
+		for (const char* name = typeid(tree).name(); *name; name++)
+		{
+			h ^= uint64_t(uint8_t(*name));
+			h *= 1099511628211ULL;
+		}
+		return h;
+	}
+
+	//writes a tree built over the registered surfaces to filename, under the scene_hash taken when it was built;
+	//false, with no file left behind, if it couldn't be written or the tree holds a surface that is no longer registered
+	static bool save(const BinaryTree& tree, const uint64_t hash, const char* filename)
+	{
+		FILE* file = fopen(filename, "wb");
+		if (!file)
+		{
+			return false;
+		}
+		const Header header = make_header(hash);
+		const SurfaceIndex index_of(Surface<ftype>::get_surface_infos(), Surface<ftype>::surface_count());
+		bool good = fwrite(&header, sizeof(Header), 1, file) == 1 && tree.write(file, index_of);
+		good = fclose(file) == 0 && good;
+		if (!good)
+		{
+			remove(filename);
+		}
+		return good;
+	}
+
+	//reads filename into tree if it was saved under hash, the scene_hash of the surfaces registered now; false,
+	//with tree left empty, if it wasn't or the file is missing or damaged
+	static bool load(BinaryTree& tree, const uint64_t hash, const char* filename)
+	{
+		FILE* file = fopen(filename, "rb");
+		if (!file)
+		{
+			return false;
+		}
+		const size_t n = Surface<ftype>::surface_count();
+		const SurfaceInfo* infos = Surface<ftype>::get_surface_infos();
+		Header header;
+		bool good = fread(&header, sizeof(Header), 1, file) == 1 && same_header(header, make_header(hash));
+		if (good)
+		{
+			const Surface<ftype>** surfaces = new const Surface<ftype>*[n];
+			for (size_t i = 0; i < n; i++)
+			{
+				surfaces[i] = infos[i].m_surface;
+			}
+			good = tree.read(file, surfaces, n);
+			delete[] surfaces;
+		}
+		fclose(file);
+		return good;
+	}
+
+	//the name of the cache file for a scene_hash, in directory
+	static void make_filename(char* filename, const size_t size, const uint64_t hash, const char* directory)
+	{
+		snprintf(filename, size, "%s/%016llx.rt3bvh", directory, (unsigned long long)hash);
+	}
+
+	//loads tree from its cache file in directory if there is one for this scene, and otherwise builds it
+	//and saves it there. true if it was loaded
+	static bool load_or_build(BinaryTree& tree, const char* directory)
+	{
+		const uint64_t hash = scene_hash(tree);
+		char filename[4096];
+		make_filename(filename, sizeof(filename), hash, directory);
+		if (load(tree, hash, filename))
+		{
+			return true;
+		}
+		tree.build();
+		save(tree, hash, filename);
+		return false;
+	}
+
+	//the same for a wide tree, caching the binary tree it is collapsed from
+	template<size_t width>
+	static bool load_or_build(WideBoundingVolumeHierarchy<ftype, width>& tree, const char* directory)
+	{
+		BinaryTree binary;
+		const bool loaded = load_or_build(binary, directory);
+		tree.build(binary);
+		return loaded;
+	}
+};
+
+#endif
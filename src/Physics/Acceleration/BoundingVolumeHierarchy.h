@@ -0,0 +1,926 @@
+#ifndef BOUNDING_VOLUME_HIERARCHY_H
+#define BOUNDING_VOLUME_HIERARCHY_H
+
+#include "Accelerator.h"
+#include "PackedPrimitives.h"
+
+#include <atomic>
+#include <cmath>
+#include <new>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+* A binary bounding volume hierarchy over the registered surfaces, built with the binned
+* surface area heuristic (SAH) from the aabbs in Surface<ftype>::manager.
+*
+* nodes are stored in one flat array with both children of an interior node next to each other,
+* so a node only needs the index of its left child. Leaves index a range of the primitives array,
+* which is reordered during the build so that every leaf's surfaces are contiguous, and then packed
+* so the leaves test their primitives without going through the surfaces' vtables.
+*
+* surfaces without finite bounds (planes) can't be binned; they are kept in the accelerator's
+* unbounded list and never enter the tree.
+*
+* for animation, update() refits the tree to surfaces that have moved (see Surface::mark_moved)
+* instead of building it again. The SAH cost of every node is remembered from when it was built,
+* and any subtree whose cost has grown past rebuild_threshold times that is rebuilt in place.
+*
+* the builders leave the nodes in the order they made them, which scatters a path from the root over
+* the whole array once the tree is bigger than the caches. layout_treelets() puts them in an order
+* that keeps the nodes a ray is likely to visit together: see there.
+*/
+
+template<typename ftype>
+class BoundingVolumeHierarchy : public Accelerator<ftype>
+{
+public:
+	typedef Maths::Vector<ftype, 3> fvector;
+	typedef Geometry::Space<ftype, 1, 3> linef;
+	typedef Geometry::AxisAlignedBoundingBox<ftype, 3> aabbf;
+	typedef typename Surface<ftype>::SurfaceInfo SurfaceInfo;
+
+	struct Node
+	{
+		fvector lower;
+		fvector upper;
+		uint32_t first;  //the left child for interior nodes, or the first primitive for leaves
+		uint32_t count;  //the number of primitives in a leaf; 0 for interior nodes
+
+		inline bool is_leaf()const { return count; }
+	};
+
+	static constexpr size_t n_bins = 12;
+	static constexpr size_t max_leaf_size = 4;
+	static constexpr size_t max_depth = 64;
+	static constexpr ftype traversal_cost = ftype(1.0);    //relative to the cost of one surface test
+	static constexpr ftype rebuild_threshold = ftype(1.5); //how far a subtree's SAH cost may grow before update() rebuilds it
+	static constexpr size_t treelet_bytes = 16384;        //the size of the blocks layout_treelets() groups the nodes into (a few pages)
+	static constexpr size_t cache_line = 64;              //the node array starts on one, so a pair of float nodes fills exactly one
+
+private:
+	//what the builder needs to know about each surface; the surfaces themselves are never touched
+	struct BuildReference
+	{
+		fvector lower;
+		fvector upper;
+		fvector centroid;
+		const Surface<ftype>* surface;
+		uint32_t index;               //where the surface was in the primitives before the build
+	};
+
+	struct Bin
+	{
+		fvector lower;
+		fvector upper;
+		size_t count;
+	};
+
+	struct StackEntry
+	{
+		uint32_t node;
+		ftype distance;
+	};
+
+	//a sibling pair waiting for a place in the layout
+	struct LayoutCandidate
+	{
+		uint32_t pair;      //where the pair is now
+		uint32_t parent;    //where its parent has been put
+		ftype area;         //the area of the parent, which is how likely the pair is to be visited
+	};
+
+	//adds candidate to the binary max-heap heap[0, n) on area
+	static void push_candidate(LayoutCandidate* heap, size_t& n, const LayoutCandidate& candidate)
+	{
+		size_t i = n++;
+		while (i > 0 && heap[(i - 1) / 2].area < candidate.area)
+		{
+			heap[i] = heap[(i - 1) / 2];
+			i = (i - 1) / 2;
+		}
+		heap[i] = candidate;
+	}
+
+	//takes the candidate with the largest area off the heap
+	static const LayoutCandidate pop_candidate(LayoutCandidate* heap, size_t& n)
+	{
+		const LayoutCandidate top = heap[0];
+		const LayoutCandidate last = heap[--n];
+		size_t i = 0;
+		for (size_t child = 1; child < n; child = 2 * i + 1)
+		{
+			if (child + 1 < n && heap[child + 1].area > heap[child].area)
+			{
+				child++;
+			}
+			if (!(heap[child].area > last.area))
+			{
+				break;
+			}
+			heap[i] = heap[child];
+			i = child;
+		}
+		if (n)
+		{
+			heap[i] = last;
+		}
+		return top;
+	}
+
+protected:
+	//the tree is kept here so other builders can fill it in and reuse the traversal
+	size_t n_nodes;
+	size_t node_capacity;
+	Node* nodes;
+	ftype* costs;                            //the SAH cost of each node's subtree when it was built
+	uint32_t* free_pairs;                    //sibling pairs left behind by subtree rebuilds, free for reuse
+	size_t n_free_pairs;
+
+	size_t n_primitives;
+	PackedPrimitives<ftype> primitives;      //in leaf order
+
+	//a node array that starts on a cache line. new[] only promises 16 bytes, which leaves every pair
+	//of float nodes across two lines; the block that was really allocated is kept just before the array
+	static Node* new_node_array(const size_t capacity)
+	{
+		unsigned char* block = new unsigned char[capacity * sizeof(Node) + sizeof(unsigned char*) + cache_line];
+		const uintptr_t start = (uintptr_t(block) + sizeof(unsigned char*) + cache_line - 1) & ~uintptr_t(cache_line - 1);
+		reinterpret_cast<unsigned char**>(start)[-1] = block;
+		Node* array = reinterpret_cast<Node*>(start);
+		for (size_t i = 0; i < capacity; i++)
+		{
+			new (array + i) Node();
+		}
+		return array;
+	}
+
+	static void delete_node_array(Node* array)
+	{
+		if (array)
+		{
+			delete[] reinterpret_cast<unsigned char**>(array)[-1];
+		}
+	}
+
+	void clear()
+	{
+		delete_node_array(nodes);
+		delete[] costs;
+		delete[] free_pairs;
+		nodes = nullptr;
+		costs = nullptr;
+		free_pairs = nullptr;
+		primitives.clear();
+		Accelerator<ftype>::unbounded.clear();
+		n_nodes = 0;
+		node_capacity = 0;
+		n_free_pairs = 0;
+		n_primitives = 0;
+	}
+
+	//makes room for capacity nodes, keeping the ones there are
+	void reserve_nodes(const size_t capacity)
+	{
+		if (capacity <= node_capacity)
+		{
+			return;
+		}
+		Node* new_nodes = new_node_array(capacity);
+		ftype* new_costs = new ftype[capacity];
+		uint32_t* new_free_pairs = new uint32_t[capacity / 2 + 1];
+		for (size_t i = 0; i < n_nodes; i++)
+		{
+			new_nodes[i] = nodes[i];
+			new_costs[i] = costs[i];
+		}
+		for (size_t i = 0; i < n_free_pairs; i++)
+		{
+			new_free_pairs[i] = free_pairs[i];
+		}
+		delete_node_array(nodes);
+		delete[] costs;
+		delete[] free_pairs;
+		nodes = new_nodes;
+		costs = new_costs;
+		free_pairs = new_free_pairs;
+		node_capacity = capacity;
+	}
+
+	//the index of two free nodes next to each other, for the children of a new interior node
+	uint32_t allocate_pair()
+	{
+		if (n_free_pairs)
+		{
+			n_free_pairs--;
+			return free_pairs[n_free_pairs];
+		}
+		if (n_nodes + 2 > node_capacity)
+		{
+			reserve_nodes(2 * node_capacity + 2);
+		}
+		const uint32_t pair = uint32_t(n_nodes);
+		n_nodes += 2;
+		return pair;
+	}
+
+	//works out the SAH cost of the subtree under nodes[index] and remembers it as the one to compare against
+	ftype compute_costs(const uint32_t index)
+	{
+		const Node& node = nodes[index];
+		const ftype area = surface_area(node.lower, node.upper);
+		if (node.is_leaf())
+		{
+			costs[index] = area * ftype(node.count);
+		}
+		else
+		{
+			costs[index] = area * traversal_cost + compute_costs(node.first) + compute_costs(node.first + 1);
+		}
+		return costs[index];
+	}
+
+	static inline void grow(fvector& lower, fvector& upper, const fvector& other_lower, const fvector& other_upper)
+	{
+		for (size_t i = 0; i < 3; i++)
+		{
+			lower[i] = Maths::min(lower[i], other_lower[i]);
+			upper[i] = Maths::max(upper[i], other_upper[i]);
+		}
+	}
+
+	static inline ftype surface_area(const fvector& lower, const fvector& upper)
+	{
+		const fvector d = upper - lower;
+		return ftype(2) * (d.x * d.y + d.y * d.z + d.z * d.x);
+	}
+
+private:
+	static inline void make_leaf(Node& node, const size_t first, const size_t count)
+	{
+		node.first = uint32_t(first);
+		node.count = uint32_t(count);
+	}
+
+	//builds the subtree for refs[first, first + count) into nodes[index]
+	void build_node(BuildReference* refs, const size_t index, const size_t first, const size_t count, const size_t depth)
+	{
+		Node& node = nodes[index];
+		node.lower = fvector(INFINITY);
+		node.upper = fvector(-INFINITY);
+		fvector c_lower(INFINITY);
+		fvector c_upper(-INFINITY);
+		for (size_t i = first; i < first + count; i++)
+		{
+			grow(node.lower, node.upper, refs[i].lower, refs[i].upper);
+			grow(c_lower, c_upper, refs[i].centroid, refs[i].centroid);
+		}
+
+		if (count == 1 || depth + 1 >= max_depth)
+		{
+			make_leaf(node, first, count);
+			return;
+		}
+
+		//find the cheapest binned split over all three axes
+		const ftype parent_area = surface_area(node.lower, node.upper);
+		ftype best_cost = INFINITY;
+		size_t best_axis = 0;
+		size_t best_split = 0;
+
+		for (size_t axis = 0; axis < 3; axis++)
+		{
+			const ftype extent = c_upper[axis] - c_lower[axis];
+			if (extent <= ftype(0))
+			{
+				continue;
+			}
+			const ftype scale = ftype(n_bins) / extent;
+
+			Bin bins[n_bins];
+			for (size_t b = 0; b < n_bins; b++)
+			{
+				bins[b].lower = fvector(INFINITY);
+				bins[b].upper = fvector(-INFINITY);
+				bins[b].count = 0;
+			}
+
+			for (size_t i = first; i < first + count; i++)
+			{
+				const size_t b = Maths::min(size_t((refs[i].centroid[axis] - c_lower[axis]) * scale), n_bins - 1);
+				bins[b].count++;
+				grow(bins[b].lower, bins[b].upper, refs[i].lower, refs[i].upper);
+			}
+
+			//sweep from the right to get the area and count to the right of each plane
+			ftype right_area[n_bins];
+			size_t right_count[n_bins];
+			fvector lower(INFINITY);
+			fvector upper(-INFINITY);
+			size_t running = 0;
+			for (size_t b = n_bins - 1; b > 0; b--)
+			{
+				running += bins[b].count;
+				grow(lower, upper, bins[b].lower, bins[b].upper);
+				right_count[b] = running;
+				right_area[b] = running ? surface_area(lower, upper) : ftype(0);
+			}
+
+			//then from the left, evaluating the cost of each plane
+			lower = fvector(INFINITY);
+			upper = fvector(-INFINITY);
+			running = 0;
+			for (size_t b = 0; b < n_bins - 1; b++)
+			{
+				running += bins[b].count;
+				grow(lower, upper, bins[b].lower, bins[b].upper);
+				if (!running || !right_count[b + 1])
+				{
+					continue;
+				}
+				const ftype cost = traversal_cost +
+					(surface_area(lower, upper) * ftype(running) + right_area[b + 1] * ftype(right_count[b + 1])) / parent_area;
+				if (cost < best_cost)
+				{
+					best_cost = cost;
+					best_axis = axis;
+					best_split = b + 1;
+				}
+			}
+		}
+
+		//all the centroids are in the same place, or testing everything is cheaper than splitting
+		if (best_cost == ftype(INFINITY) || (count <= max_leaf_size && best_cost >= ftype(count)))
+		{
+			make_leaf(node, first, count);
+			return;
+		}
+
+		//partition the references about the chosen plane
+		const ftype extent = c_upper[best_axis] - c_lower[best_axis];
+		const ftype scale = ftype(n_bins) / extent;
+		size_t i = first;
+		size_t j = first + count;
+		while (i < j)
+		{
+			const size_t b = Maths::min(size_t((refs[i].centroid[best_axis] - c_lower[best_axis]) * scale), n_bins - 1);
+			if (b < best_split)
+			{
+				i++;
+			}
+			else
+			{
+				j--;
+				Maths::swap(refs[i], refs[j]);
+			}
+		}
+
+		//allocating can move the nodes, so node can't be used past here
+		const uint32_t left = allocate_pair();
+		nodes[index].first = left;
+		nodes[index].count = 0;
+
+		build_node(refs, left, first, i - first, depth + 1);
+		build_node(refs, left + 1, i, first + count - i, depth + 1);
+	}
+
+	//refits the subtree under nodes[index] to where its primitives are now, and gives its SAH cost as it now is
+	ftype refit(const uint32_t index, ftype* current_costs)
+	{
+		Node& node = nodes[index];
+		ftype cost;
+		if (node.is_leaf())
+		{
+			node.lower = fvector(INFINITY);
+			node.upper = fvector(-INFINITY);
+			for (size_t i = node.first; i < node.first + node.count; i++)
+			{
+				const aabbf box = primitives.get_surface(i)->make_aabb();
+				grow(node.lower, node.upper, box.get_lower_bounds(), box.get_upper_bounds());
+			}
+			cost = surface_area(node.lower, node.upper) * ftype(node.count);
+		}
+		else
+		{
+			const ftype children = refit(node.first, current_costs) + refit(node.first + 1, current_costs);
+			refit_box(node);
+			cost = surface_area(node.lower, node.upper) * traversal_cost + children;
+		}
+		current_costs[index] = cost;
+		return cost;
+	}
+
+	//makes an interior node's box the union of its children's
+	inline void refit_box(Node& node)const
+	{
+		const Node& left = nodes[node.first];
+		const Node& right = nodes[node.first + 1];
+		node.lower = left.lower;
+		node.upper = left.upper;
+		grow(node.lower, node.upper, right.lower, right.upper);
+	}
+
+	//hands every sibling pair under nodes[index] back to the free list, and finds the primitives under it
+	void retire_subtree(const uint32_t index, size_t& first, size_t& last)
+	{
+		const Node& node = nodes[index];
+		if (node.is_leaf())
+		{
+			first = Maths::min(first, size_t(node.first));
+			last = Maths::max(last, size_t(node.first + node.count));
+			return;
+		}
+		free_pairs[n_free_pairs] = node.first;
+		n_free_pairs++;
+		retire_subtree(node.first, first, last);
+		retire_subtree(node.first + 1, first, last);
+	}
+
+	//builds the subtree under nodes[index] again with the SAH, over the primitives it already has.
+	//the builder indexes references by primitive, so refs needs room for all of them
+	void rebuild_subtree(BuildReference* refs, const uint32_t index, const size_t depth)
+	{
+		size_t first = n_primitives;
+		size_t last = 0;
+		retire_subtree(index, first, last);
+		const size_t count = last - first;
+
+		for (size_t i = first; i < last; i++)
+		{
+			const aabbf box = primitives.get_surface(i)->make_aabb();
+			refs[i].lower = box.get_lower_bounds();
+			refs[i].upper = box.get_upper_bounds();
+			refs[i].centroid = box.get_center();
+			refs[i].surface = primitives.get_surface(i);
+			refs[i].index = uint32_t(i);
+		}
+		build_node(refs, index, first, count, depth);
+
+		uint32_t* old_positions = new uint32_t[count];
+		for (size_t k = 0; k < count; k++)
+		{
+			old_positions[k] = refs[first + k].index;
+		}
+		primitives.permute(first, count, old_positions);
+		delete[] old_positions;
+		compute_costs(index);
+	}
+
+	//slab test; gives the distance the ray enters the node, or INFINITY when it misses or enters beyond max_distance
+	static inline ftype entry_distance(const Node& node, const TraversalRay<ftype>& ray, const ftype max_distance)
+	{
+		ftype t_near = 0;
+		ftype t_far = max_distance;
+		for (size_t i = 0; i < 3; i++)
+		{
+			const ftype t1 = (node.lower[i] - ray.origin[i]) * ray.inv_direction[i];
+			const ftype t2 = (node.upper[i] - ray.origin[i]) * ray.inv_direction[i];
+			//the running bounds go second so a NaN from a zero direction component is ignored
+			t_near = Maths::max(Maths::min(t1, t2), t_near);
+			t_far = Maths::min(Maths::max(t1, t2), t_far);
+		}
+		//pad the far side so rounding in the surface tests can't lose hits on the boundary
+		return (t_near <= t_far / Surface<ftype>::rtolerance) ? t_near : ftype(INFINITY);
+	}
+
+public:
+	BoundingVolumeHierarchy() :
+		n_nodes(0),
+		node_capacity(0),
+		nodes(nullptr),
+		costs(nullptr),
+		free_pairs(nullptr),
+		n_free_pairs(0),
+		n_primitives(0)
+	{}
+
+	BoundingVolumeHierarchy(const BoundingVolumeHierarchy& other) = delete;
+
+	~BoundingVolumeHierarchy()
+	{
+		clear();
+	}
+
+	virtual void build() override
+	{
+		build(Surface<ftype>::get_surface_infos(), Surface<ftype>::surface_count());
+	}
+
+	//builds over infos[0, n) instead of the registered surfaces, for structures that aren't the
+	//whole scene (the shared geometry of instances)
+	void build(const SurfaceInfo* infos, const size_t n)
+	{
+		clear();
+
+		BuildReference* refs = new BuildReference[n];
+		Accelerator<ftype>::partition_surfaces(infos, n, [this, refs](const SurfaceInfo& info)
+		{
+			BuildReference& ref = refs[n_primitives];
+			ref.lower = info.m_aabb.get_lower_bounds();
+			ref.upper = info.m_aabb.get_upper_bounds();
+			ref.centroid = info.m_aabb.get_center();
+			ref.surface = info.m_surface;
+			ref.index = uint32_t(n_primitives);
+			n_primitives++;
+		});
+
+		if (n_primitives)
+		{
+			reserve_nodes(2 * n_primitives - 1);
+			n_nodes = 1;
+			build_node(refs, 0, 0, n_primitives, 0);
+			compute_costs(0);
+			layout_treelets();
+
+			//the build has put the references in leaf order
+			const Surface<ftype>** surfaces = new const Surface<ftype>*[n_primitives];
+			for (size_t i = 0; i < n_primitives; i++)
+			{
+				surfaces[i] = refs[i].surface;
+			}
+			primitives.pack(surfaces, n_primitives);
+			delete[] surfaces;
+		}
+		delete[] refs;
+	}
+
+	/*
+	* brings the tree up to date with the surfaces that have moved since it was built or last updated,
+	* without building it again:
+	*
+	*  the packed copies of the moved primitives are refreshed
+	*  every box is refitted bottom-up; the top of the tree is split into subtrees that the threads of the pool take in turn
+	*  going down from the root, the first subtree on each path whose SAH cost has grown past threshold times
+	*  its cost when it was built is rebuilt, over the same primitives
+	*
+	* surfaces can move, but not be added or removed; that needs build(). pool can be anything with
+	* thread_count() and run(job), like the RenderPool the renders use. the tree keeps its own record of
+	* which moves it has seen, so other accelerators over the same surfaces (an instance's geometry and
+	* the scene around it, say) can be updated before or after it.
+	*/
+	template<typename pool_type>
+	void update(pool_type& pool, const ftype threshold = rebuild_threshold)
+	{
+		const size_t n_threads = pool.thread_count();
+		PackedPrimitives<ftype>& packed = primitives;
+		const size_t n = n_primitives;
+		const uint64_t now = Surface<ftype>::move_time();
+		pool.run([&packed, n, n_threads](const size_t thread_index)
+		{
+			const size_t first = n * thread_index / n_threads;
+			packed.refresh_moved(first, n * (thread_index + 1) / n_threads - first);
+		});
+		packed.set_snapshot_time(now);
+		Surface<ftype>::refresh_moved_bounds();
+		if (!n_nodes)
+		{
+			return;
+		}
+
+		//open up the top of the tree until there are a few subtrees for every thread
+		uint32_t* tasks = new uint32_t[4 * n_threads + 2];
+		uint32_t* upper_nodes = new uint32_t[4 * n_threads + 2];
+		size_t n_tasks = 0;
+		size_t n_upper = 0;
+		tasks[n_tasks++] = 0;
+		while (n_tasks < 4 * n_threads)
+		{
+			size_t interior = n_tasks;
+			for (size_t i = 0; i < n_tasks; i++)
+			{
+				if (!nodes[tasks[i]].is_leaf())
+				{
+					interior = i;
+					break;
+				}
+			}
+			if (interior == n_tasks)
+			{
+				break;
+			}
+			const uint32_t opened = tasks[interior];
+			upper_nodes[n_upper++] = opened;
+			tasks[interior] = tasks[--n_tasks];
+			tasks[n_tasks++] = nodes[opened].first;
+			tasks[n_tasks++] = nodes[opened].first + 1;
+		}
+
+		ftype* current_costs = new ftype[n_nodes];
+		std::atomic<size_t> next_task(0);
+		pool.run([this, tasks, n_tasks, current_costs, &next_task](const size_t)
+		{
+			for (size_t task = next_task.fetch_add(1); task < n_tasks; task = next_task.fetch_add(1))
+			{
+				refit(tasks[task], current_costs);
+			}
+		});
+
+		//nodes were opened parents first, so going backwards visits children first
+		for (size_t i = n_upper; i > 0; i--)
+		{
+			Node& node = nodes[upper_nodes[i - 1]];
+			refit_box(node);
+			current_costs[upper_nodes[i - 1]] = surface_area(node.lower, node.upper) * traversal_cost +
+				current_costs[node.first] + current_costs[node.first + 1];
+		}
+		delete[] tasks;
+		delete[] upper_nodes;
+
+		//rebuilding keeps a subtree's box, so the boxes above it stay right
+		BuildReference* refs = nullptr;
+		uint32_t stack[max_depth];
+		size_t depths[max_depth];
+		size_t top = 0;
+		stack[top] = 0;
+		depths[top++] = 0;
+		while (top)
+		{
+			top--;
+			const uint32_t index = stack[top];
+			const size_t depth = depths[top];
+			if (current_costs[index] > threshold * costs[index])
+			{
+				if (!refs)
+				{
+					refs = new BuildReference[n_primitives];
+				}
+				rebuild_subtree(refs, index, depth);
+				continue;
+			}
+			const Node& node = nodes[index];
+			if (!node.is_leaf())
+			{
+				stack[top] = node.first + 1;
+				depths[top++] = depth + 1;
+				stack[top] = node.first;
+				depths[top++] = depth + 1;
+			}
+		}
+		delete[] refs;
+		delete[] current_costs;
+	}
+
+	void update(const ftype threshold = rebuild_threshold)
+	{
+		typename Accelerator<ftype>::SerialPool pool;
+		update(pool, threshold);
+	}
+
+	/*
+	* reorders the nodes into treelets: blocks of block_bytes that each hold a piece of the tree near its
+	* top, filled from the piece's root pair with the pairs whose parents have the largest area, since
+	* those are the ones rays visit most. The pairs left over when a block is full start blocks of their
+	* own, which follow straight after so each subtree stays in one part of the array (much like a van
+	* Emde Boas layout, but greedy). A ray then touches a handful of pages on its way down rather than one
+	* for every node.
+	*
+	* sibling pairs stay together, and start on even indices (the root is followed by an unused node) so
+	* that each pair of float nodes is one cache line. A ray reads the same lines whatever the order of the
+	* pairs, so the treelets don't save cache misses (see LayoutBenchmark), only TLB misses. A block smaller than a pair gives a plain depth-first
+	* order. The builders call this with treelet_bytes when they finish (the LBVH unless told not to); it also
+	* drops the holes that update() leaves behind after rebuilding subtrees. The frontier is a heap on area,
+	* so a layout takes O(n log block) time
+	*/
+	void layout_treelets(const size_t block_bytes = treelet_bytes)
+	{
+		if (n_nodes <= 1)
+		{
+			return;
+		}
+		const size_t treelet_pairs = Maths::max(block_bytes / (2 * sizeof(Node)), size_t(1));
+
+		//room for the padding after the root, when the builder left none
+		reserve_nodes(n_nodes + 1);
+		Node* new_nodes = new_node_array(node_capacity);
+		ftype* new_costs = new ftype[node_capacity];
+		LayoutCandidate* roots = new LayoutCandidate[n_nodes / 2 + 1];
+		LayoutCandidate* frontier = new LayoutCandidate[treelet_pairs + 2];
+		size_t n_roots = 0;
+		size_t next = 2;
+		new_nodes[0] = nodes[0];
+		new_costs[0] = costs[0];
+		new_nodes[1] = nodes[0];
+		new_costs[1] = costs[0];
+		if (!nodes[0].is_leaf())
+		{
+			roots[n_roots++] = { nodes[0].first, 0, surface_area(nodes[0].lower, nodes[0].upper) };
+		}
+
+		while (n_roots)
+		{
+			size_t n_frontier = 0;
+			frontier[n_frontier++] = roots[--n_roots];
+			for (size_t placed = 0; placed < treelet_pairs && n_frontier; placed++)
+			{
+				const LayoutCandidate pair = pop_candidate(frontier, n_frontier);
+
+				new_nodes[pair.parent].first = uint32_t(next);
+				for (size_t k = 0; k < 2; k++)
+				{
+					const Node& node = nodes[pair.pair + k];
+					new_nodes[next + k] = node;
+					new_costs[next + k] = costs[pair.pair + k];
+					if (!node.is_leaf())
+					{
+						push_candidate(frontier, n_frontier, { node.first, uint32_t(next + k), surface_area(node.lower, node.upper) });
+					}
+				}
+				next += 2;
+			}
+
+			//the most likely of what is left, the top of the heap, goes on top, so its block comes next
+			for (size_t i = n_frontier; i-- > 0;)
+			{
+				roots[n_roots++] = frontier[i];
+			}
+		}
+		delete[] roots;
+		delete[] frontier;
+
+		delete_node_array(nodes);
+		delete[] costs;
+		nodes = new_nodes;
+		costs = new_costs;
+		n_nodes = next;
+		n_free_pairs = 0;
+	}
+
+	using Accelerator<ftype>::first_intersection;
+	using Accelerator<ftype>::occluded;
+
+	virtual Intersection<ftype> first_intersection(const linef& ray, const TraversalRay<ftype>& traversal)const override
+	{
+		Intersection<ftype> info = Accelerator<ftype>::unbounded_intersection(ray);
+		if (!n_nodes)
+		{
+			return info;
+		}
+
+		StackEntry stack[max_depth];
+		size_t top = 0;
+		const ftype root_distance = entry_distance(nodes[0], traversal, info.upper_bound);
+		if (root_distance == ftype(INFINITY))
+		{
+			return info;
+		}
+		stack[top++] = { 0, root_distance };
+
+		while (top)
+		{
+			const StackEntry entry = stack[--top];
+			//a closer hit may have been found since this node was pushed
+			if (entry.distance > info.upper_bound)
+			{
+				continue;
+			}
+
+			const Node& node = nodes[entry.node];
+			if (node.is_leaf())
+			{
+				primitives.update(info, node.first, node.count, ray);
+				continue;
+			}
+
+			//visit the nearer child first so the far one can be culled by its hit
+			uint32_t near_child = node.first;
+			uint32_t far_child = node.first + 1;
+			ftype near_distance = entry_distance(nodes[near_child], traversal, info.upper_bound);
+			ftype far_distance = entry_distance(nodes[far_child], traversal, info.upper_bound);
+			if (far_distance < near_distance)
+			{
+				Maths::swap(near_child, far_child);
+				Maths::swap(near_distance, far_distance);
+			}
+
+			if (far_distance != ftype(INFINITY))
+			{
+				stack[top++] = { far_child, far_distance };
+			}
+			if (near_distance != ftype(INFINITY))
+			{
+				stack[top++] = { near_child, near_distance };
+			}
+		}
+		return info;
+	}
+
+	virtual bool occluded(const linef& ray, const TraversalRay<ftype>& traversal, const ftype max_distance)const override
+	{
+		//unbounded surfaces are cheap and block a lot of rays, so they go first
+		if (Accelerator<ftype>::unbounded_occluded(ray, max_distance))
+		{
+			return true;
+		}
+		if (!n_nodes)
+		{
+			return false;
+		}
+
+		//any blocker will do, so there is no need to order the children
+		uint32_t stack[max_depth];
+		size_t top = 0;
+		stack[top++] = 0;
+		while (top)
+		{
+			const Node& node = nodes[stack[--top]];
+			if (entry_distance(node, traversal, max_distance) == ftype(INFINITY))
+			{
+				continue;
+			}
+
+			if (node.is_leaf())
+			{
+				if (primitives.occludes(node.first, node.count, ray, max_distance))
+				{
+					return true;
+				}
+				continue;
+			}
+			stack[top++] = node.first + 1;
+			stack[top++] = node.first;
+		}
+		return false;
+	}
+
+	/*
+	* writes the built tree to file: the nodes and their costs as they are in memory, then the packed
+	* primitives and the unbounded list. Surfaces are written as index_of(surface), their position in the
+	* list that read() will be given, and the write fails if that is PackedPrimitives::no_index for any of them.
+	* Only a file written by the same build of the program can be read back
+	*/
+	template<typename index_function>
+	bool write(FILE* file, const index_function& index_of)const
+	{
+		const uint64_t counts[2] = { n_nodes, n_primitives };
+		return fwrite(counts, sizeof(uint64_t), 2, file) == 2 &&
+			fwrite(nodes, sizeof(Node), n_nodes, file) == n_nodes &&
+			fwrite(costs, sizeof(ftype), n_nodes, file) == n_nodes &&
+			primitives.write(file, index_of) &&
+			Accelerator<ftype>::unbounded.write(file, index_of);
+	}
+
+	//reads a tree written by write(), linking it to surface_list[0, n_surfaces); false, with the tree left empty, if the file is bad
+	bool read(FILE* file, const Surface<ftype>* const* surface_list, const size_t n_surfaces)
+	{
+		clear();
+		uint64_t counts[2];
+		if (fread(counts, sizeof(uint64_t), 2, file) != 2 || counts[0] > 2 * counts[1])
+		{
+			return false;
+		}
+		reserve_nodes(size_t(counts[0]));
+		n_nodes = size_t(counts[0]);
+		n_primitives = size_t(counts[1]);
+		bool good = fread(nodes, sizeof(Node), n_nodes, file) == n_nodes &&
+			fread(costs, sizeof(ftype), n_nodes, file) == n_nodes &&
+			primitives.read(file, surface_list, n_surfaces) &&
+			Accelerator<ftype>::unbounded.read(file, surface_list, n_surfaces) &&
+			primitives.size() == n_primitives;
+
+		//the traversal trusts the links, so check that they make a tree no deeper than its stacks
+		if (good && n_nodes)
+		{
+			bool* visited = new bool[n_nodes]();
+			uint32_t stack[max_depth];
+			size_t depths[max_depth];
+			size_t top = 0;
+			stack[top] = 0;
+			depths[top++] = 0;
+			while (good && top)
+			{
+				top--;
+				const uint32_t index = stack[top];
+				const size_t depth = depths[top];
+				const Node& node = nodes[index];
+				good = !visited[index] && depth < max_depth;
+				visited[index] = true;
+				if (!good || node.is_leaf())
+				{
+					good = good && size_t(node.first) + node.count <= n_primitives;
+					continue;
+				}
+				good = size_t(node.first) + 1 < n_nodes && depth + 1 < max_depth;
+				if (good)
+				{
+					stack[top] = node.first;
+					depths[top++] = depth + 1;
+					stack[top] = node.first + 1;
+					depths[top++] = depth + 1;
+				}
+			}
+			delete[] visited;
+		}
+		if (!good)
+		{
+			clear();
+		}
+		return good;
+	}
+
+	inline const size_t& node_count()const { return n_nodes; }
+	inline const size_t& primitive_count()const { return n_primitives; }
+	inline const Node* get_nodes()const { return nodes; }
+	inline const PackedPrimitives<ftype>& get_primitives()const { return primitives; }
+};
+
+#endif
@@ -0,0 +1,707 @@
+#ifndef COMPACT_BOUNDING_VOLUME_HIERARCHY_H
+#define COMPACT_BOUNDING_VOLUME_HIERARCHY_H
+
+#include "WideBoundingVolumeHierarchy.h"
+
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <new>
+#include <stdint.h>
+
+/*
+* A 4-wide bounding volume hierarchy with quantized nodes, for scenes so big that the nodes of the other
+* trees no longer fit in the caches. It is made by collapsing the binary SAH tree, like
+* WideBoundingVolumeHierarchy, and traversed the same way.
+*
+* a node keeps the boxes of its children as 8 bit codes on a grid over its own box, rounded outwards so
+* they only ever grow. Its own box isn't stored: only the root's grid is kept in full, and the traversal
+* carries the grid of each child down the stack. The child nodes of a node are stored next to each other,
+* as are the primitives of its leaf children, so the links are two 24 bit indices and 4 bits per child,
+* packed into one word. That is 32 bytes for 4 children, against 32 bytes per child in the binary tree and
+* 33 in the float 4-wide one, and the node array starts on a cache line so no node is split over two. The
+* indices hold the tree to 2^24 nodes and as many primitives.
+*
+* the slab test works on the codes directly: the plane at code q lies q steps from the corner of the grid,
+* so the ray reaches it at q * (step / d) + (corner - origin) / d, one multiply-add per plane. The grids
+* are carried as the ray sees them, as those two terms (a Frame), and a child's are just the distances to
+* its own lower and upper planes, which the slab test has already worked out. Leaves reference ranges of
+* the packed primitives, as in the other trees.
+*
+* the decoding still costs something at every node. With 60k primitives and incoherent rays it traces
+* about 8% slower than the 4-wide tree, whose nodes are then four times the size, but a small scene that
+* sits in the caches anyway is about 1.6 times slower. So Scene::render never picks it for itself.
+*/
+
+template<typename ftype>
+class CompactBoundingVolumeHierarchy : public Accelerator<ftype>
+{
+public:
+	typedef Maths::Vector<ftype, 3> fvector;
+	typedef Geometry::Space<ftype, 1, 3> linef;
+	typedef BoundingVolumeHierarchy<ftype> BinaryTree;
+	typedef typename BinaryTree::Node BinaryNode;
+
+	static constexpr size_t width = 4;
+
+	struct Node
+	{
+		uint8_t lower_x[width];
+		uint8_t lower_y[width];
+		uint8_t lower_z[width];
+		uint8_t upper_x[width];
+		uint8_t upper_y[width];
+		uint8_t upper_z[width];
+		//the first of the node's child nodes in the low base_bits, then the first primitive of its leaf
+		//children (in slot order), then slot_bits per slot: empty_slot, node_slot, or the size of a leaf
+		uint64_t links;
+	};
+
+	static constexpr unsigned int base_bits = 24;
+	static constexpr unsigned int slot_bits = 4;
+	static constexpr uint64_t base_mask = (uint64_t(1) << base_bits) - 1;
+	static constexpr size_t max_index = size_t(base_mask);
+
+	static constexpr uint32_t empty_slot = 0;
+	static constexpr uint32_t node_slot = 15;
+	static constexpr uint32_t max_leaf_size = 14;
+
+	static constexpr size_t cache_line = 64;
+
+	//a node's box is cut into 254 steps. Codes go up to 255, so the last one lies past the far side and
+	//rounding outwards never runs off the grid
+	static constexpr ftype inv_levels = ftype(1) / ftype(254);
+
+	//the binary tree's depth, plus the nodes that split up leaves too big for one slot
+	static constexpr size_t max_depth = BinaryTree::max_depth + 16;
+
+	//the grid over a node's box: the corner its codes count from and the length of a step on each axis
+	struct Grid
+	{
+		ftype lower[3];
+		ftype step[3];
+	};
+
+	//a grid as a ray sees it: the distance along the ray to the grid's corner on each axis, and how much
+	//further each step takes it. they are infinite or NaN on an axis the ray doesn't move along, which
+	//the slab test ignores
+	struct Frame
+	{
+		ftype offset[3];
+		ftype scale[3];
+	};
+
+	//the frames of all the children of a node, which the slab test works out on the way
+	struct ChildFrames
+	{
+		ftype offset[3][width];
+		ftype scale[3][width];
+
+		inline void get(const size_t i, Frame& frame)const
+		{
+			for (size_t axis = 0; axis < 3; axis++)
+			{
+				frame.offset[axis] = offset[axis][i];
+				frame.scale[axis] = scale[axis][i];
+			}
+		}
+	};
+
+private:
+	static_assert(sizeof(Node) == 32, "a node should be 32 bytes");
+
+	struct StackEntry
+	{
+		uint32_t child;
+		uint32_t count;     //0 for a node
+		ftype distance;
+		Frame frame;        //only set for a node
+	};
+
+	struct OcclusionEntry
+	{
+		uint32_t node;
+		Frame frame;
+	};
+
+	//a child while the tree is being made: an interior binary node, or a run of primitives of the
+	//binary tree's leaves. runs longer than max_leaf_size get a node of their own
+	struct BuildChild
+	{
+		fvector lower;
+		fvector upper;
+		uint32_t binary;
+		uint32_t first;
+		uint32_t count;     //0 for a binary node
+
+		inline bool needs_node()const { return !count || count > max_leaf_size; }
+	};
+
+	size_t n_nodes;
+	size_t node_capacity;
+	Node* nodes;
+	Grid root;
+
+	size_t n_primitives;
+	PackedPrimitives<ftype> primitives;      //in leaf order
+
+	//a node array that starts on a cache line, like BoundingVolumeHierarchy's; the block that was really
+	//allocated is kept just before the array
+	static Node* new_node_array(const size_t capacity)
+	{
+		unsigned char* block = new unsigned char[capacity * sizeof(Node) + sizeof(unsigned char*) + cache_line];
+		const uintptr_t start = (uintptr_t(block) + sizeof(unsigned char*) + cache_line - 1) & ~uintptr_t(cache_line - 1);
+		reinterpret_cast<unsigned char**>(start)[-1] = block;
+		Node* array = reinterpret_cast<Node*>(start);
+		for (size_t i = 0; i < capacity; i++)
+		{
+			new (array + i) Node();
+		}
+		return array;
+	}
+
+	static void delete_node_array(Node* array)
+	{
+		if (array)
+		{
+			delete[] reinterpret_cast<unsigned char**>(array)[-1];
+		}
+	}
+
+	void clear()
+	{
+		delete_node_array(nodes);
+		nodes = nullptr;
+		primitives.clear();
+		Accelerator<ftype>::unbounded.clear();
+		n_nodes = 0;
+		node_capacity = 0;
+		n_primitives = 0;
+	}
+
+	//makes room for n more nodes and gives the index of the first
+	uint32_t allocate_nodes(const size_t n)
+	{
+		if (n_nodes + n > node_capacity)
+		{
+			const size_t capacity = 2 * (n_nodes + n);
+			Node* new_nodes = new_node_array(capacity);
+			for (size_t i = 0; i < n_nodes; i++)
+			{
+				new_nodes[i] = nodes[i];
+			}
+			delete_node_array(nodes);
+			nodes = new_nodes;
+			node_capacity = capacity;
+		}
+		const uint32_t first = uint32_t(n_nodes);
+		n_nodes += n;
+		assert(n_nodes <= max_index + 1 && "too many nodes for the compact bvh's links");
+		return first;
+	}
+
+	static inline ftype surface_area(const BinaryNode& node)
+	{
+		const fvector d = node.upper - node.lower;
+		return ftype(2) * (d.x * d.y + d.y * d.z + d.z * d.x);
+	}
+
+	static inline BuildChild make_child(const BinaryNode* binary_nodes, const uint32_t index)
+	{
+		const BinaryNode& node = binary_nodes[index];
+		return { node.lower, node.upper, index, node.first, node.count };
+	}
+
+	static inline ftype decode(const ftype lower, const ftype step, const uint8_t code)
+	{
+		return lower + ftype(code) * step;
+	}
+
+	//the grid of child i of a node on grid. the builder places the children's children on these grids
+	static inline void child_grid(const Node& node, const size_t i, const Grid& grid, Grid& child)
+	{
+		const uint8_t lower_codes[3] = { node.lower_x[i], node.lower_y[i], node.lower_z[i] };
+		const uint8_t upper_codes[3] = { node.upper_x[i], node.upper_y[i], node.upper_z[i] };
+		for (size_t axis = 0; axis < 3; axis++)
+		{
+			const ftype lower = decode(grid.lower[axis], grid.step[axis], lower_codes[axis]);
+			const ftype upper = decode(grid.lower[axis], grid.step[axis], upper_codes[axis]);
+			child.lower[axis] = lower;
+			child.step[axis] = (upper - lower) * inv_levels;
+		}
+	}
+
+	static inline uint32_t slot(const Node& node, const size_t i)
+	{
+		return uint32_t(node.links >> (2 * base_bits + slot_bits * i)) & ((1u << slot_bits) - 1);
+	}
+
+	static inline uint64_t make_links(const uint32_t child_base, const uint32_t primitive_base, const uint32_t* slots)
+	{
+		uint64_t links = uint64_t(child_base) | (uint64_t(primitive_base) << base_bits);
+		for (size_t i = 0; i < width; i++)
+		{
+			links |= uint64_t(slots[i]) << (2 * base_bits + slot_bits * i);
+		}
+		return links;
+	}
+
+	//the codes of the slab [lower, upper] on one axis of a grid. checked against decode() itself, so the
+	//decoded slab always holds the real one
+	static void quantize(const ftype grid_lower, const ftype step, const ftype lower, const ftype upper, uint8_t& lower_code, uint8_t& upper_code)
+	{
+		if (!(step > 0))
+		{
+			lower_code = 0;
+			upper_code = 0;
+			return;
+		}
+		const ftype low = Maths::min(Maths::max(ftype(floor((lower - grid_lower) / step)), ftype(0)), ftype(255));
+		const ftype high = Maths::min(Maths::max(ftype(ceil((upper - grid_lower) / step)), ftype(0)), ftype(255));
+		unsigned int l = unsigned(low);
+		unsigned int h = unsigned(high);
+		while (l > 0 && decode(grid_lower, step, uint8_t(l)) > lower)
+		{
+			l--;
+		}
+		while (h < 255 && decode(grid_lower, step, uint8_t(h)) < upper)
+		{
+			h++;
+		}
+		lower_code = uint8_t(l);
+		upper_code = uint8_t(h);
+	}
+
+	//bit i is set if slot i holds a child. The four slots are the top 16 bits of links, so each is or-ed
+	//down into its lowest bit, and those four bits are gathered together
+	static inline unsigned int occupied_slots(const Node& node)
+	{
+		static_assert(width == 4 && slot_bits == 4 && empty_slot == 0, "the slots should be four nibbles");
+		const uint32_t slots = uint32_t(node.links >> (2 * base_bits));
+		const uint32_t any = (slots | (slots >> 1) | (slots >> 2) | (slots >> 3)) & 0x1111u;
+		return (any | (any >> 3) | (any >> 6) | (any >> 9)) & 0xfu;
+	}
+
+	//the frame of the root's grid for a ray
+	inline void root_frame(const TraversalRay<ftype>& ray, Frame& frame)const
+	{
+		for (size_t axis = 0; axis < 3; axis++)
+		{
+			frame.offset[axis] = (root.lower[axis] - ray.origin[axis]) * ray.inv_direction[axis];
+			frame.scale[axis] = root.step[axis] * ray.inv_direction[axis];
+		}
+	}
+
+	/*
+	* the slab test against every child of a node, like WideNode::intersect. Bit i of the result is set
+	* if the ray enters child i before max_distance, and t_near[i] is then the distance it enters at.
+	* The distances to a child's lower planes are its frame's offsets, so children gets every child's
+	* frame too: its scales are the spans of the child's codes over the levels
+	*/
+	static inline unsigned int intersect(
+		const Node& node,
+		const Frame& frame,
+		const TraversalRay<ftype>& ray,
+		const ftype max_distance,
+		ftype* t_near,
+		ChildFrames& children)
+	{
+		const unsigned int occupied = occupied_slots(node);
+
+#ifdef WIDE_BVH_SSE
+		if (sizeof(ftype) == sizeof(float))
+		{
+			//the codes are stored one after another, so two loads widen all 24 of them: the first 16 are
+			//the lower x, y and z and upper x codes, the last 8 the upper y and z codes
+			const __m128i zero = _mm_setzero_si128();
+			const __m128i first = _mm_loadu_si128(reinterpret_cast<const __m128i*>(node.lower_x));
+			const __m128i last = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(node.upper_y));
+			const __m128i lower_xy = _mm_unpacklo_epi8(first, zero);
+			const __m128i lower_z_upper_x = _mm_unpackhi_epi8(first, zero);
+			const __m128i upper_yz = _mm_unpacklo_epi8(last, zero);
+
+			const __m128 sx = _mm_set1_ps(float(frame.scale[0]));
+			const __m128 sy = _mm_set1_ps(float(frame.scale[1]));
+			const __m128 sz = _mm_set1_ps(float(frame.scale[2]));
+			const __m128 ox = _mm_set1_ps(float(frame.offset[0]));
+			const __m128 oy = _mm_set1_ps(float(frame.offset[1]));
+			const __m128 oz = _mm_set1_ps(float(frame.offset[2]));
+			const __m128 lower_x = _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(lower_xy, zero)), sx), ox);
+			const __m128 lower_y = _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(lower_xy, zero)), sy), oy);
+			const __m128 lower_z = _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(lower_z_upper_x, zero)), sz), oz);
+			const __m128 upper_x = _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(lower_z_upper_x, zero)), sx), ox);
+			const __m128 upper_y = _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(upper_yz, zero)), sy), oy);
+			const __m128 upper_z = _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(upper_yz, zero)), sz), oz);
+
+			//_mm_max_ps and _mm_min_ps return their second argument when either is NaN, like Maths::max/min
+			__m128 t0 = _mm_max_ps(ray.sign[0] ? upper_x : lower_x, _mm_setzero_ps());
+			t0 = _mm_max_ps(ray.sign[1] ? upper_y : lower_y, t0);
+			t0 = _mm_max_ps(ray.sign[2] ? upper_z : lower_z, t0);
+			__m128 t1 = _mm_min_ps(ray.sign[0] ? lower_x : upper_x, _mm_set1_ps(float(max_distance)));
+			t1 = _mm_min_ps(ray.sign[1] ? lower_y : upper_y, t1);
+			t1 = _mm_min_ps(ray.sign[2] ? lower_z : upper_z, t1);
+
+			//only reached for float, so the frames can be stored straight into children
+			const __m128 levels = _mm_set1_ps(float(inv_levels));
+			_mm_storeu_ps(reinterpret_cast<float*>(children.offset[0]), lower_x);
+			_mm_storeu_ps(reinterpret_cast<float*>(children.offset[1]), lower_y);
+			_mm_storeu_ps(reinterpret_cast<float*>(children.offset[2]), lower_z);
+			_mm_storeu_ps(reinterpret_cast<float*>(children.scale[0]), _mm_mul_ps(_mm_sub_ps(upper_x, lower_x), levels));
+			_mm_storeu_ps(reinterpret_cast<float*>(children.scale[1]), _mm_mul_ps(_mm_sub_ps(upper_y, lower_y), levels));
+			_mm_storeu_ps(reinterpret_cast<float*>(children.scale[2]), _mm_mul_ps(_mm_sub_ps(upper_z, lower_z), levels));
+
+			float near[width];
+			_mm_storeu_ps(near, t0);
+			for (size_t i = 0; i < width; i++)
+			{
+				t_near[i] = ftype(near[i]);
+			}
+			const __m128 padded = _mm_div_ps(t1, _mm_set1_ps(float(Surface<ftype>::rtolerance)));
+			return unsigned(_mm_movemask_ps(_mm_cmple_ps(t0, padded))) & occupied;
+		}
+#endif
+
+		const uint8_t* lower_codes[3] = { node.lower_x, node.lower_y, node.lower_z };
+		const uint8_t* upper_codes[3] = { node.upper_x, node.upper_y, node.upper_z };
+		unsigned int mask = 0;
+		for (size_t i = 0; i < width; i++)
+		{
+			ftype t0 = 0;
+			ftype t1 = max_distance;
+			for (size_t axis = 0; axis < 3; axis++)
+			{
+				const ftype lower = ftype(lower_codes[axis][i]) * frame.scale[axis] + frame.offset[axis];
+				const ftype upper = ftype(upper_codes[axis][i]) * frame.scale[axis] + frame.offset[axis];
+				children.offset[axis][i] = lower;
+				children.scale[axis][i] = (upper - lower) * inv_levels;
+				//the running bounds go second so a NaN from a zero direction component is ignored
+				t0 = Maths::max(ray.sign[axis] ? upper : lower, t0);
+				t1 = Maths::min(ray.sign[axis] ? lower : upper, t1);
+			}
+			t_near[i] = t0;
+			//pad the far side so rounding in the surface tests can't lose hits on the boundary
+			mask |= unsigned(t0 <= t1 / Surface<ftype>::rtolerance) << i;
+		}
+		return mask & occupied;
+	}
+
+	//where each child of node is: a node index, or the first primitive of a leaf and how many it has
+	static inline void find_children(const Node& node, uint32_t* child, uint32_t* count)
+	{
+		uint32_t next_node = uint32_t(node.links & base_mask);
+		uint32_t next_primitive = uint32_t((node.links >> base_bits) & base_mask);
+		for (size_t i = 0; i < width; i++)
+		{
+			const uint32_t kind = slot(node, i);
+			const bool is_node = kind == node_slot;
+			child[i] = is_node ? next_node : next_primitive;
+			count[i] = is_node ? 0 : kind;
+			next_node += is_node;
+			next_primitive += count[i];
+		}
+	}
+
+	//the children of parent: the binary children with the largest area are opened up first, until there
+	//are width of them, and runs too long for one leaf are cut into pieces
+	size_t open(const BinaryNode* binary_nodes, const BuildChild& parent, BuildChild* children)const
+	{
+		if (parent.count)
+		{
+			const uint32_t piece = (parent.count + width - 1) / width;
+			size_t n_children = 0;
+			for (uint32_t first = 0; first < parent.count; first += piece)
+			{
+				const uint32_t count = Maths::min(piece, parent.count - first);
+				children[n_children] = { parent.lower, parent.upper, parent.binary, parent.first + first, count };
+				n_children++;
+			}
+			return n_children;
+		}
+
+		size_t n_children = 2;
+		children[0] = make_child(binary_nodes, binary_nodes[parent.binary].first);
+		children[1] = make_child(binary_nodes, binary_nodes[parent.binary].first + 1);
+		while (n_children < width)
+		{
+			size_t best = width;
+			ftype best_area = -INFINITY;
+			for (size_t i = 0; i < n_children; i++)
+			{
+				const BinaryNode& candidate = binary_nodes[children[i].binary];
+				if (!children[i].count && surface_area(candidate) > best_area)
+				{
+					best = i;
+					best_area = surface_area(candidate);
+				}
+			}
+			if (best == width)
+			{
+				break;
+			}
+			const uint32_t opened = children[best].binary;
+			children[best] = make_child(binary_nodes, binary_nodes[opened].first);
+			children[n_children] = make_child(binary_nodes, binary_nodes[opened].first + 1);
+			n_children++;
+		}
+		return n_children;
+	}
+
+	//fills in nodes[index] for parent, whose grid is grid, and everything under it. the primitives are
+	//added to leaf_order as their leaves are made
+	void fill(
+		const BinaryNode* binary_nodes,
+		const PackedPrimitives<ftype>& binary_primitives,
+		const BuildChild& parent,
+		const uint32_t index,
+		const Grid& grid,
+		const Surface<ftype>** leaf_order)
+	{
+		BuildChild children[width];
+		const size_t n_children = open(binary_nodes, parent, children);
+
+		size_t n_child_nodes = 0;
+		for (size_t i = 0; i < n_children; i++)
+		{
+			n_child_nodes += children[i].needs_node();
+		}
+		const uint32_t child_base = allocate_nodes(n_child_nodes);
+		const uint32_t primitive_base = uint32_t(n_primitives);
+		assert(n_primitives <= max_index && "too many primitives for the compact bvh's links");
+
+		Node& node = nodes[index];
+		uint32_t slots[width];
+		for (size_t i = 0; i < width; i++)
+		{
+			if (i >= n_children)
+			{
+				slots[i] = empty_slot;
+				node.lower_x[i] = node.lower_y[i] = node.lower_z[i] = 0;
+				node.upper_x[i] = node.upper_y[i] = node.upper_z[i] = 0;
+				continue;
+			}
+			const BuildChild& child = children[i];
+			quantize(grid.lower[0], grid.step[0], child.lower.x, child.upper.x, node.lower_x[i], node.upper_x[i]);
+			quantize(grid.lower[1], grid.step[1], child.lower.y, child.upper.y, node.lower_y[i], node.upper_y[i]);
+			quantize(grid.lower[2], grid.step[2], child.lower.z, child.upper.z, node.lower_z[i], node.upper_z[i]);
+			if (child.needs_node())
+			{
+				slots[i] = node_slot;
+				continue;
+			}
+			slots[i] = child.count;
+			for (uint32_t j = 0; j < child.count; j++)
+			{
+				leaf_order[n_primitives] = binary_primitives.get_surface(child.first + j);
+				n_primitives++;
+			}
+		}
+		node.links = make_links(child_base, primitive_base, slots);
+
+		//nodes may have moved while the children are filled, so the grids are all worked out first
+		Grid child_grids[width];
+		for (size_t i = 0; i < n_children; i++)
+		{
+			child_grid(nodes[index], i, grid, child_grids[i]);
+		}
+		uint32_t next = child_base;
+		for (size_t i = 0; i < n_children; i++)
+		{
+			if (children[i].needs_node())
+			{
+				fill(binary_nodes, binary_primitives, children[i], next, child_grids[i], leaf_order);
+				next++;
+			}
+		}
+	}
+
+public:
+	CompactBoundingVolumeHierarchy() :
+		n_nodes(0),
+		node_capacity(0),
+		nodes(nullptr),
+		n_primitives(0)
+	{}
+
+	CompactBoundingVolumeHierarchy(const CompactBoundingVolumeHierarchy& other) = delete;
+
+	~CompactBoundingVolumeHierarchy()
+	{
+		clear();
+	}
+
+	virtual void build() override
+	{
+		BinaryTree binary;
+		binary.build();
+		build(binary);
+	}
+
+	//compresses a binary tree that has already been built over the registered surfaces
+	void build(const BinaryTree& binary)
+	{
+		clear();
+		Accelerator<ftype>::partition_surfaces([](const typename Surface<ftype>::SurfaceInfo&) {});
+		if (!binary.primitive_count())
+		{
+			return;
+		}
+
+		//the root always gets a node, even when the binary tree is a single leaf
+		const BuildChild top = make_child(binary.get_nodes(), 0);
+		for (size_t axis = 0; axis < 3; axis++)
+		{
+			root.lower[axis] = top.lower[axis];
+			root.step[axis] = (top.upper[axis] - top.lower[axis]) * inv_levels;
+		}
+		const Surface<ftype>** leaf_order = new const Surface<ftype>*[binary.primitive_count()];
+		allocate_nodes(1);
+		fill(binary.get_nodes(), binary.get_primitives(), top, 0, root, leaf_order);
+		primitives.pack(leaf_order, n_primitives);
+		delete[] leaf_order;
+	}
+
+	using Accelerator<ftype>::first_intersection;
+	using Accelerator<ftype>::occluded;
+
+	virtual Intersection<ftype> first_intersection(const linef& ray, const TraversalRay<ftype>& traversal)const override
+	{
+		Intersection<ftype> info = Accelerator<ftype>::unbounded_intersection(ray);
+		if (!n_nodes)
+		{
+			return info;
+		}
+
+		StackEntry stack[max_depth * width];
+		size_t top = 0;
+		stack[top].child = 0;
+		stack[top].count = 0;
+		stack[top].distance = 0;
+		root_frame(traversal, stack[top].frame);
+		top++;
+
+		while (top)
+		{
+			const StackEntry& entry = stack[--top];
+			//a closer hit may have been found since this child was pushed
+			if (entry.distance > info.upper_bound)
+			{
+				continue;
+			}
+
+			if (entry.count)
+			{
+				primitives.update(info, entry.child, entry.count, ray);
+				continue;
+			}
+
+			//the entry is overwritten by the pushes below, which take their frames from children
+			const Node& node = nodes[entry.child];
+			ftype t_near[width];
+			ChildFrames children;
+			unsigned int mask = intersect(node, entry.frame, traversal, info.upper_bound, t_near, children);
+			if (!mask)
+			{
+				continue;
+			}
+
+			//the children that were hit, far to near, so the nearest ends up on top of the stack
+			size_t order[width];
+			size_t n_hit = 0;
+			for (size_t i = 0; mask; i++, mask >>= 1)
+			{
+				if (mask & 1u)
+				{
+					size_t j = n_hit;
+					while (j > 0 && t_near[order[j - 1]] < t_near[i])
+					{
+						order[j] = order[j - 1];
+						j--;
+					}
+					order[j] = i;
+					n_hit++;
+				}
+			}
+
+			uint32_t child[width];
+			uint32_t count[width];
+			find_children(node, child, count);
+			for (size_t k = 0; k < n_hit; k++)
+			{
+				const size_t i = order[k];
+				StackEntry& pushed = stack[top++];
+				pushed.child = child[i];
+				pushed.count = count[i];
+				pushed.distance = t_near[i];
+				if (!count[i])
+				{
+					children.get(i, pushed.frame);
+				}
+			}
+		}
+		return info;
+	}
+
+	virtual bool occluded(const linef& ray, const TraversalRay<ftype>& traversal, const ftype max_distance)const override
+	{
+		//unbounded surfaces are cheap and block a lot of rays, so they go first
+		if (Accelerator<ftype>::unbounded_occluded(ray, max_distance))
+		{
+			return true;
+		}
+		if (!n_nodes)
+		{
+			return false;
+		}
+
+		//any blocker will do, so the children aren't ordered
+		OcclusionEntry stack[max_depth * width];
+		size_t top = 0;
+		stack[top].node = 0;
+		root_frame(traversal, stack[top].frame);
+		top++;
+		while (top)
+		{
+			const OcclusionEntry& entry = stack[--top];
+			const Node& node = nodes[entry.node];
+			ftype t_near[width];
+			ChildFrames children;
+			unsigned int mask = intersect(node, entry.frame, traversal, max_distance, t_near, children);
+			if (!mask)
+			{
+				continue;
+			}
+
+			uint32_t child[width];
+			uint32_t count[width];
+			find_children(node, child, count);
+			for (size_t i = 0; mask; i++, mask >>= 1)
+			{
+				if (!(mask & 1u))
+				{
+					continue;
+				}
+				if (!count[i])
+				{
+					stack[top].node = child[i];
+					children.get(i, stack[top].frame);
+					top++;
+				}
+				else if (primitives.occludes(child[i], count[i], ray, max_distance))
+				{
+					return true;
+				}
+			}
+		}
+		return false;
+	}
+
+	//the bytes taken by the nodes
+	inline size_t node_memory()const { return n_nodes * sizeof(Node); }
+
+	inline const size_t& node_count()const { return n_nodes; }
+	inline const size_t& primitive_count()const { return n_primitives; }
+	inline const Node* get_nodes()const { return nodes; }
+	inline const PackedPrimitives<ftype>& get_primitives()const { return primitives; }
+};
+
+#endif
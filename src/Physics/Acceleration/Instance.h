@@ -0,0 +1,231 @@
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+#include "Surfaces/Surface.h"
+#include "Physics/Intersection.h"
+#include "BoundingVolumeHierarchy.h"
+#include "Geometry/CompoundObject.h"
+
+/*
+* Two-level instancing: the same geometry placed in the scene many times without copying it.
+*
+* InstanceGeometry is the bottom level. It takes a set of surfaces, described in their own space,
+* out of the scene and builds a BVH over them that is shared by every instance of it.
+*
+* Instance is a surface in the scene like any other, so the scene's accelerator is the top level and
+* never sees the parts. An instance holds a pointer to its geometry and a placement (a scale, then a
+* rotation, then a translation); a ray that reaches it is moved into the geometry's space and traced
+* through the shared BVH. The cost of an instance is that placement and its Surface, whatever the size
+* of the geometry, so memory grows with the unique geometry and not with the number of copies.
+*
+* a hit on an instance reports the part it landed on as well (see Intersection::instance), which the
+* instance turns into a normal and a material in the scene's space. An instance can be given a material
+* of its own to use in place of its parts'; with none, the parts keep theirs.
+*
+* instances can't be nested, and the geometry is fixed once it is built. Instances themselves can be
+* moved with set_placement, which the accelerators' update() picks up like any other moved surface.
+*/
+
+template<typename ftype>
+class InstanceGeometry
+{
+public:
+	typedef Maths::Vector<ftype, 3> fvector;
+	typedef Geometry::Space<ftype, 1, 3> linef;
+	typedef Geometry::AxisAlignedBoundingBox<ftype, 3> aabbf;
+	typedef typename Surface<ftype>::SurfaceInfo SurfaceInfo;
+private:
+	BoundingVolumeHierarchy<ftype> hierarchy;
+public:
+	InstanceGeometry() = delete;
+
+	//withdraws surfaces[0, n) from the scene and builds the shared structure over them.
+	//the surfaces must outlive the geometry, and the geometry must outlive its instances
+	InstanceGeometry(Surface<ftype>* const* surfaces, const size_t n)
+	{
+		SurfaceInfo* infos = new SurfaceInfo[n];
+		for (size_t i = 0; i < n; i++)
+		{
+			Surface<ftype>::withdraw(surfaces[i]);
+			infos[i] = SurfaceInfo(surfaces[i], surfaces[i]->make_aabb(), surfaces[i]->make_bounding_sphere());
+		}
+		hierarchy.build(infos, n);
+		delete[] infos;
+	}
+
+	InstanceGeometry(const InstanceGeometry& other) = delete;
+
+	inline bool is_bounded()const
+	{
+		return hierarchy.node_count() && !hierarchy.unbounded_count();
+	}
+
+	//the bounds of the geometry in its own space; infinite if any part is unbounded
+	const aabbf make_aabb()const
+	{
+		if (!is_bounded())
+		{
+			return aabbf({ -INFINITY, -INFINITY, -INFINITY }, { INFINITY, INFINITY, INFINITY });
+		}
+		const typename BoundingVolumeHierarchy<ftype>::Node& root = hierarchy.get_nodes()[0];
+		return aabbf(root.lower, root.upper);
+	}
+
+	inline Intersection<ftype> first_intersection(const linef& ray)const
+	{
+		return hierarchy.first_intersection(ray);
+	}
+
+	inline bool occluded(const linef& ray, const ftype max_distance)const
+	{
+		return hierarchy.occluded(ray, max_distance);
+	}
+
+	inline const BoundingVolumeHierarchy<ftype>& get_hierarchy()const { return hierarchy; }
+};
+
+
+template<typename ftype>
+class Instance : public Geometry::Placement<ftype>, public Surface<ftype>
+{
+public:
+	typedef Maths::Vector<ftype, 3> fvector;
+	typedef Geometry::Space<ftype, 1, 3> linef;
+	typedef Geometry::AxisAlignedBoundingBox<ftype, 3> aabbf;
+	typedef Geometry::Sphere<ftype> spheref;
+	typedef Maths::Quarternion<ftype> quarternion;
+
+	typedef Geometry::Placement<ftype> Placement;
+	typedef Surface<ftype> Parent;
+private:
+	const InstanceGeometry<ftype>* m_geometry;
+
+	//the bounds have to be made before the members are set, as the Surface registers them
+	static const aabbf placed_aabb(const InstanceGeometry<ftype>& geometry, const Placement& placement)
+	{
+		const aabbf local = geometry.make_aabb();
+		if (!geometry.is_bounded())
+		{
+			return local;
+		}
+		//the box around the corners of the turned box
+		const fvector corners[2] = { local.get_lower_bounds(), local.get_upper_bounds() };
+		fvector lower = placement.to_world(corners[0]);
+		fvector upper = lower;
+		for (size_t i = 1; i < 8; i++)
+		{
+			const fvector corner = placement.to_world(fvector(corners[i & 1].x, corners[(i >> 1) & 1].y, corners[(i >> 2) & 1].z));
+			for (size_t j = 0; j < 3; j++)
+			{
+				lower[j] = Maths::min(lower[j], corner[j]);
+				upper[j] = Maths::max(upper[j], corner[j]);
+			}
+		}
+		return aabbf(lower, upper);
+	}
+
+	static const spheref placed_sphere(const InstanceGeometry<ftype>& geometry, const Placement& placement)
+	{
+		const aabbf local = geometry.make_aabb();
+		if (!geometry.is_bounded())
+		{
+			return spheref(INFINITY, placement.get_position());
+		}
+		const ftype radius = ftype(0.5) * Maths::mag(local.get_upper_bounds() - local.get_lower_bounds());
+		return spheref(radius * placement.get_scale(), placement.to_world(local.get_center()));
+	}
+
+	//distances along the result are 1 / scale of the distances along ray
+	inline const linef to_local(const linef& ray)const
+	{
+		return linef(Placement::to_local(ray.get_origin()), Placement::direction_to_local(ray.get_axis()), true);
+	}
+
+public:
+	Instance() = delete;
+
+	//material may be nullptr, in which case every part keeps its own
+	Instance(
+		const InstanceGeometry<ftype>& geometry,
+		const fvector& position,
+		const quarternion& rotation,
+		const ftype scale = 1,
+		const MaterialComponent<ftype>* const material = nullptr) :
+
+		Placement(position, rotation, scale),
+		Parent(placed_aabb(geometry, *this), placed_sphere(geometry, *this), material),
+		m_geometry(&geometry)
+	{}
+
+	Instance(const Instance& other) = delete;
+
+	//moves the instance; accelerators pick the change up when they are next updated
+	void set_placement(const fvector& position, const quarternion& rotation, const ftype scale = 1)
+	{
+		Placement::set_placement(position, rotation, scale);
+		Parent::mark_moved();
+	}
+
+	virtual const aabbf make_aabb() const override
+	{
+		return placed_aabb(*m_geometry, *this);
+	}
+
+	virtual const spheref make_bounding_sphere() const override
+	{
+		return placed_sphere(*m_geometry, *this);
+	}
+
+	virtual const ftype first_intersection(const linef& ray)const override
+	{
+		return m_geometry->first_intersection(to_local(ray)).distance * Placement::scale;
+	}
+
+	virtual void intersect(Intersection<ftype>& info, const linef& ray)const override
+	{
+		const Intersection<ftype> local = m_geometry->first_intersection(to_local(ray));
+		if (local.closest)
+		{
+			info.update(this, local.closest, local.distance * Placement::scale);
+		}
+	}
+
+	virtual bool occludes(const linef& ray, const ftype max_distance)const override
+	{
+		return m_geometry->occluded(to_local(ray), max_distance / Placement::scale);
+	}
+
+	//the normal of a part of the geometry at a point in the scene
+	const fvector part_normal(const Surface<ftype>* part, const fvector& point)const
+	{
+		return Placement::direction_to_world(part->normal(Placement::to_local(point)));
+	}
+
+	//the material of a part of the geometry at a point in the scene
+	const Optics::Material<ftype>* part_material(const Surface<ftype>* part, const fvector& point)const
+	{
+		const MaterialComponent<ftype>* material = Parent::get_material_component();
+		if (!material)
+		{
+			material = part->get_material_component();
+		}
+		return material->get_material(part->get_local_coordinates(Placement::to_local(point)));
+	}
+
+	//an instance has no surface of its own; these only answer for callers that don't know which part
+	//was hit. The interaction code uses part_normal and part_material instead
+	virtual const fvector normal(const fvector& point)const override
+	{
+		return Maths::unit(point - Placement::to_world(m_geometry->make_aabb().get_center()));
+	}
+
+	virtual const Maths::Vector<ftype, 2> get_local_coordinates(const fvector& point)const override
+	{
+		const fvector local = Placement::to_local(point);
+		return Maths::Vector<ftype, 2>(local.x, local.y);
+	}
+
+	inline const InstanceGeometry<ftype>& get_geometry()const { return *m_geometry; }
+};
+
+#endif
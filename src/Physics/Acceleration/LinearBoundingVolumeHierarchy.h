@@ -0,0 +1,465 @@
+#ifndef LINEAR_BOUNDING_VOLUME_HIERARCHY_H
+#define LINEAR_BOUNDING_VOLUME_HIERARCHY_H
+
+#include "BoundingVolumeHierarchy.h"
+#include "Maths/Morton.h"
+
+#include <atomic>
+#include <stdint.h>
+
+/*
+* A bounding volume hierarchy built from Morton codes (an "LBVH", after Karras 2012), for scenes that
+* are rebuilt often enough that the build matters as much as the trace.
+*
+* the centroids of the surfaces are quantised to a grid over the scene and given Morton codes, the
+* codes are radix sorted, and the tree is read straight off the sorted codes: every interior node
+* splits its range where the highest differing bit changes, and can find that split without
+* looking at any other node. So every step except the final pass that cuts the tree into leaves
+* runs on all the threads of a pool, and none of them needs a lock.
+*
+* the tree is written in the same layout as BoundingVolumeHierarchy and traversed by the same code.
+* It is somewhat worse than the SAH build for tracing, so it is meant for geometry that moves every frame.
+*
+* build(pool) takes anything with thread_count() and run(job), like the RenderPool the renders use;
+* build() runs everything on the calling thread.
+*/
+
+template<typename ftype>
+class LinearBoundingVolumeHierarchy : public BoundingVolumeHierarchy<ftype>
+{
+public:
+	typedef Maths::Vector<ftype, 3> fvector;
+	typedef typename BoundingVolumeHierarchy<ftype>::Node Node;
+	typedef typename Surface<ftype>::SurfaceInfo SurfaceInfo;
+	typedef BoundingVolumeHierarchy<ftype> Parent;
+
+	static constexpr size_t radix_bits = 8;
+	static constexpr size_t n_buckets = size_t(1) << radix_bits;
+
+private:
+	static constexpr uint32_t leaf_flag = 0x80000000;    //marks child links that point at a primitive
+
+	struct BuildReference
+	{
+		fvector lower;
+		fvector upper;
+		const Surface<ftype>* surface;
+	};
+
+	//per-build scratch space
+	struct Workspace
+	{
+		size_t n;
+		size_t n_threads;
+		BuildReference* refs;
+		uint64_t* codes;
+		uint64_t* code_buffer;
+		uint32_t* order;                  //sorted position -> reference
+		uint32_t* order_buffer;
+		size_t* histograms;               //n_buckets per thread
+		uint32_t* left;                   //children of each interior node, as interior indices or leaf_flag | primitive
+		uint32_t* right;
+		uint32_t* first;                  //the range of sorted primitives under each interior node
+		uint32_t* last;
+		uint32_t* parent;                 //of interior nodes, then of leaves at n - 1 + i
+		uint32_t* node_index;             //where each interior node, then each leaf, sits in the node array
+		std::atomic<uint32_t>* visits;
+
+		Workspace(const size_t n_, const size_t n_threads_) :
+			n(n_),
+			n_threads(n_threads_),
+			refs(new BuildReference[n_]),
+			codes(new uint64_t[n_]),
+			code_buffer(new uint64_t[n_]),
+			order(new uint32_t[n_]),
+			order_buffer(new uint32_t[n_]),
+			histograms(new size_t[n_buckets * n_threads_]),
+			left(new uint32_t[n_]),
+			right(new uint32_t[n_]),
+			first(new uint32_t[n_]),
+			last(new uint32_t[n_]),
+			parent(new uint32_t[2 * n_]),
+			node_index(new uint32_t[2 * n_]),
+			visits(new std::atomic<uint32_t>[n_])
+		{}
+
+		Workspace(const Workspace& other) = delete;
+
+		~Workspace()
+		{
+			delete[] refs;
+			delete[] codes;
+			delete[] code_buffer;
+			delete[] order;
+			delete[] order_buffer;
+			delete[] histograms;
+			delete[] left;
+			delete[] right;
+			delete[] first;
+			delete[] last;
+			delete[] parent;
+			delete[] node_index;
+			delete[] visits;
+		}
+
+		//the part of [0, count) that thread_index works on
+		inline void chunk(const size_t thread_index, const size_t count, size_t& begin, size_t& end)const
+		{
+			begin = count * thread_index / n_threads;
+			end = count * (thread_index + 1) / n_threads;
+		}
+	};
+
+	const bool wide_codes;
+	const bool treelet_layout;
+
+	//the length of the prefix the sorted codes i and j share, with ties broken by position; -1 if j is out of range
+	static inline int common_prefix(const Workspace& work, const int64_t i, const int64_t j)
+	{
+		if (j < 0 || j >= int64_t(work.n))
+		{
+			return -1;
+		}
+		const uint64_t a = work.codes[i];
+		const uint64_t b = work.codes[j];
+		if (a == b)
+		{
+			return 64 + int(Maths::leading_zeros(uint64_t(i ^ j)));
+		}
+		return int(Maths::leading_zeros(a ^ b));
+	}
+
+	//finds the range and the split of interior node i from the sorted codes alone
+	static void emit_interior(Workspace& work, const int64_t i)
+	{
+		const int direction = (common_prefix(work, i, i + 1) - common_prefix(work, i, i - 1)) < 0 ? -1 : 1;
+		const int min_prefix = common_prefix(work, i, i - direction);
+
+		//gallop out to an upper bound on the length of the range, then binary search for its end
+		int64_t max_length = 2;
+		while (common_prefix(work, i, i + max_length * direction) > min_prefix)
+		{
+			max_length *= 2;
+		}
+		int64_t length = 0;
+		for (int64_t step = max_length / 2; step >= 1; step /= 2)
+		{
+			if (common_prefix(work, i, i + (length + step) * direction) > min_prefix)
+			{
+				length += step;
+			}
+		}
+		const int64_t j = i + length * direction;
+
+		//the split is where the prefix shared by the whole range stops being shared
+		const int node_prefix = common_prefix(work, i, j);
+		int64_t split = 0;
+		int64_t step = length;
+		do
+		{
+			step = (step + 1) / 2;
+			if (common_prefix(work, i, i + (split + step) * direction) > node_prefix)
+			{
+				split += step;
+			}
+		} while (step > 1);
+		const int64_t gamma = i + split * direction + (direction < 0 ? -1 : 0);
+
+		const int64_t lo = (i < j) ? i : j;
+		const int64_t hi = (i < j) ? j : i;
+		work.first[i] = uint32_t(lo);
+		work.last[i] = uint32_t(hi);
+
+		//children sit next to each other, at 2i + 1 and 2i + 2, so no allocation is needed
+		if (lo == gamma)
+		{
+			work.left[i] = leaf_flag | uint32_t(gamma);
+			work.parent[work.n - 1 + gamma] = uint32_t(i);
+			work.node_index[work.n - 1 + gamma] = uint32_t(2 * i + 1);
+		}
+		else
+		{
+			work.left[i] = uint32_t(gamma);
+			work.parent[gamma] = uint32_t(i);
+			work.node_index[gamma] = uint32_t(2 * i + 1);
+		}
+		if (hi == gamma + 1)
+		{
+			work.right[i] = leaf_flag | uint32_t(gamma + 1);
+			work.parent[work.n - 1 + gamma + 1] = uint32_t(i);
+			work.node_index[work.n - 1 + gamma + 1] = uint32_t(2 * i + 2);
+		}
+		else
+		{
+			work.right[i] = uint32_t(gamma + 1);
+			work.parent[gamma + 1] = uint32_t(i);
+			work.node_index[gamma + 1] = uint32_t(2 * i + 2);
+		}
+	}
+
+	//stable least-significant-digit radix sort of the codes, carrying order along
+	template<typename pool_type>
+	static void radix_sort(pool_type& pool, Workspace& work, const size_t key_bits)
+	{
+		for (size_t shift = 0; shift < key_bits; shift += radix_bits)
+		{
+			pool.run([&work, shift](const size_t thread_index)
+			{
+				size_t* histogram = work.histograms + n_buckets * thread_index;
+				for (size_t b = 0; b < n_buckets; b++)
+				{
+					histogram[b] = 0;
+				}
+				size_t begin, end;
+				work.chunk(thread_index, work.n, begin, end);
+				for (size_t i = begin; i < end; i++)
+				{
+					histogram[(work.codes[i] >> shift) & (n_buckets - 1)]++;
+				}
+			});
+
+			//bucket-major, thread-minor, so each thread's share of a bucket follows the previous thread's
+			size_t offset = 0;
+			for (size_t b = 0; b < n_buckets; b++)
+			{
+				for (size_t t = 0; t < work.n_threads; t++)
+				{
+					const size_t count = work.histograms[n_buckets * t + b];
+					work.histograms[n_buckets * t + b] = offset;
+					offset += count;
+				}
+			}
+
+			pool.run([&work, shift](const size_t thread_index)
+			{
+				size_t* offsets = work.histograms + n_buckets * thread_index;
+				size_t begin, end;
+				work.chunk(thread_index, work.n, begin, end);
+				for (size_t i = begin; i < end; i++)
+				{
+					const size_t destination = offsets[(work.codes[i] >> shift) & (n_buckets - 1)]++;
+					work.code_buffer[destination] = work.codes[i];
+					work.order_buffer[destination] = work.order[i];
+				}
+			});
+			Maths::swap(work.codes, work.code_buffer);
+			Maths::swap(work.order, work.order_buffer);
+		}
+	}
+
+	//cuts the tree into leaves: small ranges become a single leaf, and so does anything at the depth limit
+	void make_leaves(const Workspace& work)
+	{
+		uint32_t stack[Parent::max_depth];
+		size_t depth[Parent::max_depth];
+		size_t top = 0;
+		stack[top] = 0;
+		depth[top++] = 0;
+		while (top)
+		{
+			top--;
+			const uint32_t i = stack[top];
+			const size_t d = depth[top];
+			Node& node = Parent::nodes[work.node_index[i]];
+			const uint32_t count = work.last[i] - work.first[i] + 1;
+			if (count <= Parent::max_leaf_size || d + 2 >= Parent::max_depth)
+			{
+				node.first = work.first[i];
+				node.count = count;
+				continue;
+			}
+			node.first = 2 * i + 1;
+			node.count = 0;
+			if (!(work.right[i] & leaf_flag))
+			{
+				stack[top] = work.right[i];
+				depth[top++] = d + 1;
+			}
+			if (!(work.left[i] & leaf_flag))
+			{
+				stack[top] = work.left[i];
+				depth[top++] = d + 1;
+			}
+		}
+	}
+
+public:
+	//wide_codes uses 63 bit codes instead of 30; they take twice as long to sort but keep
+	//densely packed geometry apart. treelet_layout has the build finish with layout_treelets(), which adds
+	//a tenth to a third to the build time and takes a fifth or more off the trace time of a big tree; a tree that
+	//only lasts a frame and is traced by few rays may do better without it
+	LinearBoundingVolumeHierarchy(const bool wide_codes_ = false, const bool treelet_layout_ = true) :
+		wide_codes(wide_codes_),
+		treelet_layout(treelet_layout_)
+	{}
+
+	LinearBoundingVolumeHierarchy(const LinearBoundingVolumeHierarchy& other) = delete;
+
+	virtual void build() override
+	{
+		typename Parent::SerialPool pool;
+		build(pool);
+	}
+
+	template<typename pool_type>
+	void build(pool_type& pool)
+	{
+		Parent::clear();
+		const size_t n_surfaces = Surface<ftype>::surface_count();
+		if (!n_surfaces)
+		{
+			return;
+		}
+
+		Workspace work(n_surfaces, pool.thread_count());
+		size_t n = 0;
+		Accelerator<ftype>::partition_surfaces([&work, &n](const SurfaceInfo& info)
+		{
+			work.refs[n].lower = info.m_aabb.get_lower_bounds();
+			work.refs[n].upper = info.m_aabb.get_upper_bounds();
+			work.refs[n].surface = info.m_surface;
+			n++;
+		});
+		work.n = n;
+		Parent::n_primitives = n;
+		if (!n)
+		{
+			return;
+		}
+
+		//bounds of the centroids, so the whole grid is used
+		fvector* c_lower = new fvector[work.n_threads];
+		fvector* c_upper = new fvector[work.n_threads];
+		pool.run([&work, c_lower, c_upper](const size_t thread_index)
+		{
+			fvector lower(INFINITY);
+			fvector upper(-INFINITY);
+			size_t begin, end;
+			work.chunk(thread_index, work.n, begin, end);
+			for (size_t i = begin; i < end; i++)
+			{
+				const fvector centroid = (work.refs[i].lower + work.refs[i].upper) * ftype(0.5);
+				Parent::grow(lower, upper, centroid, centroid);
+			}
+			c_lower[thread_index] = lower;
+			c_upper[thread_index] = upper;
+		});
+		fvector lower(INFINITY);
+		fvector upper(-INFINITY);
+		for (size_t t = 0; t < work.n_threads; t++)
+		{
+			Parent::grow(lower, upper, c_lower[t], c_upper[t]);
+		}
+		delete[] c_lower;
+		delete[] c_upper;
+
+		//quantise and encode
+		const size_t axis_bits = wide_codes ? 21 : 10;
+		const ftype cells = ftype((uint32_t(1) << axis_bits) - 1);
+		fvector scale;
+		for (size_t a = 0; a < 3; a++)
+		{
+			const ftype extent = upper[a] - lower[a];
+			scale[a] = (extent > ftype(0)) ? cells / extent : ftype(0);
+		}
+		const bool wide = wide_codes;
+		pool.run([&work, &lower, &scale, wide](const size_t thread_index)
+		{
+			size_t begin, end;
+			work.chunk(thread_index, work.n, begin, end);
+			for (size_t i = begin; i < end; i++)
+			{
+				const fvector centroid = (work.refs[i].lower + work.refs[i].upper) * ftype(0.5);
+				const uint32_t x = uint32_t((centroid.x - lower.x) * scale.x);
+				const uint32_t y = uint32_t((centroid.y - lower.y) * scale.y);
+				const uint32_t z = uint32_t((centroid.z - lower.z) * scale.z);
+				work.codes[i] = wide ? Maths::morton_encode_wide(x, y, z) : uint64_t(Maths::morton_encode(x, y, z));
+				work.order[i] = uint32_t(i);
+			}
+		});
+
+		radix_sort(pool, work, 3 * axis_bits);
+
+		//the tree has n - 1 interior nodes, and 2n - 1 nodes in all
+		Parent::reserve_nodes(2 * n - 1);
+		Parent::n_nodes = 2 * n - 1;
+		work.node_index[0] = 0;
+		if (n == 1)
+		{
+			work.node_index[work.n - 1] = 0;
+			work.parent[work.n - 1] = 0;
+		}
+
+		pool.run([&work](const size_t thread_index)
+		{
+			size_t begin, end;
+			work.chunk(thread_index, work.n - 1, begin, end);
+			for (size_t i = begin; i < end; i++)
+			{
+				work.visits[i].store(0, std::memory_order_relaxed);
+				emit_interior(work, int64_t(i));
+			}
+		});
+
+		//boxes go up from the leaves; the second child to arrive at a node builds its box and carries on
+		Node* nodes = Parent::nodes;
+		pool.run([&work, nodes](const size_t thread_index)
+		{
+			size_t begin, end;
+			work.chunk(thread_index, work.n, begin, end);
+			for (size_t i = begin; i < end; i++)
+			{
+				Node& leaf = nodes[work.node_index[work.n - 1 + i]];
+				const BuildReference& ref = work.refs[work.order[i]];
+				leaf.lower = ref.lower;
+				leaf.upper = ref.upper;
+				leaf.first = uint32_t(i);
+				leaf.count = 1;
+				if (work.n == 1)
+				{
+					continue;
+				}
+
+				uint32_t current = work.parent[work.n - 1 + i];
+				for (;;)
+				{
+					if (!work.visits[current].fetch_add(1, std::memory_order_acq_rel))
+					{
+						break;
+					}
+					Node& node = nodes[work.node_index[current]];
+					const Node& a = nodes[2 * current + 1];
+					const Node& b = nodes[2 * current + 2];
+					node.lower = a.lower;
+					node.upper = a.upper;
+					Parent::grow(node.lower, node.upper, b.lower, b.upper);
+					if (!current)
+					{
+						break;
+					}
+					current = work.parent[current];
+				}
+			}
+		});
+
+		if (n > 1)
+		{
+			make_leaves(work);
+		}
+		Parent::compute_costs(0);
+		if (treelet_layout)
+		{
+			Parent::layout_treelets();
+		}
+
+		const Surface<ftype>** surfaces = new const Surface<ftype>*[n];
+		for (size_t i = 0; i < n; i++)
+		{
+			surfaces[i] = work.refs[work.order[i]].surface;
+		}
+		Parent::primitives.pack(surfaces, n);
+		delete[] surfaces;
+	}
+};
+
+#endif
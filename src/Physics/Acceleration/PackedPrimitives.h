@@ -0,0 +1,699 @@
+#ifndef PACKED_PRIMITIVES_H
+#define PACKED_PRIMITIVES_H
+
+#include "Surfaces/Surface.h"
+#include "Surfaces/Sphere.h"
+#include "Surfaces/Triangle.h"
+#include "Surfaces/Plane.h"
+#include "Physics/Intersection.h"
+#include "Physics/RayPacket.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <typeinfo>
+
+/*
+* A compact copy of the geometry of a list of surfaces, made for the accelerators to test rays against.
+*
+* every primitive type the store knows about (spheres, triangles and planes) gets its own
+* structure-of-arrays storage, so testing a primitive means reading a few contiguous floats and
+* calling a plain function rather than chasing a pointer to the surface and going through its vtable.
+* surface types the store doesn't know about, subclasses of the ones it does included, still work; they are tested through Surface::intersect and Surface::occludes.
+*
+* primitives keep the order of the list they were packed from, and primitive i remembers its surface
+* so that a hit can still be turned into a normal and a material. The Surface classes stay the way
+* scenes are built; the store is just a snapshot of them, so a surface that moves must be refreshed.
+* the store remembers the move clock (see Surface::move_time) of its snapshot, so refresh_moved finds
+* the surfaces that moved since, however many other stores have been refreshed in the meantime.
+*/
+
+template<typename ftype>
+class PackedPrimitives
+{
+public:
+	typedef Maths::Vector<ftype, 3> fvector;
+	typedef Geometry::Space<ftype, 1, 3> linef;
+
+	enum Kind : uint8_t
+	{
+		SPHERE,
+		TRIANGLE,
+		PLANE,
+		OTHER       //tested through its vtable
+	};
+
+private:
+	//one array per coordinate
+	struct Components
+	{
+		ftype* x = nullptr;
+		ftype* y = nullptr;
+		ftype* z = nullptr;
+
+		void allocate(const size_t n)
+		{
+			x = new ftype[n];
+			y = new ftype[n];
+			z = new ftype[n];
+		}
+
+		void release()
+		{
+			delete[] x;
+			delete[] y;
+			delete[] z;
+			x = nullptr;
+			y = nullptr;
+			z = nullptr;
+		}
+
+		inline void set(const size_t i, const fvector& value)
+		{
+			x[i] = value.x;
+			y[i] = value.y;
+			z[i] = value.z;
+		}
+
+		inline const fvector get(const size_t i)const
+		{
+			return fvector(x[i], y[i], z[i]);
+		}
+
+		bool write(FILE* file, const size_t n)const
+		{
+			return fwrite(x, sizeof(ftype), n, file) == n &&
+				fwrite(y, sizeof(ftype), n, file) == n &&
+				fwrite(z, sizeof(ftype), n, file) == n;
+		}
+
+		bool read(FILE* file, const size_t n)
+		{
+			allocate(n);
+			return fread(x, sizeof(ftype), n, file) == n &&
+				fread(y, sizeof(ftype), n, file) == n &&
+				fread(z, sizeof(ftype), n, file) == n;
+		}
+
+		void hash(uint64_t& h, const size_t n)const
+		{
+			hash_bytes(h, x, n * sizeof(ftype));
+			hash_bytes(h, y, n * sizeof(ftype));
+			hash_bytes(h, z, n * sizeof(ftype));
+		}
+	};
+
+	//64 bit FNV-1a
+	static inline void hash_bytes(uint64_t& h, const void* data, const size_t n_bytes)
+	{
+		const unsigned char* bytes = static_cast<const unsigned char*>(data);
+		for (size_t i = 0; i < n_bytes; i++)
+		{
+			h ^= bytes[i];
+			h *= 1099511628211ULL;
+		}
+	}
+
+	size_t n_primitives;
+	uint8_t* kinds;
+	uint32_t* slots;                    //index into the storage of the primitive's kind
+	const Surface<ftype>** surfaces;
+
+	size_t n_spheres;
+	Components sphere_centers;
+	ftype* sphere_r2;
+
+	size_t n_triangles;
+	Components triangle_vertices;
+	Components triangle_edge1;
+	Components triangle_edge2;
+
+	size_t n_planes;
+	Components plane_points;
+	Components plane_normals;
+
+	uint64_t snapshot_time;             //Surface::move_time() when the geometry was last read from the surfaces
+
+	//goes by the exact type, so a subclass that overrides intersect or occludes is still tested through its vtable
+	static inline Kind classify(const Surface<ftype>* surface)
+	{
+		const std::type_info& type = typeid(*surface);
+		if (type == typeid(Sphere<ftype>))
+		{
+			return SPHERE;
+		}
+		if (type == typeid(Triangle<ftype>))
+		{
+			return TRIANGLE;
+		}
+		if (type == typeid(Plane<ftype>))
+		{
+			return PLANE;
+		}
+		return OTHER;
+	}
+
+public:
+	PackedPrimitives() :
+		n_primitives(0),
+		kinds(nullptr),
+		slots(nullptr),
+		surfaces(nullptr),
+		n_spheres(0),
+		sphere_r2(nullptr),
+		n_triangles(0),
+		n_planes(0),
+		snapshot_time(0)
+	{}
+
+	PackedPrimitives(const PackedPrimitives& other) = delete;
+
+	~PackedPrimitives()
+	{
+		clear();
+	}
+
+	void clear()
+	{
+		delete[] kinds;
+		delete[] slots;
+		delete[] surfaces;
+		delete[] sphere_r2;
+		kinds = nullptr;
+		slots = nullptr;
+		surfaces = nullptr;
+		sphere_r2 = nullptr;
+		sphere_centers.release();
+		triangle_vertices.release();
+		triangle_edge1.release();
+		triangle_edge2.release();
+		plane_points.release();
+		plane_normals.release();
+		n_primitives = 0;
+		n_spheres = 0;
+		n_triangles = 0;
+		n_planes = 0;
+	}
+
+	//copies the geometry of surface_list[0, n) into the store, replacing whatever was there
+	void pack(const Surface<ftype>* const* surface_list, const size_t n)
+	{
+		clear();
+		snapshot_time = Surface<ftype>::move_time();
+		if (!n)
+		{
+			return;
+		}
+		n_primitives = n;
+		kinds = new uint8_t[n];
+		slots = new uint32_t[n];
+		surfaces = new const Surface<ftype>*[n];
+
+		//count first so every array is allocated once at its final size
+		for (size_t i = 0; i < n; i++)
+		{
+			surfaces[i] = surface_list[i];
+			kinds[i] = classify(surface_list[i]);
+			switch (kinds[i])
+			{
+			case SPHERE: n_spheres++; break;
+			case TRIANGLE: n_triangles++; break;
+			case PLANE: n_planes++; break;
+			default: break;
+			}
+		}
+
+		sphere_centers.allocate(n_spheres);
+		sphere_r2 = new ftype[n_spheres];
+		triangle_vertices.allocate(n_triangles);
+		triangle_edge1.allocate(n_triangles);
+		triangle_edge2.allocate(n_triangles);
+		plane_points.allocate(n_planes);
+		plane_normals.allocate(n_planes);
+
+		size_t sphere = 0;
+		size_t triangle = 0;
+		size_t plane = 0;
+		for (size_t i = 0; i < n; i++)
+		{
+			switch (kinds[i])
+			{
+			case SPHERE: slots[i] = uint32_t(sphere++); break;
+			case TRIANGLE: slots[i] = uint32_t(triangle++); break;
+			case PLANE: slots[i] = uint32_t(plane++); break;
+			default: slots[i] = 0; break;
+			}
+			refresh(i);
+		}
+	}
+
+	//re-reads the geometry of primitive i from its surface, after the surface has moved
+	void refresh(const size_t i)
+	{
+		const uint32_t slot = slots[i];
+		switch (kinds[i])
+		{
+		case SPHERE:
+		{
+			const Sphere<ftype>* s = static_cast<const Sphere<ftype>*>(surfaces[i]);
+			sphere_centers.set(slot, s->get_center());
+			sphere_r2[slot] = s->get_r2();
+			break;
+		}
+		case TRIANGLE:
+		{
+			const Triangle<ftype>* t = static_cast<const Triangle<ftype>*>(surfaces[i]);
+			triangle_vertices.set(slot, t->get_vertex(0));
+			triangle_edge1.set(slot, t->get_edge1());
+			triangle_edge2.set(slot, t->get_edge2());
+			break;
+		}
+		case PLANE:
+		{
+			const Plane<ftype>* p = static_cast<const Plane<ftype>*>(surfaces[i]);
+			plane_points.set(slot, p->get_origin());
+			plane_normals.set(slot, p->get_normal());
+			break;
+		}
+		default:
+			break;
+		}
+	}
+
+	//refreshes the primitives in [first, first + count) whose surfaces have moved since the snapshot. threads
+	//can refresh separate ranges at once; once they all have, set_snapshot_time(time) with the move_time()
+	//taken before they started
+	void refresh_moved(const size_t first, const size_t count)
+	{
+		for (size_t i = first; i < first + count; i++)
+		{
+			if (surfaces[i]->has_moved_since(snapshot_time))
+			{
+				refresh(i);
+			}
+		}
+	}
+
+	inline void set_snapshot_time(const uint64_t time) { snapshot_time = time; }
+
+	inline const uint64_t& get_snapshot_time()const { return snapshot_time; }
+
+	/*
+	* a hash of everything the accelerators see of the primitives: their kinds, order and geometry, and
+	* the boxes of the ones tested through their vtables. Two stores with the same hash can share a
+	* cached acceleration structure
+	*/
+	uint64_t hash()const
+	{
+		uint64_t h = 14695981039346656037ULL;
+		hash_bytes(h, &n_primitives, sizeof(n_primitives));
+		hash_bytes(h, kinds, n_primitives);
+		sphere_centers.hash(h, n_spheres);
+		hash_bytes(h, sphere_r2, n_spheres * sizeof(ftype));
+		triangle_vertices.hash(h, n_triangles);
+		triangle_edge1.hash(h, n_triangles);
+		triangle_edge2.hash(h, n_triangles);
+		plane_points.hash(h, n_planes);
+		plane_normals.hash(h, n_planes);
+		for (size_t i = 0; i < n_primitives; i++)
+		{
+			if (kinds[i] == OTHER)
+			{
+				const Geometry::AxisAlignedBoundingBox<ftype, 3> box = surfaces[i]->make_aabb();
+				const ftype bounds[6] = {
+					box.get_lower_bounds().x, box.get_lower_bounds().y, box.get_lower_bounds().z,
+					box.get_upper_bounds().x, box.get_upper_bounds().y, box.get_upper_bounds().z };
+				hash_bytes(h, bounds, sizeof(bounds));
+			}
+		}
+		return h;
+	}
+
+	//what index_of gives for a surface it doesn't know
+	static constexpr uint32_t no_index = uint32_t(-1);
+
+	//writes the store to file, with each surface as index_of(surface), its position in a list read() will be given.
+	//fails if any surface's index is no_index
+	template<typename index_function>
+	bool write(FILE* file, const index_function& index_of)const
+	{
+		const uint64_t counts[4] = { n_primitives, n_spheres, n_triangles, n_planes };
+		if (fwrite(counts, sizeof(uint64_t), 4, file) != 4 ||
+			fwrite(kinds, 1, n_primitives, file) != n_primitives ||
+			fwrite(slots, sizeof(uint32_t), n_primitives, file) != n_primitives)
+		{
+			return false;
+		}
+		for (size_t i = 0; i < n_primitives; i++)
+		{
+			const uint32_t index = index_of(surfaces[i]);
+			if (index == no_index || fwrite(&index, sizeof(uint32_t), 1, file) != 1)
+			{
+				return false;
+			}
+		}
+		return sphere_centers.write(file, n_spheres) &&
+			fwrite(sphere_r2, sizeof(ftype), n_spheres, file) == n_spheres &&
+			triangle_vertices.write(file, n_triangles) &&
+			triangle_edge1.write(file, n_triangles) &&
+			triangle_edge2.write(file, n_triangles) &&
+			plane_points.write(file, n_planes) &&
+			plane_normals.write(file, n_planes);
+	}
+
+	//reads a store written by write(), linking it back to surface_list[0, n_surfaces); false if the file is bad
+	bool read(FILE* file, const Surface<ftype>* const* surface_list, const size_t n_surfaces)
+	{
+		clear();
+		snapshot_time = Surface<ftype>::move_time();
+		uint64_t counts[4];
+		if (fread(counts, sizeof(uint64_t), 4, file) != 4 || counts[1] + counts[2] + counts[3] > counts[0])
+		{
+			return false;
+		}
+		n_primitives = size_t(counts[0]);
+		n_spheres = size_t(counts[1]);
+		n_triangles = size_t(counts[2]);
+		n_planes = size_t(counts[3]);
+		kinds = new uint8_t[n_primitives];
+		slots = new uint32_t[n_primitives];
+		surfaces = new const Surface<ftype>*[n_primitives];
+		sphere_r2 = new ftype[n_spheres];
+		if (fread(kinds, 1, n_primitives, file) != n_primitives ||
+			fread(slots, sizeof(uint32_t), n_primitives, file) != n_primitives)
+		{
+			clear();
+			return false;
+		}
+		for (size_t i = 0; i < n_primitives; i++)
+		{
+			const size_t kind_counts[3] = { n_spheres, n_triangles, n_planes };
+			uint32_t index;
+			if (kinds[i] > OTHER || (kinds[i] != OTHER && slots[i] >= kind_counts[kinds[i]]) ||
+				fread(&index, sizeof(uint32_t), 1, file) != 1 || index >= n_surfaces)
+			{
+				clear();
+				return false;
+			}
+			surfaces[i] = surface_list[index];
+		}
+		if (!(sphere_centers.read(file, n_spheres) &&
+			fread(sphere_r2, sizeof(ftype), n_spheres, file) == n_spheres &&
+			triangle_vertices.read(file, n_triangles) &&
+			triangle_edge1.read(file, n_triangles) &&
+			triangle_edge2.read(file, n_triangles) &&
+			plane_points.read(file, n_planes) &&
+			plane_normals.read(file, n_planes)))
+		{
+			clear();
+			return false;
+		}
+		return true;
+	}
+
+	//reorders primitives [first, first + count); position first + k gets the primitive that was at
+	//old_positions[k]. the geometry itself stays where it is, only the lookups move
+	void permute(const size_t first, const size_t count, const uint32_t* old_positions)
+	{
+		uint8_t* old_kinds = new uint8_t[count];
+		uint32_t* old_slots = new uint32_t[count];
+		const Surface<ftype>** old_surfaces = new const Surface<ftype>*[count];
+		for (size_t k = 0; k < count; k++)
+		{
+			old_kinds[k] = kinds[first + k];
+			old_slots[k] = slots[first + k];
+			old_surfaces[k] = surfaces[first + k];
+		}
+		for (size_t k = 0; k < count; k++)
+		{
+			const size_t from = old_positions[k] - first;
+			kinds[first + k] = old_kinds[from];
+			slots[first + k] = old_slots[from];
+			surfaces[first + k] = old_surfaces[from];
+		}
+		delete[] old_kinds;
+		delete[] old_slots;
+		delete[] old_surfaces;
+	}
+
+	//distance along the ray to primitive i, with the same meaning as Surface::first_intersection
+	inline ftype distance(const size_t i, const linef& ray)const
+	{
+		const uint32_t slot = slots[i];
+		switch (kinds[i])
+		{
+		case SPHERE:
+			return Geometry::intersection(sphere_centers.get(slot), sphere_r2[slot], ray, Surface<ftype>::tolerance);
+		case TRIANGLE:
+			return Geometry::intersection(
+				triangle_vertices.get(slot), triangle_edge1.get(slot), triangle_edge2.get(slot), ray);
+		case PLANE:
+			return Geometry::intersection(plane_points.get(slot), plane_normals.get(slot), ray);
+		default:
+			return surfaces[i]->first_intersection(ray);
+		}
+	}
+
+	//tests primitives [first, first + count) and keeps the closest hit in info
+	inline void update(Intersection<ftype>& info, const size_t first, const size_t count, const linef& ray)const
+	{
+		for (size_t i = first; i < first + count; i++)
+		{
+			if (kinds[i] == OTHER)
+			{
+				//lets instances record the part they were hit on
+				surfaces[i]->intersect(info, ray);
+				continue;
+			}
+			info.update(surfaces[i], distance(i, ray));
+		}
+	}
+
+	/*
+	* the distances along every lane of the packet to a primitive of each packed kind. each loop takes the same
+	* steps as the Geometry::intersection it stands in for, so a lane gets exactly the distance a lone ray
+	* would; misses are picked out at the end rather than branched on, so the lanes can be done together
+	*/
+	static inline void sphere_distances(
+		const ftype cx, const ftype cy, const ftype cz, const ftype r2, const RayPacket<ftype>& packet, ftype* out)
+	{
+		for (size_t l = 0; l < RayPacket<ftype>::size; l++)
+		{
+			const ftype projected = packet.direction_x[l] * (cx - packet.origin_x[l]) +
+				packet.direction_y[l] * (cy - packet.origin_y[l]) + packet.direction_z[l] * (cz - packet.origin_z[l]);
+			const ftype sx = cx - (packet.origin_x[l] + projected * packet.direction_x[l]);
+			const ftype sy = cy - (packet.origin_y[l] + projected * packet.direction_y[l]);
+			const ftype sz = cz - (packet.origin_z[l] + projected * packet.direction_z[l]);
+			const ftype separation2 = (sx * sx) + (sy * sy) + (sz * sz);
+			//clamped so a miss doesn't take the slow path of sqrt for negative numbers
+			const ftype half_chord = sqrt(Maths::max(r2 - separation2, ftype(0)));
+			const ftype hit = (projected - half_chord > Surface<ftype>::tolerance) ?
+				projected - half_chord :
+				projected + half_chord;
+			out[l] = (separation2 > r2) ? ftype(-1) : hit;
+		}
+	}
+
+	static inline void triangle_distances(
+		const ftype vx, const ftype vy, const ftype vz,
+		const ftype e1x, const ftype e1y, const ftype e1z,
+		const ftype e2x, const ftype e2y, const ftype e2z,
+		const RayPacket<ftype>& packet, ftype* out)
+	{
+		for (size_t l = 0; l < RayPacket<ftype>::size; l++)
+		{
+			const ftype dx = packet.direction_x[l];
+			const ftype dy = packet.direction_y[l];
+			const ftype dz = packet.direction_z[l];
+			const ftype px = dy * e2z - dz * e2y;
+			const ftype py = dz * e2x - e2z * dx;
+			const ftype pz = dx * e2y - e2x * dy;
+			const ftype det = e1x * px + e1y * py + e1z * pz;
+			const ftype inv_det = ftype(1) / det;
+
+			const ftype sx = packet.origin_x[l] - vx;
+			const ftype sy = packet.origin_y[l] - vy;
+			const ftype sz = packet.origin_z[l] - vz;
+			const ftype u = (sx * px + sy * py + sz * pz) * inv_det;
+			const ftype qx = sy * e1z - sz * e1y;
+			const ftype qy = sz * e1x - e1z * sx;
+			const ftype qz = sx * e1y - e1x * sy;
+			const ftype v = (dx * qx + dy * qy + dz * qz) * inv_det;
+			const ftype hit = (e2x * qx + e2y * qy + e2z * qz) * inv_det;
+
+			const bool miss = (det == ftype(0)) | (u < ftype(0)) | (u > ftype(1)) | (v < ftype(0)) | (u + v > ftype(1));
+			out[l] = miss ? ftype(-1) : hit;
+		}
+	}
+
+	static inline void plane_distances(
+		const ftype px, const ftype py, const ftype pz,
+		const ftype nx, const ftype ny, const ftype nz,
+		const RayPacket<ftype>& packet, ftype* out)
+	{
+		for (size_t l = 0; l < RayPacket<ftype>::size; l++)
+		{
+			const ftype denominator = nx * packet.direction_x[l] + ny * packet.direction_y[l] + nz * packet.direction_z[l];
+			const ftype hit = (nx * (px - packet.origin_x[l]) + ny * (py - packet.origin_y[l]) + nz * (pz - packet.origin_z[l])) / denominator;
+			out[l] = (denominator == ftype(0) || hit == ftype(0)) ? ftype(-1) : hit;
+		}
+	}
+
+	//the distances along every lane of the packet to primitive i, which must be of a packed kind
+	inline void distances(const size_t i, const RayPacket<ftype>& packet, ftype* out)const
+	{
+		const uint32_t slot = slots[i];
+		switch (kinds[i])
+		{
+		case SPHERE:
+			sphere_distances(sphere_centers.x[slot], sphere_centers.y[slot], sphere_centers.z[slot], sphere_r2[slot], packet, out);
+			break;
+		case TRIANGLE:
+			triangle_distances(
+				triangle_vertices.x[slot], triangle_vertices.y[slot], triangle_vertices.z[slot],
+				triangle_edge1.x[slot], triangle_edge1.y[slot], triangle_edge1.z[slot],
+				triangle_edge2.x[slot], triangle_edge2.y[slot], triangle_edge2.z[slot],
+				packet, out);
+			break;
+		case PLANE:
+			plane_distances(
+				plane_points.x[slot], plane_points.y[slot], plane_points.z[slot],
+				plane_normals.x[slot], plane_normals.y[slot], plane_normals.z[slot],
+				packet, out);
+			break;
+		default:
+			break;
+		}
+	}
+
+	//tests primitives [first, first + count) against the lanes of the packet set in mask, keeping each lane's closest hit
+	inline void update(RayPacket<ftype>& packet, const size_t first, const size_t count, const uint32_t mask)const
+	{
+		ftype dist[RayPacket<ftype>::size];
+		for (size_t i = first; i < first + count; i++)
+		{
+			const Surface<ftype>* surface = surfaces[i];
+			if (kinds[i] == OTHER)
+			{
+				RayPacket<ftype>::for_each_lane(mask, [&packet, surface](const size_t lane)
+				{
+					surface->intersect(packet.hits[lane], packet.rays[lane]);
+				});
+				continue;
+			}
+			distances(i, packet, dist);
+			RayPacket<ftype>::for_each_lane(mask, [&packet, surface, &dist](const size_t lane)
+			{
+				packet.hits[lane].update(surface, dist[lane]);
+			});
+		}
+	}
+
+	//true if any of primitives [first, first + count) is hit between Surface::tolerance and max_distance
+	inline bool occludes(const size_t first, const size_t count, const linef& ray, const ftype max_distance)const
+	{
+		for (size_t i = first; i < first + count; i++)
+		{
+			if (kinds[i] == OTHER)
+			{
+				if (surfaces[i]->occludes(ray, max_distance))
+				{
+					return true;
+				}
+				continue;
+			}
+			const ftype dist = distance(i, ray);
+			if (dist > Surface<ftype>::tolerance && dist < max_distance)
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	inline const size_t& size()const { return n_primitives; }
+	inline const size_t& sphere_count()const { return n_spheres; }
+	inline const size_t& triangle_count()const { return n_triangles; }
+	inline const size_t& plane_count()const { return n_planes; }
+	inline Kind get_kind(const size_t i)const { return Kind(kinds[i]); }
+	inline const Surface<ftype>* get_surface(const size_t i)const { return surfaces[i]; }
+};
+
+#ifdef RAY_PACKET_SSE
+//the same steps 4 lanes at a time. sqrt and division are exactly rounded in SSE as well, so nothing changes
+template<>
+inline void PackedPrimitives<float>::sphere_distances(
+	const float cx, const float cy, const float cz, const float r2, const RayPacket<float>& packet, float* out)
+{
+	const __m128 center_x = _mm_set1_ps(cx);
+	const __m128 center_y = _mm_set1_ps(cy);
+	const __m128 center_z = _mm_set1_ps(cz);
+	const __m128 radius2 = _mm_set1_ps(r2);
+	const __m128 tolerance = _mm_set1_ps(Surface<float>::tolerance);
+	for (size_t l = 0; l < RayPacket<float>::size; l += 4)
+	{
+		const __m128 ox = _mm_loadu_ps(packet.origin_x + l);
+		const __m128 oy = _mm_loadu_ps(packet.origin_y + l);
+		const __m128 oz = _mm_loadu_ps(packet.origin_z + l);
+		const __m128 dx = _mm_loadu_ps(packet.direction_x + l);
+		const __m128 dy = _mm_loadu_ps(packet.direction_y + l);
+		const __m128 dz = _mm_loadu_ps(packet.direction_z + l);
+
+		const __m128 projected = _mm_add_ps(_mm_add_ps(
+			_mm_mul_ps(dx, _mm_sub_ps(center_x, ox)),
+			_mm_mul_ps(dy, _mm_sub_ps(center_y, oy))),
+			_mm_mul_ps(dz, _mm_sub_ps(center_z, oz)));
+		const __m128 sx = _mm_sub_ps(center_x, _mm_add_ps(ox, _mm_mul_ps(projected, dx)));
+		const __m128 sy = _mm_sub_ps(center_y, _mm_add_ps(oy, _mm_mul_ps(projected, dy)));
+		const __m128 sz = _mm_sub_ps(center_z, _mm_add_ps(oz, _mm_mul_ps(projected, dz)));
+		const __m128 separation2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, sx), _mm_mul_ps(sy, sy)), _mm_mul_ps(sz, sz));
+		const __m128 half_chord = _mm_sqrt_ps(_mm_max_ps(_mm_sub_ps(radius2, separation2), _mm_setzero_ps()));
+		const __m128 near_hit = _mm_sub_ps(projected, half_chord);
+		const __m128 hit = select_ps(_mm_cmpgt_ps(near_hit, tolerance), near_hit, _mm_add_ps(projected, half_chord));
+		_mm_storeu_ps(out + l, select_ps(_mm_cmpgt_ps(separation2, radius2), _mm_set1_ps(-1.0f), hit));
+	}
+}
+
+template<>
+inline void PackedPrimitives<float>::triangle_distances(
+	const float vx, const float vy, const float vz,
+	const float e1x, const float e1y, const float e1z,
+	const float e2x, const float e2y, const float e2z,
+	const RayPacket<float>& packet, float* out)
+{
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 edge1_x = _mm_set1_ps(e1x);
+	const __m128 edge1_y = _mm_set1_ps(e1y);
+	const __m128 edge1_z = _mm_set1_ps(e1z);
+	const __m128 edge2_x = _mm_set1_ps(e2x);
+	const __m128 edge2_y = _mm_set1_ps(e2y);
+	const __m128 edge2_z = _mm_set1_ps(e2z);
+	for (size_t l = 0; l < RayPacket<float>::size; l += 4)
+	{
+		const __m128 dx = _mm_loadu_ps(packet.direction_x + l);
+		const __m128 dy = _mm_loadu_ps(packet.direction_y + l);
+		const __m128 dz = _mm_loadu_ps(packet.direction_z + l);
+		const __m128 px = _mm_sub_ps(_mm_mul_ps(dy, edge2_z), _mm_mul_ps(dz, edge2_y));
+		const __m128 py = _mm_sub_ps(_mm_mul_ps(dz, edge2_x), _mm_mul_ps(edge2_z, dx));
+		const __m128 pz = _mm_sub_ps(_mm_mul_ps(dx, edge2_y), _mm_mul_ps(edge2_x, dy));
+		const __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(edge1_x, px), _mm_mul_ps(edge1_y, py)), _mm_mul_ps(edge1_z, pz));
+		const __m128 inv_det = _mm_div_ps(one, det);
+
+		const __m128 sx = _mm_sub_ps(_mm_loadu_ps(packet.origin_x + l), _mm_set1_ps(vx));
+		const __m128 sy = _mm_sub_ps(_mm_loadu_ps(packet.origin_y + l), _mm_set1_ps(vy));
+		const __m128 sz = _mm_sub_ps(_mm_loadu_ps(packet.origin_z + l), _mm_set1_ps(vz));
+		const __m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, px), _mm_mul_ps(sy, py)), _mm_mul_ps(sz, pz)), inv_det);
+		const __m128 qx = _mm_sub_ps(_mm_mul_ps(sy, edge1_z), _mm_mul_ps(sz, edge1_y));
+		const __m128 qy = _mm_sub_ps(_mm_mul_ps(sz, edge1_x), _mm_mul_ps(edge1_z, sx));
+		const __m128 qz = _mm_sub_ps(_mm_mul_ps(sx, edge1_y), _mm_mul_ps(edge1_x, sy));
+		const __m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), inv_det);
+		const __m128 hit = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(edge2_x, qx), _mm_mul_ps(edge2_y, qy)), _mm_mul_ps(edge2_z, qz)), inv_det);
+
+		const __m128 miss = _mm_or_ps(_mm_or_ps(_mm_or_ps(_mm_cmpeq_ps(det, zero), _mm_cmplt_ps(u, zero)),
+			_mm_or_ps(_mm_cmpgt_ps(u, one), _mm_cmplt_ps(v, zero))), _mm_cmpgt_ps(_mm_add_ps(u, v), one));
+		_mm_storeu_ps(out + l, select_ps(miss, _mm_set1_ps(-1.0f), hit));
+	}
+}
+#endif
+
+#endif
@@ -0,0 +1,486 @@
+#ifndef SPATIAL_SPLIT_BOUNDING_VOLUME_HIERARCHY_H
+#define SPATIAL_SPLIT_BOUNDING_VOLUME_HIERARCHY_H
+
+#include "BoundingVolumeHierarchy.h"
+#include "Surfaces/Triangle.h"
+
+#include <stdint.h>
+
+/*
+* A bounding volume hierarchy that may split space as well as objects (an "SBVH", after Stich, Friedrich
+* and Dietrich 2009), for scenes of large or long, thin triangles where the boxes of an ordinary
+* BVH's children overlap badly. It is the slow, quality-first preset; LinearBoundingVolumeHierarchy
+* is the fast one, and BoundingVolumeHierarchy sits between them.
+*
+* every node tries the binned SAH object split of the ordinary build. Where the two children it gives
+* would overlap by more than split_alpha of the root's area, it also tries splitting space into
+* n_spatial_bins slabs: a triangle that crosses a candidate plane is clipped against it, and the part
+* on each side goes into that child with the box of just that part. Whichever split is cheaper wins.
+* Surfaces other than triangles are clipped by their boxes, which is looser but still right.
+*
+* a spatial split puts a surface in both children, so the leaves can hold more references than there
+* are surfaces. Spatial splits stop once there are reference_budget times as many references as
+* surfaces, which bounds the memory. A surface that appears in several leaves is tested once for
+* each, which can't change the closest hit.
+*
+* the tree is written in the same layout as BoundingVolumeHierarchy and traversed by the same code.
+* update() works too, but refitting leaves uses whole surfaces, so the tree loses the benefit of its
+* spatial splits; geometry that moves is better served by the other builders.
+*/
+
+template<typename ftype>
+class SpatialSplitBoundingVolumeHierarchy : public BoundingVolumeHierarchy<ftype>
+{
+public:
+	typedef Maths::Vector<ftype, 3> fvector;
+	typedef typename BoundingVolumeHierarchy<ftype>::Node Node;
+	typedef typename Surface<ftype>::SurfaceInfo SurfaceInfo;
+	typedef BoundingVolumeHierarchy<ftype> Parent;
+
+	static constexpr size_t n_spatial_bins = 32;
+	static constexpr ftype split_alpha = ftype(1e-5);
+
+private:
+	//a surface, or the part of one that lies in a node
+	struct Reference
+	{
+		fvector lower;
+		fvector upper;
+		const Surface<ftype>* surface;
+		const Triangle<ftype>* triangle;     //nullptr for the surfaces that are clipped by their boxes
+
+		inline fvector centroid()const { return (lower + upper) * ftype(0.5); }
+	};
+
+	struct Bin
+	{
+		fvector lower;
+		fvector upper;
+		size_t count;       //references with their centroid here, or that start here for a spatial split
+		size_t exits;       //references that end here, for a spatial split
+	};
+
+	struct Split
+	{
+		ftype cost = ftype(INFINITY);
+		size_t axis = 0;
+		size_t bin = 0;     //the first bin on the right
+		bool spatial = false;
+		fvector left_lower;
+		fvector left_upper;
+		fvector right_lower;
+		fvector right_upper;
+	};
+
+	const ftype reference_budget;
+	size_t n_surfaces;
+	ftype root_area;
+	size_t n_references;                    //references in the tree so far, counting every copy
+	size_t max_references;
+
+	const Surface<ftype>** leaf_surfaces;   //in leaf order, with a surface once for every leaf it is in
+	size_t n_leaf_surfaces;
+	size_t leaf_capacity;
+
+	static inline void empty_box(fvector& lower, fvector& upper)
+	{
+		lower = fvector(INFINITY);
+		upper = fvector(-INFINITY);
+	}
+
+	static inline bool is_empty(const fvector& lower, const fvector& upper)
+	{
+		return lower.x > upper.x || lower.y > upper.y || lower.z > upper.z;
+	}
+
+	//the box of the part of ref between lo and hi along axis
+	static void clip(const Reference& ref, const size_t axis, const ftype lo, const ftype hi, fvector& lower, fvector& upper)
+	{
+		if (!ref.triangle)
+		{
+			lower = ref.lower;
+			upper = ref.upper;
+			lower[axis] = Maths::max(lower[axis], lo);
+			upper[axis] = Maths::min(upper[axis], hi);
+			return;
+		}
+
+		//the vertices inside the slab, and where the edges cross its sides
+		empty_box(lower, upper);
+		for (size_t e = 0; e < 3; e++)
+		{
+			const fvector& a = ref.triangle->get_vertex(e);
+			const fvector& b = ref.triangle->get_vertex((e + 1) % 3);
+			if (a[axis] >= lo && a[axis] <= hi)
+			{
+				Parent::grow(lower, upper, a, a);
+			}
+			const ftype planes[2] = { lo, hi };
+			for (size_t p = 0; p < 2; p++)
+			{
+				if ((a[axis] - planes[p]) * (b[axis] - planes[p]) < ftype(0))
+				{
+					const ftype t = (planes[p] - a[axis]) / (b[axis] - a[axis]);
+					fvector crossing = a + (b - a) * t;
+					crossing[axis] = planes[p];
+					Parent::grow(lower, upper, crossing, crossing);
+				}
+			}
+		}
+		//the reference may already be a clipped part
+		for (size_t i = 0; i < 3; i++)
+		{
+			lower[i] = Maths::max(lower[i], ref.lower[i]);
+			upper[i] = Maths::min(upper[i], ref.upper[i]);
+		}
+	}
+
+	//the binned SAH object split, as in BoundingVolumeHierarchy::build_node, keeping the children's boxes
+	static void find_object_split(const Reference* refs, const size_t count, const fvector& c_lower, const fvector& c_upper,
+		const ftype parent_area, Split& best)
+	{
+		constexpr size_t n_bins = Parent::n_bins;
+		for (size_t axis = 0; axis < 3; axis++)
+		{
+			const ftype extent = c_upper[axis] - c_lower[axis];
+			if (extent <= ftype(0))
+			{
+				continue;
+			}
+			const ftype scale = ftype(n_bins) / extent;
+
+			Bin bins[n_bins];
+			for (size_t b = 0; b < n_bins; b++)
+			{
+				empty_box(bins[b].lower, bins[b].upper);
+				bins[b].count = 0;
+			}
+			for (size_t i = 0; i < count; i++)
+			{
+				const size_t b = Maths::min(size_t((refs[i].centroid()[axis] - c_lower[axis]) * scale), n_bins - 1);
+				bins[b].count++;
+				Parent::grow(bins[b].lower, bins[b].upper, refs[i].lower, refs[i].upper);
+			}
+			sweep(bins, n_bins, parent_area, axis, false, best);
+		}
+	}
+
+	//spatial splits over n_spatial_bins slabs of the node's box
+	void find_spatial_split(const Reference* refs, const size_t count, const fvector& node_lower, const fvector& node_upper,
+		const ftype parent_area, Split& best)const
+	{
+		for (size_t axis = 0; axis < 3; axis++)
+		{
+			const ftype extent = node_upper[axis] - node_lower[axis];
+			if (extent <= ftype(0))
+			{
+				continue;
+			}
+			const ftype width = extent / ftype(n_spatial_bins);
+			const ftype scale = ftype(1) / width;
+
+			Bin bins[n_spatial_bins];
+			for (size_t b = 0; b < n_spatial_bins; b++)
+			{
+				empty_box(bins[b].lower, bins[b].upper);
+				bins[b].count = 0;
+				bins[b].exits = 0;
+			}
+			for (size_t i = 0; i < count; i++)
+			{
+				const size_t first = spatial_bin(refs[i].lower[axis], node_lower[axis], scale);
+				const size_t last = spatial_bin(refs[i].upper[axis], node_lower[axis], scale);
+				bins[first].count++;
+				bins[last].exits++;
+				for (size_t b = first; b <= last; b++)
+				{
+					const ftype lo = node_lower[axis] + ftype(b) * width;
+					fvector lower, upper;
+					clip(refs[i], axis, lo, lo + width, lower, upper);
+					if (!is_empty(lower, upper))
+					{
+						Parent::grow(bins[b].lower, bins[b].upper, lower, upper);
+					}
+				}
+			}
+			sweep(bins, n_spatial_bins, parent_area, axis, true, best);
+		}
+	}
+
+	static inline size_t spatial_bin(const ftype position, const ftype node_lower, const ftype scale)
+	{
+		const ftype b = Maths::max((position - node_lower) * scale, ftype(0));
+		return Maths::min(size_t(b), n_spatial_bins - 1);
+	}
+
+	//evaluates every plane between bins and keeps the cheapest in best. for spatial splits a reference
+	//counts on the left from the bin it starts in, and on the right up to the bin it ends in
+	static void sweep(const Bin* bins, const size_t n, const ftype parent_area, const size_t axis, const bool spatial, Split& best)
+	{
+		fvector right_lower[n_spatial_bins];
+		fvector right_upper[n_spatial_bins];
+		size_t right_count[n_spatial_bins];
+		fvector lower, upper;
+		empty_box(lower, upper);
+		size_t running = 0;
+		for (size_t b = n - 1; b > 0; b--)
+		{
+			running += spatial ? bins[b].exits : bins[b].count;
+			Parent::grow(lower, upper, bins[b].lower, bins[b].upper);
+			right_count[b] = running;
+			right_lower[b] = lower;
+			right_upper[b] = upper;
+		}
+
+		empty_box(lower, upper);
+		running = 0;
+		for (size_t b = 0; b < n - 1; b++)
+		{
+			running += bins[b].count;
+			Parent::grow(lower, upper, bins[b].lower, bins[b].upper);
+			if (!running || !right_count[b + 1])
+			{
+				continue;
+			}
+			const ftype cost = Parent::traversal_cost +
+				(Parent::surface_area(lower, upper) * ftype(running) +
+				 Parent::surface_area(right_lower[b + 1], right_upper[b + 1]) * ftype(right_count[b + 1])) / parent_area;
+			if (cost < best.cost)
+			{
+				best.cost = cost;
+				best.axis = axis;
+				best.bin = b + 1;
+				best.spatial = spatial;
+				best.left_lower = lower;
+				best.left_upper = upper;
+				best.right_lower = right_lower[b + 1];
+				best.right_upper = right_upper[b + 1];
+			}
+		}
+	}
+
+	void add_leaf(Node& node, const Reference* refs, const size_t count)
+	{
+		if (n_leaf_surfaces + count > leaf_capacity)
+		{
+			leaf_capacity = Maths::max(2 * leaf_capacity, n_leaf_surfaces + count);
+			const Surface<ftype>** grown = new const Surface<ftype>*[leaf_capacity];
+			for (size_t i = 0; i < n_leaf_surfaces; i++)
+			{
+				grown[i] = leaf_surfaces[i];
+			}
+			delete[] leaf_surfaces;
+			leaf_surfaces = grown;
+		}
+		node.first = uint32_t(n_leaf_surfaces);
+		node.count = uint32_t(count);
+		for (size_t i = 0; i < count; i++)
+		{
+			leaf_surfaces[n_leaf_surfaces++] = refs[i].surface;
+		}
+	}
+
+	//builds the subtree for refs[0, count) into nodes[index]; takes ownership of refs
+	void build_node(Reference* refs, const size_t count, const uint32_t index, const size_t depth)
+	{
+		Node* nodes = Parent::nodes;
+		fvector node_lower, node_upper, c_lower, c_upper;
+		empty_box(node_lower, node_upper);
+		empty_box(c_lower, c_upper);
+		for (size_t i = 0; i < count; i++)
+		{
+			Parent::grow(node_lower, node_upper, refs[i].lower, refs[i].upper);
+			const fvector centroid = refs[i].centroid();
+			Parent::grow(c_lower, c_upper, centroid, centroid);
+		}
+		nodes[index].lower = node_lower;
+		nodes[index].upper = node_upper;
+
+		if (count == 1 || depth + 1 >= Parent::max_depth)
+		{
+			add_leaf(nodes[index], refs, count);
+			delete[] refs;
+			return;
+		}
+
+		const ftype parent_area = Parent::surface_area(node_lower, node_upper);
+		Split best;
+		find_object_split(refs, count, c_lower, c_upper, parent_area, best);
+
+		//only worth looking for a spatial split where the object split's children overlap
+		if (best.cost != ftype(INFINITY) && n_references + count <= max_references)
+		{
+			fvector overlap_lower, overlap_upper;
+			for (size_t i = 0; i < 3; i++)
+			{
+				overlap_lower[i] = Maths::max(best.left_lower[i], best.right_lower[i]);
+				overlap_upper[i] = Maths::min(best.left_upper[i], best.right_upper[i]);
+			}
+			if (!is_empty(overlap_lower, overlap_upper) &&
+				Parent::surface_area(overlap_lower, overlap_upper) > split_alpha * root_area)
+			{
+				find_spatial_split(refs, count, node_lower, node_upper, parent_area, best);
+			}
+		}
+
+		if (best.cost == ftype(INFINITY) || (count <= Parent::max_leaf_size && best.cost >= ftype(count)))
+		{
+			add_leaf(nodes[index], refs, count);
+			delete[] refs;
+			return;
+		}
+
+		//at most every reference goes to both sides
+		Reference* left_refs = new Reference[count];
+		Reference* right_refs = new Reference[count];
+		size_t n_left = 0;
+		size_t n_right = 0;
+		const size_t axis = best.axis;
+		if (best.spatial)
+		{
+			const ftype width = (node_upper[axis] - node_lower[axis]) / ftype(n_spatial_bins);
+			const ftype scale = ftype(1) / width;
+			const ftype plane = node_lower[axis] + ftype(best.bin) * width;
+			for (size_t i = 0; i < count; i++)
+			{
+				const size_t first = spatial_bin(refs[i].lower[axis], node_lower[axis], scale);
+				const size_t last = spatial_bin(refs[i].upper[axis], node_lower[axis], scale);
+				if (last < best.bin)
+				{
+					left_refs[n_left++] = refs[i];
+				}
+				else if (first >= best.bin)
+				{
+					right_refs[n_right++] = refs[i];
+				}
+				else
+				{
+					//the reference straddles the plane; each side gets the part that lies in it
+					Reference left = refs[i];
+					Reference right = refs[i];
+					clip(refs[i], axis, -ftype(INFINITY), plane, left.lower, left.upper);
+					clip(refs[i], axis, plane, ftype(INFINITY), right.lower, right.upper);
+					const bool has_left = !is_empty(left.lower, left.upper);
+					const bool has_right = !is_empty(right.lower, right.upper);
+					if (has_left || !has_right)
+					{
+						left_refs[n_left++] = has_left ? left : refs[i];
+					}
+					if (has_right)
+					{
+						right_refs[n_right++] = right;
+					}
+				}
+			}
+			n_references += n_left + n_right - count;
+		}
+		else
+		{
+			const ftype scale = ftype(Parent::n_bins) / (c_upper[axis] - c_lower[axis]);
+			for (size_t i = 0; i < count; i++)
+			{
+				const size_t b = Maths::min(size_t((refs[i].centroid()[axis] - c_lower[axis]) * scale), Parent::n_bins - 1);
+				if (b < best.bin)
+				{
+					left_refs[n_left++] = refs[i];
+				}
+				else
+				{
+					right_refs[n_right++] = refs[i];
+				}
+			}
+		}
+		delete[] refs;
+
+		//a spatial split that copies everything to one side would never finish
+		if (!n_left || !n_right)
+		{
+			Reference* all = n_left ? left_refs : right_refs;
+			delete[] (n_left ? right_refs : left_refs);
+			add_leaf(Parent::nodes[index], all, n_left + n_right);
+			delete[] all;
+			return;
+		}
+
+		//allocating can move the nodes
+		const uint32_t left = Parent::allocate_pair();
+		Parent::nodes[index].first = left;
+		Parent::nodes[index].count = 0;
+
+		build_node(left_refs, n_left, left, depth + 1);
+		build_node(right_refs, n_right, left + 1, depth + 1);
+	}
+
+public:
+	//reference_budget is how many references the tree may hold for every surface; 1 turns spatial splits off
+	SpatialSplitBoundingVolumeHierarchy(const ftype reference_budget_ = ftype(1.5)) :
+		reference_budget(reference_budget_),
+		n_surfaces(0),
+		root_area(0),
+		n_references(0),
+		max_references(0),
+		leaf_surfaces(nullptr),
+		n_leaf_surfaces(0),
+		leaf_capacity(0)
+	{}
+
+	SpatialSplitBoundingVolumeHierarchy(const SpatialSplitBoundingVolumeHierarchy& other) = delete;
+
+	virtual void build() override
+	{
+		Parent::clear();
+		n_surfaces = 0;
+		const size_t n = Surface<ftype>::surface_count();
+		Reference* refs = new Reference[n];
+		size_t count = 0;
+		Accelerator<ftype>::partition_surfaces([refs, &count](const SurfaceInfo& info)
+		{
+			Reference& ref = refs[count];
+			ref.lower = info.m_aabb.get_lower_bounds();
+			ref.upper = info.m_aabb.get_upper_bounds();
+			ref.surface = info.m_surface;
+			ref.triangle = dynamic_cast<const Triangle<ftype>*>(info.m_surface);
+			count++;
+		});
+		if (!count)
+		{
+			delete[] refs;
+			return;
+		}
+
+		n_surfaces = count;
+		n_references = count;
+		max_references = size_t(ftype(count) * reference_budget);
+		fvector lower, upper;
+		empty_box(lower, upper);
+		for (size_t i = 0; i < count; i++)
+		{
+			Parent::grow(lower, upper, refs[i].lower, refs[i].upper);
+		}
+		root_area = Parent::surface_area(lower, upper);
+
+		leaf_capacity = max_references;
+		leaf_surfaces = new const Surface<ftype>*[leaf_capacity];
+		n_leaf_surfaces = 0;
+
+		Parent::reserve_nodes(2 * count - 1);
+		Parent::n_nodes = 1;
+		build_node(refs, count, 0, 0);
+		Parent::compute_costs(0);
+		Parent::layout_treelets();
+
+		Parent::n_primitives = n_leaf_surfaces;
+		Parent::primitives.pack(leaf_surfaces, n_leaf_surfaces);
+		delete[] leaf_surfaces;
+		leaf_surfaces = nullptr;
+		leaf_capacity = 0;
+	}
+
+	//how many references the last build ended up with for every surface; 1 when nothing was split
+	inline ftype duplication()const
+	{
+		return n_surfaces ? ftype(Parent::n_primitives) / ftype(n_surfaces) : ftype(0);
+	}
+};
+
+#endif
@@ -0,0 +1,486 @@
+#ifndef UNIFORM_GRID_H
+#define UNIFORM_GRID_H
+
+#include "Accelerator.h"
+#include "PackedPrimitives.h"
+
+#include <atomic>
+#include <cmath>
+#include <stdint.h>
+
+/*
+* A uniform grid over the registered surfaces, for scenes of many primitives of about the same size
+* spread over the scene (the lattice of spheres in camera_tests). There a grid is as good as a tree
+* for finding the surfaces near a ray, it is walked without a stack, and it builds in two passes
+* over the primitives that run on all the threads of a pool.
+*
+* the scene's box is cut into cells_per_primitive cells per primitive, as close to cubes as the
+* box allows. Every cell keeps a list of the primitives whose aabbs overlap it, all of them in one
+* array with an offset per cell. Rays walk the cells they pass through in order with a 3D-DDA
+* (Amanatides & Woo) and stop at the first cell that holds a hit closer than its far side.
+*
+* a primitive that spans several cells would be tested once for each of them, so every ray keeps a
+* small mailbox of the primitives it has just tested and skips those. Skipping one can't change the
+* answer: its hit is already in the Intersection, or it had none.
+*
+* suits(...) looks at the sizes of the primitives and says whether the grid is likely to beat a BVH;
+* Scene::render uses it to pick one when asked to.
+*/
+
+template<typename ftype>
+class UniformGrid : public Accelerator<ftype>
+{
+public:
+	typedef Maths::Vector<ftype, 3> fvector;
+	typedef Geometry::Space<ftype, 1, 3> linef;
+	typedef typename Surface<ftype>::SurfaceInfo SurfaceInfo;
+
+	static constexpr ftype cells_per_primitive = ftype(2);
+	static constexpr size_t max_resolution = 1024;          //cells along any axis
+	static constexpr size_t mailbox_size = 32;              //a power of two
+	static constexpr size_t min_primitives = 64;            //below this a grid isn't worth it
+	static constexpr ftype max_size_variation = ftype(0.25);//the largest coefficient of variation of primitive sizes suits() accepts
+	static constexpr ftype min_occupancy = ftype(0.01);     //the smallest fraction of the scene's box the primitives' boxes must fill
+
+private:
+	//where a ray is in the grid, and how it moves to the next cell
+	struct Walk
+	{
+		int32_t cell[3];
+		int32_t step[3];
+		int32_t end[3];         //the cell index just past the grid in the direction of travel
+		ftype t_next[3];        //the distance to the next cell boundary on each axis
+		ftype t_delta[3];       //the distance between cell boundaries on each axis
+
+		//moves to the next cell, and returns false if that leaves the grid
+		inline bool advance()
+		{
+			size_t axis = (t_next[0] < t_next[1]) ? 0 : 1;
+			axis = (t_next[2] < t_next[axis]) ? 2 : axis;
+			cell[axis] += step[axis];
+			if (cell[axis] == end[axis])
+			{
+				return false;
+			}
+			t_next[axis] += t_delta[axis];
+			return true;
+		}
+
+		inline ftype exit_distance()const
+		{
+			return Maths::min(Maths::min(t_next[0], t_next[1]), t_next[2]);
+		}
+	};
+
+	struct Mailbox
+	{
+		uint32_t ids[mailbox_size];
+
+		Mailbox()
+		{
+			for (size_t i = 0; i < mailbox_size; i++)
+			{
+				ids[i] = UINT32_MAX;
+			}
+		}
+
+		//true the first time a primitive is seen; a later one can push it out, which only costs a retest
+		inline bool first_visit(const uint32_t id)
+		{
+			uint32_t& slot = ids[id & (mailbox_size - 1)];
+			if (slot == id)
+			{
+				return false;
+			}
+			slot = id;
+			return true;
+		}
+	};
+
+	fvector lower;
+	fvector upper;
+	fvector cell_size;
+	fvector inv_cell_size;
+	uint32_t resolution[3];
+	size_t n_cells;
+	uint32_t* cell_start;               //cell i holds cell_items[cell_start[i], cell_start[i + 1])
+	uint32_t* cell_items;
+	size_t n_items;
+	PackedPrimitives<ftype> primitives;
+
+	void clear()
+	{
+		delete[] cell_start;
+		delete[] cell_items;
+		cell_start = nullptr;
+		cell_items = nullptr;
+		primitives.clear();
+		Accelerator<ftype>::unbounded.clear();
+		n_cells = 0;
+		n_items = 0;
+	}
+
+	inline size_t cell_index(const int32_t x, const int32_t y, const int32_t z)const
+	{
+		return (size_t(z) * resolution[1] + size_t(y)) * resolution[0] + size_t(x);
+	}
+
+	inline int32_t cell_coordinate(const ftype position, const size_t axis)const
+	{
+		const int32_t c = int32_t((position - lower[axis]) * inv_cell_size[axis]);
+		return Maths::min(Maths::max(c, int32_t(0)), int32_t(resolution[axis]) - 1);
+	}
+
+	//the cells a box overlaps, padded a little so rays that graze a cell boundary still find it
+	inline void cell_range(const fvector& box_lower, const fvector& box_upper, int32_t first[3], int32_t last[3])const
+	{
+		for (size_t a = 0; a < 3; a++)
+		{
+			const ftype pad = ftype(1e-3) * cell_size[a];
+			first[a] = cell_coordinate(box_lower[a] - pad, a);
+			last[a] = cell_coordinate(box_upper[a] + pad, a);
+		}
+	}
+
+	//sets up the walk of a ray that enters the grid at t_enter; false if it misses the grid before max_distance
+	inline bool start_walk(const linef& ray, const TraversalRay<ftype>& traversal, const ftype max_distance, Walk& walk)const
+	{
+		ftype t_enter = 0;
+		ftype t_exit = max_distance;
+		for (size_t a = 0; a < 3; a++)
+		{
+			const ftype t1 = (lower[a] - traversal.origin[a]) * traversal.inv_direction[a];
+			const ftype t2 = (upper[a] - traversal.origin[a]) * traversal.inv_direction[a];
+			t_enter = Maths::max(Maths::min(t1, t2), t_enter);
+			t_exit = Maths::min(Maths::max(t1, t2), t_exit);
+		}
+		if (t_enter > t_exit / Surface<ftype>::rtolerance)
+		{
+			return false;
+		}
+
+		const fvector& direction = ray.get_axis();
+		for (size_t a = 0; a < 3; a++)
+		{
+			const ftype origin = traversal.origin[a];
+			walk.cell[a] = cell_coordinate(origin + direction[a] * t_enter, a);
+			if (direction[a] > ftype(0))
+			{
+				walk.step[a] = 1;
+				walk.end[a] = int32_t(resolution[a]);
+				walk.t_next[a] = (lower[a] + ftype(walk.cell[a] + 1) * cell_size[a] - origin) * traversal.inv_direction[a];
+				walk.t_delta[a] = cell_size[a] * traversal.inv_direction[a];
+			}
+			else if (direction[a] < ftype(0))
+			{
+				walk.step[a] = -1;
+				walk.end[a] = -1;
+				walk.t_next[a] = (lower[a] + ftype(walk.cell[a]) * cell_size[a] - origin) * traversal.inv_direction[a];
+				walk.t_delta[a] = -cell_size[a] * traversal.inv_direction[a];
+			}
+			else
+			{
+				walk.step[a] = 0;
+				walk.end[a] = -1;
+				walk.t_next[a] = ftype(INFINITY);
+				walk.t_delta[a] = ftype(INFINITY);
+			}
+		}
+		return true;
+	}
+
+public:
+	UniformGrid() :
+		n_cells(0),
+		cell_start(nullptr),
+		cell_items(nullptr),
+		n_items(0)
+	{
+		resolution[0] = resolution[1] = resolution[2] = 0;
+	}
+
+	UniformGrid(const UniformGrid& other) = delete;
+
+	~UniformGrid()
+	{
+		clear();
+	}
+
+	/*
+	* whether a grid is likely to trace infos[0, n) faster than a BVH: there have to be enough bounded
+	* primitives, of about the same size (the coefficient of variation of their box diagonals is at most
+	* max_size_variation), and they have to fill enough of the scene's box that most cells aren't empty
+	*/
+	static bool suits(const SurfaceInfo* infos, const size_t n)
+	{
+		size_t count = 0;
+		ftype sum = 0;
+		ftype sum2 = 0;
+		ftype volume = 0;
+		fvector scene_lower(INFINITY);
+		fvector scene_upper(-INFINITY);
+		for (size_t i = 0; i < n; i++)
+		{
+			if (!infos[i].is_bounded())
+			{
+				continue;
+			}
+			const fvector& box_lower = infos[i].m_aabb.get_lower_bounds();
+			const fvector& box_upper = infos[i].m_aabb.get_upper_bounds();
+			const fvector extent = box_upper - box_lower;
+			const ftype diagonal = Maths::mag(extent);
+			sum += diagonal;
+			sum2 += diagonal * diagonal;
+			volume += extent.x * extent.y * extent.z;
+			for (size_t a = 0; a < 3; a++)
+			{
+				scene_lower[a] = Maths::min(scene_lower[a], box_lower[a]);
+				scene_upper[a] = Maths::max(scene_upper[a], box_upper[a]);
+			}
+			count++;
+		}
+		if (count < min_primitives || sum <= ftype(0))
+		{
+			return false;
+		}
+
+		const ftype mean = sum / ftype(count);
+		const ftype variance = Maths::max(sum2 / ftype(count) - mean * mean, ftype(0));
+		if (std::sqrt(variance) > max_size_variation * mean)
+		{
+			return false;
+		}
+		const fvector scene_extent = scene_upper - scene_lower;
+		const ftype scene_volume = scene_extent.x * scene_extent.y * scene_extent.z;
+		return volume >= min_occupancy * scene_volume;
+	}
+
+	static bool suits_scene()
+	{
+		return suits(Surface<ftype>::get_surface_infos(), Surface<ftype>::surface_count());
+	}
+
+	virtual void build() override
+	{
+		typename Accelerator<ftype>::SerialPool pool;
+		build(pool);
+	}
+
+	//pool can be anything with thread_count() and run(job), like the RenderPool the renders use
+	template<typename pool_type>
+	void build(pool_type& pool)
+	{
+		clear();
+		const size_t n_surfaces = Surface<ftype>::surface_count();
+		const Surface<ftype>** surfaces = new const Surface<ftype>*[n_surfaces];
+		fvector* box_lower = new fvector[n_surfaces];
+		fvector* box_upper = new fvector[n_surfaces];
+		size_t n = 0;
+		lower = fvector(INFINITY);
+		upper = fvector(-INFINITY);
+		Accelerator<ftype>::partition_surfaces([this, surfaces, box_lower, box_upper, &n](const SurfaceInfo& info)
+		{
+			surfaces[n] = info.m_surface;
+			box_lower[n] = info.m_aabb.get_lower_bounds();
+			box_upper[n] = info.m_aabb.get_upper_bounds();
+			for (size_t a = 0; a < 3; a++)
+			{
+				lower[a] = Maths::min(lower[a], box_lower[n][a]);
+				upper[a] = Maths::max(upper[a], box_upper[n][a]);
+			}
+			n++;
+		});
+		if (!n)
+		{
+			delete[] surfaces;
+			delete[] box_lower;
+			delete[] box_upper;
+			return;
+		}
+		primitives.pack(surfaces, n);
+		delete[] surfaces;
+
+		//cells as close to cubes as the box allows; flat boxes still get at least one cell across
+		fvector extent = upper - lower;
+		const ftype largest = Maths::max(Maths::max(extent.x, extent.y), extent.z);
+		for (size_t a = 0; a < 3; a++)
+		{
+			if (extent[a] < ftype(1e-3) * largest)
+			{
+				const ftype pad = ftype(0.5e-3) * largest + ftype(Surface<ftype>::tolerance);
+				lower[a] -= pad;
+				upper[a] += pad;
+			}
+		}
+		extent = upper - lower;
+		const ftype cells_per_length = std::cbrt(cells_per_primitive * ftype(n) / (extent.x * extent.y * extent.z));
+		n_cells = 1;
+		for (size_t a = 0; a < 3; a++)
+		{
+			const ftype cells = Maths::min(Maths::max(std::ceil(extent[a] * cells_per_length), ftype(1)), ftype(max_resolution));
+			resolution[a] = uint32_t(cells);
+			cell_size[a] = extent[a] / ftype(resolution[a]);
+			inv_cell_size[a] = ftype(resolution[a]) / extent[a];
+			n_cells *= resolution[a];
+		}
+
+		//count the primitives in every cell, then give each cell its place in the array and fill it;
+		//both passes run on every thread and only meet in the atomic counters
+		const size_t n_threads = pool.thread_count();
+		std::atomic<uint32_t>* counts = new std::atomic<uint32_t>[n_cells];
+		pool.run([this, counts, n_threads](const size_t thread_index)
+		{
+			for (size_t i = n_cells * thread_index / n_threads; i < n_cells * (thread_index + 1) / n_threads; i++)
+			{
+				counts[i].store(0, std::memory_order_relaxed);
+			}
+		});
+		pool.run([this, counts, box_lower, box_upper, n, n_threads](const size_t thread_index)
+		{
+			for (size_t i = n * thread_index / n_threads; i < n * (thread_index + 1) / n_threads; i++)
+			{
+				int32_t first[3], last[3];
+				cell_range(box_lower[i], box_upper[i], first, last);
+				for (int32_t z = first[2]; z <= last[2]; z++)
+				{
+					for (int32_t y = first[1]; y <= last[1]; y++)
+					{
+						for (int32_t x = first[0]; x <= last[0]; x++)
+						{
+							counts[cell_index(x, y, z)].fetch_add(1, std::memory_order_relaxed);
+						}
+					}
+				}
+			}
+		});
+
+		cell_start = new uint32_t[n_cells + 1];
+		size_t total = 0;
+		for (size_t i = 0; i < n_cells; i++)
+		{
+			cell_start[i] = uint32_t(total);
+			total += counts[i].load(std::memory_order_relaxed);
+			counts[i].store(0, std::memory_order_relaxed);
+		}
+		cell_start[n_cells] = uint32_t(total);
+		n_items = total;
+		cell_items = new uint32_t[n_items];
+
+		pool.run([this, counts, box_lower, box_upper, n, n_threads](const size_t thread_index)
+		{
+			for (size_t i = n * thread_index / n_threads; i < n * (thread_index + 1) / n_threads; i++)
+			{
+				int32_t first[3], last[3];
+				cell_range(box_lower[i], box_upper[i], first, last);
+				for (int32_t z = first[2]; z <= last[2]; z++)
+				{
+					for (int32_t y = first[1]; y <= last[1]; y++)
+					{
+						for (int32_t x = first[0]; x <= last[0]; x++)
+						{
+							const size_t cell = cell_index(x, y, z);
+							cell_items[cell_start[cell] + counts[cell].fetch_add(1, std::memory_order_relaxed)] = uint32_t(i);
+						}
+					}
+				}
+			}
+		});
+
+		//threads fill cells in any order; sorting them keeps the trace the same from one build to the next
+		pool.run([this, n_threads](const size_t thread_index)
+		{
+			for (size_t cell = n_cells * thread_index / n_threads; cell < n_cells * (thread_index + 1) / n_threads; cell++)
+			{
+				uint32_t* items = cell_items + cell_start[cell];
+				const size_t count = cell_start[cell + 1] - cell_start[cell];
+				for (size_t i = 1; i < count; i++)
+				{
+					const uint32_t item = items[i];
+					size_t j = i;
+					for (; j > 0 && items[j - 1] > item; j--)
+					{
+						items[j] = items[j - 1];
+					}
+					items[j] = item;
+				}
+			}
+		});
+
+		delete[] counts;
+		delete[] box_lower;
+		delete[] box_upper;
+	}
+
+	using Accelerator<ftype>::first_intersection;
+	using Accelerator<ftype>::occluded;
+
+	virtual Intersection<ftype> first_intersection(const linef& ray, const TraversalRay<ftype>& traversal)const override
+	{
+		Intersection<ftype> info = Accelerator<ftype>::unbounded_intersection(ray);
+		Walk walk;
+		if (!n_cells || !start_walk(ray, traversal, info.upper_bound, walk))
+		{
+			return info;
+		}
+
+		Mailbox mailbox;
+		do
+		{
+			const size_t cell = cell_index(walk.cell[0], walk.cell[1], walk.cell[2]);
+			for (uint32_t k = cell_start[cell]; k < cell_start[cell + 1]; k++)
+			{
+				const uint32_t id = cell_items[k];
+				if (mailbox.first_visit(id))
+				{
+					primitives.update(info, id, 1, ray);
+				}
+			}
+			//anything hit in a later cell is further away than this cell's far side
+			const ftype t_exit = walk.exit_distance();
+			if (t_exit >= info.upper_bound)
+			{
+				break;
+			}
+		} while (walk.advance());
+		return info;
+	}
+
+	virtual bool occluded(const linef& ray, const TraversalRay<ftype>& traversal, const ftype max_distance)const override
+	{
+		if (Accelerator<ftype>::unbounded_occluded(ray, max_distance))
+		{
+			return true;
+		}
+		Walk walk;
+		if (!n_cells || !start_walk(ray, traversal, max_distance, walk))
+		{
+			return false;
+		}
+
+		Mailbox mailbox;
+		do
+		{
+			const size_t cell = cell_index(walk.cell[0], walk.cell[1], walk.cell[2]);
+			for (uint32_t k = cell_start[cell]; k < cell_start[cell + 1]; k++)
+			{
+				const uint32_t id = cell_items[k];
+				if (mailbox.first_visit(id) && primitives.occludes(id, 1, ray, max_distance))
+				{
+					return true;
+				}
+			}
+			if (walk.exit_distance() >= max_distance)
+			{
+				break;
+			}
+		} while (walk.advance());
+		return false;
+	}
+
+	inline const size_t& cell_count()const { return n_cells; }
+	inline const size_t& item_count()const { return n_items; }
+	inline const uint32_t* get_resolution()const { return resolution; }
+	inline const PackedPrimitives<ftype>& get_primitives()const { return primitives; }
+};
+
+#endif
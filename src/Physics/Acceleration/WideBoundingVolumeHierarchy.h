@@ -0,0 +1,656 @@
+#ifndef WIDE_BOUNDING_VOLUME_HIERARCHY_H
+#define WIDE_BOUNDING_VOLUME_HIERARCHY_H
+
+#include "BoundingVolumeHierarchy.h"
+
+#include <stdint.h>
+
+/*
+* A bounding volume hierarchy with width (4 or 8) children per node, made by collapsing the
+* binary SAH tree of BoundingVolumeHierarchy.
+*
+* each node keeps the boxes of all its children in structure-of-arrays form, so one ray can be
+* tested against every child at once. With SSE (x86-64 always has it) the 4-wide float slab test
+* is done in one go with 128-bit vectors, and with AVX the 8-wide one is done with 256-bit vectors;
+* everything else uses a plain loop over the children that the compiler is free to vectorize.
+*
+* leaves live in their parent's child slots rather than in nodes of their own. Unused slots hold an
+* inverted box that no ray can enter, and are masked out as well so that even a NaN ray can't reach them.
+*
+* update() refits the boxes to surfaces that have moved, the same as the binary tree's, but never rebuilds.
+*/
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define WIDE_BVH_SSE
+#endif
+
+#ifdef __AVX__
+#define WIDE_BVH_AVX
+#endif
+
+#if defined(WIDE_BVH_SSE) || defined(WIDE_BVH_AVX)
+#include <immintrin.h>
+#endif
+
+template<typename ftype, size_t width>
+struct WideNode
+{
+	ftype lower_x[width];
+	ftype lower_y[width];
+	ftype lower_z[width];
+	ftype upper_x[width];
+	ftype upper_y[width];
+	ftype upper_z[width];
+	uint32_t child[width];   //a node index for interior children, or the first primitive of a leaf
+	uint32_t count[width];   //the number of primitives in a leaf child; 0 for interior children and empty slots
+	unsigned int occupied;   //bit i is set if slot i holds a child
+
+	//the slab test against every child at once. Bit i of the result is set if the ray enters child i
+	//before max_distance, and t_near[i] is then the distance it enters at
+	inline unsigned int intersect(const TraversalRay<ftype>& ray, const ftype max_distance, ftype* t_near)const
+	{
+		const ftype* near_x = ray.sign[0] ? upper_x : lower_x;
+		const ftype* far_x = ray.sign[0] ? lower_x : upper_x;
+		const ftype* near_y = ray.sign[1] ? upper_y : lower_y;
+		const ftype* far_y = ray.sign[1] ? lower_y : upper_y;
+		const ftype* near_z = ray.sign[2] ? upper_z : lower_z;
+		const ftype* far_z = ray.sign[2] ? lower_z : upper_z;
+
+		unsigned int mask = 0;
+		for (size_t i = 0; i < width; i++)
+		{
+			//the running bounds go second so a NaN from a zero direction component is ignored
+			ftype t0 = Maths::max((near_x[i] - ray.origin.x) * ray.inv_direction.x, ftype(0));
+			t0 = Maths::max((near_y[i] - ray.origin.y) * ray.inv_direction.y, t0);
+			t0 = Maths::max((near_z[i] - ray.origin.z) * ray.inv_direction.z, t0);
+			ftype t1 = Maths::min((far_x[i] - ray.origin.x) * ray.inv_direction.x, max_distance);
+			t1 = Maths::min((far_y[i] - ray.origin.y) * ray.inv_direction.y, t1);
+			t1 = Maths::min((far_z[i] - ray.origin.z) * ray.inv_direction.z, t1);
+			t_near[i] = t0;
+			//pad the far side so rounding in the surface tests can't lose hits on the boundary
+			mask |= unsigned(t0 <= t1 / Surface<ftype>::rtolerance) << i;
+		}
+		return mask & occupied;
+	}
+
+	//the same slab test for the lanes of a packet set in lanes, each against its own max_distance. child_lanes[i]
+	//gets the lanes that enter child i, and t_min[i] the nearest distance any of them enters it at
+	inline void intersect(
+		const RayPacket<ftype>& packet,
+		const uint32_t lanes,
+		const ftype* max_distance,
+		uint32_t* child_lanes,
+		ftype* t_min)const
+	{
+		for (size_t i = 0; i < width; i++)
+		{
+			child_lanes[i] = (occupied & (1u << i)) ?
+				packet.enter_box(lower_x[i], lower_y[i], lower_z[i], upper_x[i], upper_y[i], upper_z[i], lanes, max_distance, t_min[i]) :
+				0;
+		}
+	}
+};
+
+#ifdef WIDE_BVH_SSE
+template<>
+inline unsigned int WideNode<float, 4>::intersect(const TraversalRay<float>& ray, const float max_distance, float* t_near)const
+{
+	const float* near_x = ray.sign[0] ? upper_x : lower_x;
+	const float* far_x = ray.sign[0] ? lower_x : upper_x;
+	const float* near_y = ray.sign[1] ? upper_y : lower_y;
+	const float* far_y = ray.sign[1] ? lower_y : upper_y;
+	const float* near_z = ray.sign[2] ? upper_z : lower_z;
+	const float* far_z = ray.sign[2] ? lower_z : upper_z;
+
+	const __m128 ox = _mm_set1_ps(ray.origin.x);
+	const __m128 oy = _mm_set1_ps(ray.origin.y);
+	const __m128 oz = _mm_set1_ps(ray.origin.z);
+	const __m128 ix = _mm_set1_ps(ray.inv_direction.x);
+	const __m128 iy = _mm_set1_ps(ray.inv_direction.y);
+	const __m128 iz = _mm_set1_ps(ray.inv_direction.z);
+
+	//_mm_max_ps and _mm_min_ps return their second argument when either is NaN, like Maths::max/min
+	__m128 t0 = _mm_max_ps(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(near_x), ox), ix), _mm_setzero_ps());
+	t0 = _mm_max_ps(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(near_y), oy), iy), t0);
+	t0 = _mm_max_ps(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(near_z), oz), iz), t0);
+	__m128 t1 = _mm_min_ps(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(far_x), ox), ix), _mm_set1_ps(max_distance));
+	t1 = _mm_min_ps(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(far_y), oy), iy), t1);
+	t1 = _mm_min_ps(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(far_z), oz), iz), t1);
+
+	_mm_storeu_ps(t_near, t0);
+	const __m128 padded = _mm_div_ps(t1, _mm_set1_ps(Surface<float>::rtolerance));
+	return unsigned(_mm_movemask_ps(_mm_cmple_ps(t0, padded))) & occupied;
+}
+#endif
+
+#ifdef WIDE_BVH_AVX
+template<>
+inline unsigned int WideNode<float, 8>::intersect(const TraversalRay<float>& ray, const float max_distance, float* t_near)const
+{
+	const float* near_x = ray.sign[0] ? upper_x : lower_x;
+	const float* far_x = ray.sign[0] ? lower_x : upper_x;
+	const float* near_y = ray.sign[1] ? upper_y : lower_y;
+	const float* far_y = ray.sign[1] ? lower_y : upper_y;
+	const float* near_z = ray.sign[2] ? upper_z : lower_z;
+	const float* far_z = ray.sign[2] ? lower_z : upper_z;
+
+	const __m256 ox = _mm256_set1_ps(ray.origin.x);
+	const __m256 oy = _mm256_set1_ps(ray.origin.y);
+	const __m256 oz = _mm256_set1_ps(ray.origin.z);
+	const __m256 ix = _mm256_set1_ps(ray.inv_direction.x);
+	const __m256 iy = _mm256_set1_ps(ray.inv_direction.y);
+	const __m256 iz = _mm256_set1_ps(ray.inv_direction.z);
+
+	__m256 t0 = _mm256_max_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(near_x), ox), ix), _mm256_setzero_ps());
+	t0 = _mm256_max_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(near_y), oy), iy), t0);
+	t0 = _mm256_max_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(near_z), oz), iz), t0);
+	__m256 t1 = _mm256_min_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(far_x), ox), ix), _mm256_set1_ps(max_distance));
+	t1 = _mm256_min_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(far_y), oy), iy), t1);
+	t1 = _mm256_min_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(far_z), oz), iz), t1);
+
+	_mm256_storeu_ps(t_near, t0);
+	const __m256 padded = _mm256_div_ps(t1, _mm256_set1_ps(Surface<float>::rtolerance));
+	return unsigned(_mm256_movemask_ps(_mm256_cmp_ps(t0, padded, _CMP_LE_OQ))) & occupied;
+}
+#endif
+
+template<typename ftype, size_t width>
+class WideBoundingVolumeHierarchy : public Accelerator<ftype>
+{
+public:
+	typedef Maths::Vector<ftype, 3> fvector;
+	typedef Geometry::Space<ftype, 1, 3> linef;
+	typedef Geometry::AxisAlignedBoundingBox<ftype, 3> aabbf;
+	typedef WideNode<ftype, width> Node;
+	typedef BoundingVolumeHierarchy<ftype> BinaryTree;
+	typedef typename BinaryTree::Node BinaryNode;
+
+	static_assert(width >= 2 && width <= 8 * sizeof(unsigned int), "the slab test returns one bit per child");
+
+	static constexpr size_t max_depth = BinaryTree::max_depth;
+
+	//a packet with fewer lanes left than this in a subtree traces them one at a time
+	static constexpr size_t min_packet_lanes = 2;
+
+private:
+	struct StackEntry
+	{
+		uint32_t child;
+		uint32_t count;
+		ftype distance;
+	};
+
+	struct PacketEntry
+	{
+		uint32_t child;
+		uint32_t count;
+		uint32_t lanes;      //the lanes of the packet that enter the child
+		ftype distance;      //the nearest of their entry distances
+	};
+
+	size_t n_nodes;
+	Node* nodes;
+
+	size_t n_primitives;
+	PackedPrimitives<ftype> primitives;      //in leaf order
+
+	void clear()
+	{
+		delete[] nodes;
+		nodes = nullptr;
+		primitives.clear();
+		Accelerator<ftype>::unbounded.clear();
+		n_nodes = 0;
+		n_primitives = 0;
+	}
+
+	static inline ftype surface_area(const BinaryNode& node)
+	{
+		const fvector d = node.upper - node.lower;
+		return ftype(2) * (d.x * d.y + d.y * d.z + d.z * d.x);
+	}
+
+	static inline void set_slot(Node& node, const size_t slot, const BinaryNode& child)
+	{
+		node.occupied |= 1u << slot;
+		node.lower_x[slot] = child.lower.x;
+		node.lower_y[slot] = child.lower.y;
+		node.lower_z[slot] = child.lower.z;
+		node.upper_x[slot] = child.upper.x;
+		node.upper_y[slot] = child.upper.y;
+		node.upper_z[slot] = child.upper.z;
+	}
+
+	static inline void clear_slot(Node& node, const size_t slot)
+	{
+		node.lower_x[slot] = INFINITY;
+		node.lower_y[slot] = INFINITY;
+		node.lower_z[slot] = INFINITY;
+		node.upper_x[slot] = -INFINITY;
+		node.upper_y[slot] = -INFINITY;
+		node.upper_z[slot] = -INFINITY;
+		node.child[slot] = 0;
+		node.count[slot] = 0;
+		node.occupied &= ~(1u << slot);
+	}
+
+	//the box of child slot of node as it is now; a leaf's from its surfaces, an interior child's from its own slots
+	fvector slot_box(const Node& node, const size_t slot, fvector& upper)const
+	{
+		fvector lower(INFINITY);
+		upper = fvector(-INFINITY);
+		if (node.count[slot])
+		{
+			for (size_t i = node.child[slot]; i < node.child[slot] + node.count[slot]; i++)
+			{
+				const aabbf box = primitives.get_surface(i)->make_aabb();
+				grow(lower, upper, box.get_lower_bounds(), box.get_upper_bounds());
+			}
+			return lower;
+		}
+		const Node& child = nodes[node.child[slot]];
+		for (size_t i = 0; i < width; i++)
+		{
+			if (child.occupied & (1u << i))
+			{
+				grow(lower, upper,
+					fvector(child.lower_x[i], child.lower_y[i], child.lower_z[i]),
+					fvector(child.upper_x[i], child.upper_y[i], child.upper_z[i]));
+			}
+		}
+		return lower;
+	}
+
+	static inline void grow(fvector& lower, fvector& upper, const fvector& other_lower, const fvector& other_upper)
+	{
+		for (size_t i = 0; i < 3; i++)
+		{
+			lower[i] = Maths::min(lower[i], other_lower[i]);
+			upper[i] = Maths::max(upper[i], other_upper[i]);
+		}
+	}
+
+	static inline void set_box(Node& node, const size_t slot, const fvector& lower, const fvector& upper)
+	{
+		node.lower_x[slot] = lower.x;
+		node.lower_y[slot] = lower.y;
+		node.lower_z[slot] = lower.z;
+		node.upper_x[slot] = upper.x;
+		node.upper_y[slot] = upper.y;
+		node.upper_z[slot] = upper.z;
+	}
+
+	//turns the binary subtree under binary_nodes[root] into wide nodes; gives the index of the top one.
+	//the binary children with the largest area are opened up first, until the node is full
+	uint32_t collapse(const BinaryNode* binary_nodes, const uint32_t root)
+	{
+		uint32_t slots[width];
+		size_t n_slots = 2;
+		slots[0] = binary_nodes[root].first;
+		slots[1] = binary_nodes[root].first + 1;
+
+		while (n_slots < width)
+		{
+			size_t best = width;
+			ftype best_area = -INFINITY;
+			for (size_t i = 0; i < n_slots; i++)
+			{
+				const BinaryNode& candidate = binary_nodes[slots[i]];
+				if (!candidate.is_leaf() && surface_area(candidate) > best_area)
+				{
+					best = i;
+					best_area = surface_area(candidate);
+				}
+			}
+			if (best == width)
+			{
+				break;
+			}
+			const uint32_t opened = slots[best];
+			slots[best] = binary_nodes[opened].first;
+			slots[n_slots] = binary_nodes[opened].first + 1;
+			n_slots++;
+		}
+
+		const uint32_t index = uint32_t(n_nodes);
+		n_nodes++;
+		nodes[index].occupied = 0;
+		for (size_t i = 0; i < width; i++)
+		{
+			if (i >= n_slots)
+			{
+				clear_slot(nodes[index], i);
+				continue;
+			}
+			const BinaryNode& child = binary_nodes[slots[i]];
+			set_slot(nodes[index], i, child);
+			if (child.is_leaf())
+			{
+				nodes[index].child[i] = child.first;
+				nodes[index].count[i] = child.count;
+			}
+			else
+			{
+				const uint32_t child_index = collapse(binary_nodes, slots[i]);
+				nodes[index].child[i] = child_index;
+				nodes[index].count[i] = 0;
+			}
+		}
+		return index;
+	}
+
+	//carries the closest hit in info on through the subtree under root, for one ray
+	void trace(const StackEntry root, const linef& ray, const TraversalRay<ftype>& traversal, Intersection<ftype>& info)const
+	{
+		StackEntry stack[max_depth * width];
+		size_t top = 0;
+		stack[top++] = root;
+
+		while (top)
+		{
+			const StackEntry entry = stack[--top];
+			//a closer hit may have been found since this child was pushed
+			if (entry.distance > info.upper_bound)
+			{
+				continue;
+			}
+
+			if (entry.count)
+			{
+				primitives.update(info, entry.child, entry.count, ray);
+				continue;
+			}
+
+			const Node& node = nodes[entry.child];
+			ftype t_near[width];
+			unsigned int mask = node.intersect(traversal, info.upper_bound, t_near);
+
+			//push the children that were hit far to near, so the nearest is visited first
+			const size_t first = top;
+			while (mask)
+			{
+				size_t i = 0;
+				while (!(mask & (1u << i)))
+				{
+					i++;
+				}
+				mask &= ~(1u << i);
+
+				size_t j = top;
+				while (j > first && stack[j - 1].distance < t_near[i])
+				{
+					stack[j] = stack[j - 1];
+					j--;
+				}
+				stack[j] = { node.child[i], node.count[i], t_near[i] };
+				top++;
+			}
+		}
+	}
+
+public:
+	WideBoundingVolumeHierarchy() :
+		n_nodes(0),
+		nodes(nullptr),
+		n_primitives(0)
+	{}
+
+	WideBoundingVolumeHierarchy(const WideBoundingVolumeHierarchy& other) = delete;
+
+	~WideBoundingVolumeHierarchy()
+	{
+		clear();
+	}
+
+	virtual void build() override
+	{
+		BinaryTree binary;
+		binary.build();
+		build(binary);
+	}
+
+	//collapses a binary tree that has already been built over the registered surfaces, such as one read
+	//back by AcceleratorCache or made by one of the other builders
+	void build(const BinaryTree& binary)
+	{
+		clear();
+		Accelerator<ftype>::partition_surfaces([](const typename Surface<ftype>::SurfaceInfo&) {});
+
+		n_primitives = binary.primitive_count();
+		if (!n_primitives)
+		{
+			return;
+		}
+
+		//the wide tree uses the same leaves, so the primitives keep the binary tree's order
+		const PackedPrimitives<ftype>& binary_primitives = binary.get_primitives();
+		const Surface<ftype>** surfaces = new const Surface<ftype>*[n_primitives];
+		for (size_t i = 0; i < n_primitives; i++)
+		{
+			surfaces[i] = binary_primitives.get_surface(i);
+		}
+		primitives.pack(surfaces, n_primitives);
+		delete[] surfaces;
+
+		//every wide node replaces at least one interior binary node, so this is always enough
+		const BinaryNode* binary_nodes = binary.get_nodes();
+		nodes = new Node[binary.node_count()];
+		if (binary_nodes[0].is_leaf())
+		{
+			//a lone leaf still needs a node to hang from
+			n_nodes = 1;
+			nodes[0].occupied = 0;
+			for (size_t i = 0; i < width; i++)
+			{
+				clear_slot(nodes[0], i);
+			}
+			set_slot(nodes[0], 0, binary_nodes[0]);
+			nodes[0].child[0] = binary_nodes[0].first;
+			nodes[0].count[0] = binary_nodes[0].count;
+		}
+		else
+		{
+			collapse(binary_nodes, 0);
+		}
+	}
+
+	using Accelerator<ftype>::first_intersection;
+	using Accelerator<ftype>::occluded;
+
+	virtual Intersection<ftype> first_intersection(const linef& ray, const TraversalRay<ftype>& traversal)const override
+	{
+		Intersection<ftype> info = Accelerator<ftype>::unbounded_intersection(ray);
+		if (n_nodes)
+		{
+			trace({ 0, 0, 0 }, ray, traversal, info);
+		}
+		return info;
+	}
+
+	/*
+	* traces the packet's lanes down the tree together: each node is read once for all of them, and a child
+	* is visited by the lanes that enter it. once fewer than min_packet_lanes are left in a subtree the
+	* packet has diverged, and those lanes finish the subtree one ray at a time
+	*/
+	virtual void first_intersection(RayPacket<ftype>& packet)const override
+	{
+		Accelerator<ftype>::unbounded_intersection(packet);
+		if (!n_nodes || !packet.active)
+		{
+			return;
+		}
+
+		PacketEntry stack[max_depth * width];
+		size_t top = 0;
+		stack[top++] = { 0, 0, packet.active, 0 };
+
+		ftype bounds[RayPacket<ftype>::size];
+		while (top)
+		{
+			const PacketEntry entry = stack[--top];
+
+			//lanes that have found a hit closer than the child since it was pushed leave it
+			uint32_t lanes = 0;
+			for (size_t l = 0; l < RayPacket<ftype>::size; l++)
+			{
+				bounds[l] = packet.hits[l].upper_bound;
+				lanes |= uint32_t(!(entry.distance > bounds[l])) << l;
+			}
+			lanes &= entry.lanes;
+			if (!lanes)
+			{
+				continue;
+			}
+
+			if (RayPacket<ftype>::lane_count(lanes) < min_packet_lanes)
+			{
+				RayPacket<ftype>::for_each_lane(lanes, [this, &packet, &entry](const size_t lane)
+				{
+					const linef& ray = packet.rays[lane];
+					trace({ entry.child, entry.count, 0 }, ray, TraversalRay<ftype>(ray), packet.hits[lane]);
+				});
+				continue;
+			}
+
+			if (entry.count)
+			{
+				primitives.update(packet, entry.child, entry.count, lanes);
+				continue;
+			}
+
+			const Node& node = nodes[entry.child];
+			uint32_t child_lanes[width];
+			ftype t_min[width];
+			node.intersect(packet, lanes, bounds, child_lanes, t_min);
+
+			//far to near, as for a single ray
+			const size_t first = top;
+			for (size_t i = 0; i < width; i++)
+			{
+				if (!child_lanes[i])
+				{
+					continue;
+				}
+				size_t j = top;
+				while (j > first && stack[j - 1].distance < t_min[i])
+				{
+					stack[j] = stack[j - 1];
+					j--;
+				}
+				stack[j] = { node.child[i], node.count[i], child_lanes[i], t_min[i] };
+				top++;
+			}
+		}
+	}
+
+	virtual bool occluded(const linef& ray, const TraversalRay<ftype>& traversal, const ftype max_distance)const override
+	{
+		//unbounded surfaces are cheap and block a lot of rays, so they go first
+		if (Accelerator<ftype>::unbounded_occluded(ray, max_distance))
+		{
+			return true;
+		}
+		if (!n_nodes)
+		{
+			return false;
+		}
+
+		//any blocker will do, so there is no need to order the children
+		uint32_t stack[max_depth * width];
+		size_t top = 0;
+		stack[top++] = 0;
+		while (top)
+		{
+			const Node& node = nodes[stack[--top]];
+			ftype t_near[width];
+			unsigned int mask = node.intersect(traversal, max_distance, t_near);
+			for (size_t i = 0; mask; i++, mask >>= 1)
+			{
+				if (!(mask & 1u))
+				{
+					continue;
+				}
+				if (!node.count[i])
+				{
+					stack[top++] = node.child[i];
+				}
+				else if (primitives.occludes(node.child[i], node.count[i], ray, max_distance))
+				{
+					return true;
+				}
+			}
+		}
+		return false;
+	}
+
+	/*
+	* refits the tree to the surfaces that have moved since it was built or last updated, like
+	* BoundingVolumeHierarchy::update, but without ever rebuilding a subtree: the wide nodes don't keep
+	* the costs the binary tree was built with, so a scene whose surfaces have travelled far from where
+	* they started should be built again.
+	*
+	* the moved primitives and the leaf boxes are refreshed on the threads of the pool. collapse() numbers
+	* every node before its children, so the interior boxes are then refitted going backwards through the array.
+	*/
+	template<typename pool_type>
+	void update(pool_type& pool)
+	{
+		const size_t n_threads = pool.thread_count();
+		const uint64_t now = Surface<ftype>::move_time();
+		pool.run([this, n_threads](const size_t thread_index)
+		{
+			const size_t first = n_primitives * thread_index / n_threads;
+			primitives.refresh_moved(first, n_primitives * (thread_index + 1) / n_threads - first);
+		});
+		primitives.set_snapshot_time(now);
+		Surface<ftype>::refresh_moved_bounds();
+
+		pool.run([this, n_threads](const size_t thread_index)
+		{
+			for (size_t index = n_nodes * thread_index / n_threads; index < n_nodes * (thread_index + 1) / n_threads; index++)
+			{
+				for (size_t slot = 0; slot < width; slot++)
+				{
+					if ((nodes[index].occupied & (1u << slot)) && nodes[index].count[slot])
+					{
+						fvector upper;
+						const fvector lower = slot_box(nodes[index], slot, upper);
+						set_box(nodes[index], slot, lower, upper);
+					}
+				}
+			}
+		});
+		for (size_t index = n_nodes; index-- > 0;)
+		{
+			for (size_t slot = 0; slot < width; slot++)
+			{
+				if ((nodes[index].occupied & (1u << slot)) && !nodes[index].count[slot])
+				{
+					fvector upper;
+					const fvector lower = slot_box(nodes[index], slot, upper);
+					set_box(nodes[index], slot, lower, upper);
+				}
+			}
+		}
+	}
+
+	void update()
+	{
+		typename Accelerator<ftype>::SerialPool pool;
+		update(pool);
+	}
+
+	inline const size_t& node_count()const { return n_nodes; }
+	inline const size_t& primitive_count()const { return n_primitives; }
+	inline const Node* get_nodes()const { return nodes; }
+	inline const PackedPrimitives<ftype>& get_primitives()const { return primitives; }
+};
+
+//4 children per node suits SSE, 8 suits AVX
+template<typename ftype>
+using BoundingVolumeHierarchy4 = WideBoundingVolumeHierarchy<ftype, 4>;
+
+template<typename ftype>
+using BoundingVolumeHierarchy8 = WideBoundingVolumeHierarchy<ftype, 8>;
+
+#endif
@@ -6,6 +6,10 @@
 #include "Surfaces/Surface.h"
 #include "Physics/Intersection.h"
 #include "Physics/RayInfo.h"
+#include "Physics/RayPacket.h"
+#include "Physics/PathTermination.h"
+#include "Acceleration/Accelerator.h"
+#include "Acceleration/Instance.h"
 //#include "Camera/Camera.h"
 
 /*
@@ -31,6 +35,15 @@ template<typename ftype>
 Optics::SpectrumArray<ftype> find_ray_intensity(
     RayInfo<ftype>& info);
 
+/*
+the same for a ray whose first intersection has already been found, such as a primary ray
+tested against the surfaces its tile of the camera can see
+*/
+template<typename ftype>
+Optics::SpectrumArray<ftype> find_ray_intensity(
+    RayInfo<ftype>& info,
+    const Intersection<ftype>& intersection_info);
+
 /*
 * given an array of surface pointers, we find the surface that the ray intersects first.
 * it would be good to order the surfaces by distance... perhaps in a variation of this
@@ -38,39 +51,135 @@ Optics::SpectrumArray<ftype> find_ray_intensity(
 template<typename ftype>
 Intersection<ftype> first_intersection(
     const Geometry::Space<ftype, 1, 3>& ray,
-    const Surface<ftype>** surfaces,
+    const Surface<ftype>* const* surfaces,
     const size_t n_surfaces)
 {
     Intersection<ftype> info;
     for(size_t i=0; i < n_surfaces; i++)
     {
-        const Surface<ftype>* surface = surfaces[i];
-        info.update(surface, surface->first_intersection(ray));
+        surfaces[i]->intersect(info, ray);
     }
     return info;
 }
 
+template<typename ftype>
+Intersection<ftype> first_intersection(
+    const Geometry::Space<ftype, 1, 3>& ray,
+    const Span<const Surface<ftype>*>& surfaces)
+{
+    return first_intersection<ftype>(ray, surfaces.get_objects(), surfaces.get_size());
+}
 
 /*
-finds the ray that is reflected specularly of a surface with input normal at input position*/
+* finds the surface the ray intersects first in the whole scene. the active accelerator answers this
+* when one has been built; otherwise every surface that survives the cull is tested.
+*/
 template<typename ftype>
-Optics::SpectrumArray<ftype> compute_specular_reflection(
-    RayInfo<ftype>& info,
+Intersection<ftype> first_intersection(const Geometry::Space<ftype, 1, 3>& ray, const TraversalRay<ftype>& traversal)
+{
+    typedef Geometry::AxisAlignedBoundingBox<ftype, 3> aabbf;
+
+    const Accelerator<ftype>* accelerator = Accelerator<ftype>::get_active();
+    if (accelerator)
+    {
+        return accelerator->first_intersection(ray, traversal);
+    }
+
+    aabbf culling_box(ray.get_origin(), ray.get_axis() * ftype(INFINITY) + ray.get_origin());
+    return first_intersection<ftype>(ray, Surface<ftype>::surface_cull(culling_box));
+}
+
+template<typename ftype>
+Intersection<ftype> first_intersection(const Geometry::Space<ftype, 1, 3>& ray)
+{
+    return first_intersection<ftype>(ray, TraversalRay<ftype>(ray));
+}
+
+/*
+* the first intersections of every ray in the packet, left in packet.hits. the active accelerator traces
+* them together if it knows how; without one, each ray is tested on its own
+*/
+template<typename ftype>
+void first_intersection(RayPacket<ftype>& packet)
+{
+    const Accelerator<ftype>* accelerator = Accelerator<ftype>::get_active();
+    if (accelerator)
+    {
+        accelerator->first_intersection(packet);
+        return;
+    }
+    RayPacket<ftype>::for_each_lane(packet.active, [&packet](const size_t lane)
+    {
+        packet.hits[lane] = first_intersection<ftype>(packet.rays[lane]);
+    });
+}
+
+
+/*
+the ray that is reflected specularly off a surface with input normal at input position*/
+template<typename ftype>
+const Geometry::Space<ftype, 1, 3> reflected_ray(
+    const Maths::Vector<ftype, 3>& incident_direction,
     const Maths::Vector<ftype, 3>& position,
     const Maths::Vector<ftype, 3>& normal)
 {
     //find the direction of the reflected ray, this should be a unit vector
-    const Maths::Vector<ftype, 3> new_direction = info.m_ray.get_axis() - (ftype(2) * Maths::dot(normal, info.m_ray.get_axis()))*normal;
+    const Maths::Vector<ftype, 3> new_direction = incident_direction - (ftype(2) * Maths::dot(normal, incident_direction))*normal;
+    return Geometry::Space<ftype, 1, 3>(position, new_direction, true);
+}
 
+/*
+finds the light arriving along the ray that is reflected specularly of a surface with input normal at input position.
+throughput is the reflected ray's*/
+template<typename ftype>
+Optics::SpectrumArray<ftype> compute_specular_reflection(
+    RayInfo<ftype>& info,
+    const Maths::Vector<ftype, 3>& position,
+    const Maths::Vector<ftype, 3>& normal,
+    const ftype throughput)
+{
     //make a new ray:
     RayInfo<ftype> new_info(
-        Geometry::Space<ftype, 1, 3>(position, new_direction, true), 
+        reflected_ray(info.m_ray.get_axis(), position, normal),
         info.m_bitfield, 
-        info.m_generation + 1);
+        info.m_generation + 1,
+        ftype(1.0),
+        throughput);
 
     return find_ray_intensity(new_info);
 }
 
+/*
+the light that one source delivers to a diffusive surface with input normal at input position, in the colours
+of bitfield, when illumination_ratio of the source reaches the position
+*/
+template<typename ftype>
+Optics::SpectrumArray<ftype> diffuse_light(
+    const LightSource<ftype>* light,
+    const Optics::SpectrumInt bitfield,
+    const Maths::Vector<ftype, 3>& position,
+    const Maths::Vector<ftype, 3>& normal,
+    const ftype illumination_ratio)
+{
+    //define the diffusive constant
+    constexpr static ftype diffusive_constant = 1 / Maths::two_pi<ftype>;
+
+    //find the cosine of direction to normal and multiply with the other constants
+    const ftype constant = Maths::modulus(Maths::dot(normal, light->get_effective_direction(position)) * diffusive_constant * illumination_ratio);
+    Optics::SpectrumArray<ftype> this_intensity = light->get_intensity(position) * constant;
+
+    if (bitfield != Optics::all_colours)
+    {
+        BEGIN_SPECTRUM_LOOP(j)
+            if (!(bitfield & (1 << j)))
+            {
+                this_intensity[j] = ftype(0.0);
+            }
+        END_SPECTRUM_LOOP
+    }
+    return this_intensity;
+}
+
 /*
 finds the effective intensity value for each light source in the scene
 after a ray has been incident on a diffusive surface 
@@ -81,9 +190,6 @@ Optics::SpectrumArray<ftype> compute_diffusive_reflection(
     const Maths::Vector<ftype, 3>& position,
     const Maths::Vector<ftype, 3>& normal)
 {
-    //define the diffusive constant
-    constexpr static ftype diffusive_constant = 1 / Maths::two_pi<ftype>;
-
     Optics::SpectrumArray<ftype> out;
 
     //loop through the light sources...
@@ -96,20 +202,7 @@ Optics::SpectrumArray<ftype> compute_diffusive_reflection(
         //see if this point is illuminated by our source
         if (illumination_ratio)
         {
-            //find the cosine of direction to normal and multiply with the other constants
-            const ftype constant = Maths::modulus(Maths::dot(normal, light->get_effective_direction(position)) * diffusive_constant * illumination_ratio);
-            Optics::SpectrumArray<ftype> this_intensity = light->get_intensity(position) * constant;
-
-            if (info.m_bitfield != Optics::all_colours)
-            {
-                BEGIN_SPECTRUM_LOOP(j)
-                    if (!(info.m_bitfield & (1 << j)))
-                    {
-                        this_intensity[j] = ftype(0.0);
-                    }
-                END_SPECTRUM_LOOP
-            }
-            out += this_intensity;
+            out += diffuse_light(light, info.m_bitfield, position, normal, illumination_ratio);
         }
     }
     return out;
@@ -141,14 +234,16 @@ const Geometry::Space<ftype, 1, 3> refracted_ray(
 }
 
 /*
-returns the rayinfo struct when a 
+finds the light arriving along the rays refracted at input position, one for each group of colours the material
+bends the same way. throughput is the refracted rays'
 */
 template<typename ftype>
 Optics::SpectrumArray<ftype> compute_refraction(
     RayInfo<ftype>& info,
     const Maths::Vector<ftype, 3>& position,
     const Maths::Vector<ftype, 3>& normal,
-    const Optics::Material<ftype>* material)
+    const Optics::Material<ftype>* material,
+    const ftype throughput)
 {
 
     Optics::SpectrumArray<ftype> out;
@@ -169,7 +264,8 @@ Optics::SpectrumArray<ftype> compute_refraction(
                 new_ray,
                 colours,
                 info.m_generation + 1,
-                new_n);
+                new_n,
+                throughput);
             
             out += (find_ray_intensity(new_info)* transmissivities);
         }
@@ -178,47 +274,62 @@ Optics::SpectrumArray<ftype> compute_refraction(
 }
 
 
+//the threshold value that the properties of a material must be above to calculate something
+template<typename ftype>
+constexpr ftype threshold_value = ftype(1e-3);
+
+/*
+where the ray hit the closest surface of intersection_info, which must be set, the surface normal
+there and the material it has there
+*/
+template<typename ftype>
+const Optics::Material<ftype>* hit_point(
+    const Geometry::Space<ftype, 1, 3>& ray,
+    const Intersection<ftype>& intersection_info,
+    Maths::Vector<ftype, 3>& position,
+    Maths::Vector<ftype, 3>& normal)
+{
+    //get the intersection position:
+    position = ray.get_origin() + ray.get_axis() * intersection_info.distance;
+
+    //get the surface normal and the material properties:
+    const Surface<ftype>* closest_surface = intersection_info.closest;
+    if (intersection_info.instance)
+    {
+        //the hit was on a part of an instance, which lives in the instance's space
+        normal = intersection_info.instance->part_normal(closest_surface, position);
+        return intersection_info.instance->part_material(closest_surface, position);
+    }
+    normal = closest_surface->normal(position);
+    return closest_surface->get_material_component()->get_material(closest_surface->get_local_coordinates(position));
+}
+
 /*
 
 */
 template<typename ftype>
 Optics::SpectrumArray<ftype> find_ray_intensity(RayInfo<ftype>& info) // we could provide a background colour here.
 {
-    typedef Geometry::AxisAlignedBoundingBox<ftype, 3> aabbf;
-
+    //check that we're not past max generations or this could go on forever.
+    if (info.m_generation >= RayInfo<ftype>::max_generations) { return Optics::SpectrumArray<ftype>(); }
 
-    //define the threshold value that the properties must be above to calculate something
-    static constexpr ftype threshold_value = 1e-3;
+    //we shoot this ray into space to find the surface of the first intersection...
+    return find_ray_intensity(info, first_intersection<ftype>(info.m_ray, info.m_traversal));
+}
 
+template<typename ftype>
+Optics::SpectrumArray<ftype> find_ray_intensity(RayInfo<ftype>& info, const Intersection<ftype>& intersection_info)
+{
     Optics::SpectrumArray<ftype> out;
 
-    //check that we're not past max generations or this could go on forever.
     if (info.m_generation >= RayInfo<ftype>::max_generations) { return out; }
 
-    aabbf culling_box(info.m_ray.get_origin(), info.m_ray.get_axis() * ftype(INFINITY) + info.m_ray.get_origin());
-    Set<Surface<ftype>*> remaining_surfaces = Surface<ftype>::surface_cull(culling_box);
-
-    //we shoot this ray into space to find the surface of the first intersection...
-    const Intersection<ftype> intersection_info = 
-        first_intersection<ftype>(
-            info.m_ray,
-            static_cast<const Surface<ftype>**>(remaining_surfaces),
-            remaining_surfaces.get_size());
-
     //if we don't collide with a surface, we don't modify the array whatsoever, as it is 0.0
     if (!intersection_info.closest) { return out; }
 
-    //get the intersection position:
-    const Maths::Vector<ftype, 3> intersection_position = info.m_ray.get_origin() + info.m_ray.get_axis() * intersection_info.distance;
-
-    //get the surface normal
-    const Maths::Vector<ftype, 3> surface_normal = intersection_info.closest->normal(intersection_position);
-
-    //get the material properties:
-    const Surface<ftype>* closest_surface = intersection_info.closest;
-
-    const Optics::Material<ftype>* material = 
-        closest_surface->get_material_component()->get_material(closest_surface->get_local_coordinates(intersection_position));
+    Maths::Vector<ftype, 3> intersection_position;
+    Maths::Vector<ftype, 3> surface_normal;
+    const Optics::Material<ftype>* material = hit_point(info.m_ray, intersection_info, intersection_position, surface_normal);
 
     const Optics::SpectrumArray<const ftype*> diffusivity(material->get_diffusivity());
     const Optics::SpectrumArray<const ftype*> specularity(material->get_specularity());
@@ -229,20 +340,41 @@ Optics::SpectrumArray<ftype> find_ray_intensity(RayInfo<ftype>& info) // we coul
     Optics::SpectrumArray<ftype> spec;
     Optics::SpectrumArray<ftype> trans;
 
-    if (diffusivity.threshold(threshold_value))
+    if (diffusivity.threshold(threshold_value<ftype>))
     {
         //we can pass coefficients through these?
         diff = compute_diffusive_reflection<ftype>(info, intersection_position, surface_normal)*diffusivity;
     }
 
-    if (specularity.threshold(threshold_value))
+    //the active termination may drop rays whose light would hardly reach the camera, or scale up the ones it keeps
+    const PathTermination<ftype>& termination = PathTermination<ftype>::get_active();
+    ftype weight;
+
+    if (specularity.threshold(threshold_value<ftype>))
     {
-        spec = compute_specular_reflection<ftype>(info, intersection_position, surface_normal)*specularity;
+        const ftype throughput = info.m_throughput * specularity.max();
+        if (termination.survives(throughput, intersection_position, PathTermination<ftype>::specular_salt, weight))
+        {
+            spec = compute_specular_reflection<ftype>(info, intersection_position, surface_normal, throughput * weight)*specularity;
+            if (weight != ftype(1))
+            {
+                spec = spec * weight;
+            }
+        }
     }
 
-    if (transmissivity.threshold(threshold_value))
+    if (transmissivity.threshold(threshold_value<ftype>))
     {
-        trans = compute_refraction<ftype>(info, intersection_position, surface_normal, material) * transmissivity;
+        //the light of a refracted ray is multiplied by the transmissivity twice
+        const ftype throughput = info.m_throughput * transmissivity.max() * transmissivity.max();
+        if (termination.survives(throughput, intersection_position, PathTermination<ftype>::refraction_salt, weight))
+        {
+            trans = compute_refraction<ftype>(info, intersection_position, surface_normal, material, throughput * weight) * transmissivity;
+            if (weight != ftype(1))
+            {
+                trans = trans * weight;
+            }
+        }
     }
 //#define CAMERA_DEBUG
 #ifdef CAMERA_DEBUG
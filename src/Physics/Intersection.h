@@ -3,8 +3,15 @@
 
 #include "Surfaces/Surface.h"
 
+template<typename ftype>
+class Instance;
+
 /*
 Class used to find the first intersection between a ray all surfaces in a (sub) set of surfaces
+
+when the closest hit is on an instance, closest is the part of the instance's shared geometry that was
+hit, in the instance's own space, and instance is set; the instance turns the part's normal and material
+back into the scene's.
 */
 
 template<typename ftype>
@@ -15,12 +22,14 @@ struct Intersection
     ftype lower_bound;
     const Surface<ftype>* closest;      // the closest surface that intersects with the ray.
     // we are assuming that only surfaces can intersect with rays& interaction doesn't modify surfaces
+    const Instance<ftype>* instance;    // the instance closest belongs to, if any
 
     Intersection() :
-        closest(nullptr),
         distance(INFINITY),
+        upper_bound(INFINITY),
         lower_bound(Surface<ftype>::tolerance),
-        upper_bound(INFINITY)
+        closest(nullptr),
+        instance(nullptr)
     {}
 
     void update(const Surface<ftype>* surface, const ftype dist)
@@ -28,10 +37,22 @@ struct Intersection
         if ((dist < upper_bound) && (dist > lower_bound))
         {
             closest = surface;
+            instance = nullptr;
+            distance = dist;
+            upper_bound = dist * Surface<ftype>::rtolerance;
+        }
+    }
+
+    void update(const Instance<ftype>* owner, const Surface<ftype>* part, const ftype dist)
+    {
+        if ((dist < upper_bound) && (dist > lower_bound))
+        {
+            closest = part;
+            instance = owner;
             distance = dist;
             upper_bound = dist * Surface<ftype>::rtolerance;
         }
     }
 };
 
-#endif
\ No newline at end of file
+#endif
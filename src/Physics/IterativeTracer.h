@@ -0,0 +1,182 @@
+#ifndef ITERATIVE_TRACER_H
+#define ITERATIVE_TRACER_H
+
+#include "Physics/Interaction.h"
+
+#include <cassert>
+
+/*
+works out the light a primary ray delivers without recursing. find_ray_intensity calls itself through
+compute_specular_reflection and compute_refraction, up to max_generations deep, and each level keeps a
+handful of spectrum temporaries on the call stack. here the rays still to be traced wait on a fixed
+stack of records instead, each with the weight its light is multiplied by on the way to the camera, and
+the light each ray finds at its surface goes straight into the pixel's sum.
+
+the rays are taken off the stack in the order find_ray_intensity would trace them, the specular ray
+before the refracted ones, so the ray budget, the most rays a pixel may trace, cuts off the same end
+of the tree it would. the sums are added in a different order, so a pixel can differ from
+find_ray_intensity in the last bits.
+
+a tracer is only used by one thread at a time.
+*/
+
+template<typename ftype>
+class IterativeTracer
+{
+public:
+    typedef Maths::Vector<ftype, 3> fvector;
+    typedef Geometry::Space<ftype, 1, 3> linef;
+    typedef Optics::SpectrumArray<ftype> sarray;
+
+    //every generation can leave a specular ray and one refracted ray per colour waiting
+    static constexpr size_t stack_size = size_t(RayInfo<ftype>::max_generations) * (1 + Optics::max_colours);
+    static constexpr size_t unlimited = size_t(-1);
+
+private:
+    struct Pending
+    {
+        linef ray;
+        sarray weight;                       //what the ray's light is multiplied by on its way to the camera
+        ftype throughput;                    //the RayInfo::m_throughput the ray would have in find_ray_intensity
+        ftype refractive_index;
+        Optics::SpectrumInt bitfield;
+        unsigned char generation;
+    };
+
+    Pending stack[stack_size];
+    size_t n_pending;
+    size_t ray_budget;
+
+    void push(
+        const linef& ray,
+        const sarray& weight,
+        const ftype throughput,
+        const Optics::SpectrumInt bitfield,
+        const unsigned char generation,
+        const ftype refractive_index)
+    {
+        assert(n_pending < stack_size && "the ray stack is full");
+        Pending& pending = stack[n_pending++];
+        pending.ray = ray;
+        pending.weight = weight;
+        pending.throughput = throughput;
+        pending.bitfield = bitfield;
+        pending.generation = generation;
+        pending.refractive_index = refractive_index;
+    }
+
+    //adds the light the ray finds at its surface to out, and pushes the rays it needs traced
+    void visit(RayInfo<ftype>& info, const sarray& weight, const Intersection<ftype>& intersection_info, sarray& out)
+    {
+        if (!intersection_info.closest)
+        {
+            return;
+        }
+
+        fvector position;
+        fvector normal;
+        const Optics::Material<ftype>* material = hit_point(info.m_ray, intersection_info, position, normal);
+
+        const Optics::SpectrumArray<const ftype*> diffusivity(material->get_diffusivity());
+        const Optics::SpectrumArray<const ftype*> specularity(material->get_specularity());
+        const Optics::SpectrumArray<const ftype*> transmissivity(material->get_transmissivity());
+
+        if (diffusivity.threshold(threshold_value<ftype>))
+        {
+            out += (compute_diffusive_reflection<ftype>(info, position, normal) * diffusivity) * weight;
+        }
+
+        //rays past the last generation would give nothing, so they aren't pushed
+        const unsigned char child_generation = info.m_generation + 1;
+        if (child_generation >= RayInfo<ftype>::max_generations)
+        {
+            return;
+        }
+
+        //the termination goes by the ray's throughput, as find_ray_intensity does, so both drop the same rays
+        const PathTermination<ftype>& termination = PathTermination<ftype>::get_active();
+        ftype compensation;
+
+        //the stack is last in first out, so the refracted rays go on first, the last of them at the bottom
+        if (transmissivity.threshold(threshold_value<ftype>))
+        {
+            //find_ray_intensity multiplies a refracted ray's light by the transmissivity twice
+            sarray refracted_weight = (weight * transmissivity) * transmissivity;
+            const ftype refracted_throughput = info.m_throughput * transmissivity.max() * transmissivity.max();
+            const bool refract = termination.survives(refracted_throughput, position, PathTermination<ftype>::refraction_salt, compensation);
+            if (compensation != ftype(1))
+            {
+                refracted_weight = refracted_weight * compensation;
+            }
+            for (size_t i = material->unique_refractions(); refract && i-- > 0;)
+            {
+                const Optics::SpectrumInt colours = info.m_bitfield & material->get_refractive_split(i);
+                if (colours)
+                {
+                    const ftype new_n = material->get_refractive_index(i);
+                    push(
+                        refracted_ray(info.m_ray.get_axis(), position, normal, info.m_refractive_index, new_n),
+                        refracted_weight,
+                        refracted_throughput * compensation,
+                        colours,
+                        child_generation,
+                        new_n);
+                }
+            }
+        }
+
+        if (specularity.threshold(threshold_value<ftype>))
+        {
+            const ftype reflected_throughput = info.m_throughput * specularity.max();
+            if (termination.survives(reflected_throughput, position, PathTermination<ftype>::specular_salt, compensation))
+            {
+                sarray reflected_weight = weight * specularity;
+                if (compensation != ftype(1))
+                {
+                    reflected_weight = reflected_weight * compensation;
+                }
+                push(
+                    reflected_ray(info.m_ray.get_axis(), position, normal),
+                    reflected_weight,
+                    reflected_throughput * compensation,
+                    info.m_bitfield,
+                    child_generation,
+                    ftype(1.0));
+            }
+        }
+    }
+
+public:
+    IterativeTracer(const size_t budget = unlimited) :
+        n_pending(0),
+        ray_budget(budget)
+    {}
+
+    IterativeTracer(const IterativeTracer& other) = delete;
+
+    inline void set_ray_budget(const size_t budget) { ray_budget = budget; }
+
+    inline const size_t& get_ray_budget()const { return ray_budget; }
+
+    //the light delivered along a primary ray whose first intersection has already been found; the primary
+    //ray counts towards the budget
+    sarray intensity(const linef& ray, const Intersection<ftype>& intersection_info)
+    {
+        sarray out;
+        n_pending = 0;
+
+        RayInfo<ftype> primary(ray);
+        visit(primary, sarray(ftype(1)), intersection_info, out);
+
+        for (size_t rays = 1; n_pending && rays < ray_budget; rays++)
+        {
+            //copied out, as visiting the ray pushes its children over it
+            const Pending pending = stack[--n_pending];
+            RayInfo<ftype> info(pending.ray, pending.bitfield, pending.generation, pending.refractive_index, pending.throughput);
+            visit(info, pending.weight, first_intersection<ftype>(info.m_ray, info.m_traversal), out);
+        }
+        return out;
+    }
+};
+
+#endif
@@ -36,25 +36,18 @@ public:
 
 	virtual ftype illumination(const fvector& point) const override
     {
-		const linef ray(point, m_direction);
-
-        //make an aabb representing the ray...
-        const aabb3 culling_box(point, point + ftype(INFINITY)*m_direction);
-
-		//get the ptrs to only the surfaces that intersect the aabb
-		const Set<Surface<ftype> *> surfaces = Surface<ftype>::surface_cull(culling_box);
-		const size_t n = surfaces.get_size();
-        for (size_t i = 0; i < n; i++)
-        {
-			const Surface<ftype>* surface = surfaces[i];
-			const ftype dist = surface->first_intersection(ray);
-            if (dist > Surface<ftype>::tolerance && dist != ftype(INFINITY))
-            {
-                return 0;
-            }
-        }
-        return 1;
+		linef ray;
+		ftype max_distance;
+		shadow_ray(point, ray, max_distance);
+		return LightSource<ftype>::occluded(ray, max_distance) ? 0 : 1;
     }
+
+	virtual bool shadow_ray(const fvector& point, linef& ray, ftype& max_distance)const override
+	{
+		ray = linef(point, m_direction);
+		max_distance = ftype(INFINITY);
+		return true;
+	}
 };
 
 #endif
\ No newline at end of file
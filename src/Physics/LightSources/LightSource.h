@@ -6,6 +6,7 @@
 #include "Containers/Manager.h"
 #include "Optics/SpectrumArray.h"
 #include "Surfaces/Surface.h"
+#include "Acceleration/Accelerator.h"
 
 /*
 * Defines the abstract class that is the light source.
@@ -34,12 +35,38 @@ class LightSource
     typedef Maths::Vector<ftype, 3> fvector;
     typedef Optics::SpectrumArray<ftype> sarray;
     typedef Geometry::Space<ftype, 1, 3> linef;
+    typedef Geometry::AxisAlignedBoundingBox<ftype, 3> aabb3;
 protected:
     //we'll keep a member here that can store the results of get_intensity??
     //if this is gonna be multithreded, we'll need a mutex
+
 public:
     static Manager<LightSource> manager;
 
+    //shadow ray test: is there any surface between the start of the ray and max_distance along it?
+    //this never needs the closest hit, so it returns at the first blocker it finds
+    static bool occluded(const linef& ray, const ftype max_distance)
+    {
+        const Accelerator<ftype>* accelerator = Accelerator<ftype>::get_active();
+        if (accelerator)
+        {
+            return accelerator->occluded(ray, max_distance);
+        }
+
+        //make an aabb representing the ray and get the ptrs to only the surfaces that intersect it
+        const aabb3 culling_box(ray.get_origin(), ray.get_origin() + max_distance * ray.get_axis());
+        const Span<const Surface<ftype>*> surfaces = Surface<ftype>::surface_cull(culling_box);
+        const size_t n = surfaces.get_size();
+        for (size_t i = 0; i < n; i++)
+        {
+            if (surfaces[i]->occludes(ray, max_distance))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
     LightSource()
     {
         manager.register_object(this);
@@ -68,6 +95,11 @@ public:
     //maybe we don;t need to define this now. We could do a cull for surfaces here.
     virtual ftype illumination(const fvector& point) const = 0;
 
+    //lights that are either blocked or not at a point make the shadow ray it is lit along, and the distance a
+    //surface must be within to block it, so callers can test many shadow rays together. the rest return false
+    //and have to be asked for their illumination
+    virtual bool shadow_ray(const fvector& point, linef& ray, ftype& max_distance)const { return false; }
+
     //gets all the lights in the world
     inline static const LightSource** get_lights()
     {
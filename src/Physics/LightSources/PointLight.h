@@ -38,28 +38,19 @@ public:
 
 	virtual ftype illumination(const fvector& point) const override
     {   
-		const ftype distance2 = Maths::mag2(point - m_position) * Surface<ftype>::rtolerance *Surface<ftype>::rtolerance;
-		//make the ray
-		const linef ray(point, get_effective_direction(point));
-
-        //make an aabb representing the ray...
-        const aabb3 culling_box(point, m_position);
-
-		//get the ptrs to only the surfaces that intersect the aabb
-		const Set<Surface<ftype>*> surfaces = Surface<ftype>::surface_cull(culling_box);
-
-		const size_t n = surfaces.get_size();
-        for (size_t i = 0; i < n; i++)
-        {
-			const Surface<ftype>* surface = surfaces[i];
-			const ftype dist = surface->first_intersection(ray);
-            if ((dist > Surface<ftype>::tolerance) && (dist*dist < distance2))
-            {
-                return 0;
-            }
-        }
-        return 1;
+		linef ray;
+		ftype max_distance;
+		shadow_ray(point, ray, max_distance);
+		return LightSource<ftype>::occluded(ray, max_distance) ? 0 : 1;
     }
+
+	virtual bool shadow_ray(const fvector& point, linef& ray, ftype& max_distance)const override
+	{
+		//anything past the light (less a tolerance) can't cast a shadow on this point
+		max_distance = Maths::mag(point - m_position) * Surface<ftype>::rtolerance;
+		ray = linef(point, get_effective_direction(point));
+		return true;
+	}
 };
 
 #endif // !
@@ -0,0 +1,121 @@
+#ifndef PATH_TERMINATION_H
+#define PATH_TERMINATION_H
+
+#include "Maths/Vector.h"
+
+#include <stdint.h>
+#include <cstring>
+
+/*
+decides whether a specular or refracted ray is worth tracing, from its throughput: the product of the
+largest colour of every factor the light it finds is scaled by on its way to the camera, so never less than
+what any one colour is scaled by. every tracing mode works it out the same way, from the same factors in the
+same order, so they all drop the same rays. the threshold a material has to pass to spawn a ray
+only looks at that one surface, so a ray that earlier bounces have already dimmed to almost nothing is
+otherwise traced as fully as a primary one.
+
+    NO_TERMINATION      - every ray is traced, up to RayInfo::max_generations
+    CUTOFF_TERMINATION  - rays with a throughput under the threshold are dropped. fast and repeatable, but the
+                          light they would have found is lost, so the image gets a little darker
+    RUSSIAN_ROULETTE    - a ray with a throughput t under the threshold is traced with probability t/threshold,
+                          and the light it finds is scaled up by threshold/t, so on average nothing is lost
+
+the roulette draws its numbers from a hash of where the ray starts, so a render gives the same image on any
+number of threads. the termination of the render in progress is the active one, like the active accelerator.
+*/
+
+template<typename ftype>
+class PathTermination
+{
+public:
+    typedef Maths::Vector<ftype, 3> fvector;
+
+    //which of the rays leaving a surface a decision is for; all the refracted rays share one
+    static constexpr uint32_t specular_salt = 0;
+    static constexpr uint32_t refraction_salt = 1;
+
+    enum Policy
+    {
+        NO_TERMINATION,
+        CUTOFF_TERMINATION,
+        RUSSIAN_ROULETTE
+    };
+
+private:
+    static PathTermination active;
+
+    Policy policy;
+    ftype threshold;
+
+    //the finaliser of splitmix64
+    static inline uint64_t mix(uint64_t x)
+    {
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+        return x ^ (x >> 31);
+    }
+
+    //a number in [0, 1) that only depends on the position and on which of the rays leaving it is asked about
+    static ftype random_unit(const fvector& position, const uint32_t salt)
+    {
+        static_assert(sizeof(ftype) <= sizeof(uint64_t), "the coordinates are hashed as 64 bit words");
+        uint64_t hash = 0x9e3779b97f4a7c15ull ^ salt;
+        for (size_t k = 0; k < 3; k++)
+        {
+            uint64_t bits = 0;
+            memcpy(&bits, &position[k], sizeof(ftype));
+            hash = mix(hash ^ bits);
+        }
+        return ftype(hash >> 40) / ftype(uint64_t(1) << 24);
+    }
+
+public:
+    PathTermination(const Policy policy_ = NO_TERMINATION, const ftype threshold_ = ftype(0.01)) :
+        policy(policy_),
+        threshold(threshold_)
+    {}
+
+    /*
+    * whether to trace a ray with the input throughput that leaves position; salt tells the rays leaving the same
+    * position apart. weight is what the light the ray finds must then be multiplied by, which is only ever more
+    * than 1 for rays that survived the roulette
+    */
+    bool survives(const ftype throughput, const fvector& position, const uint32_t salt, ftype& weight)const
+    {
+        weight = ftype(1);
+        if (policy == NO_TERMINATION || throughput >= threshold)
+        {
+            return true;
+        }
+        if (policy == CUTOFF_TERMINATION)
+        {
+            return false;
+        }
+        const ftype probability = throughput / threshold;
+        if (random_unit(position, salt) >= probability)
+        {
+            return false;
+        }
+        weight = ftype(1) / probability;
+        return true;
+    }
+
+    inline const Policy& get_policy()const { return policy; }
+
+    inline const ftype& get_threshold()const { return threshold; }
+
+    inline static const PathTermination& get_active()
+    {
+        return active;
+    }
+
+    inline static void set_active(const PathTermination& termination)
+    {
+        active = termination;
+    }
+};
+
+template<typename ftype>
+PathTermination<ftype> PathTermination<ftype>::active;
+
+#endif
@@ -16,6 +16,36 @@ member for the last surface that it was in
 */
 
 
+/*
+what the acceleration structures need to know about a ray on top of its line: the reciprocal of its
+direction, so slab tests are multiplications, and which way it points along each axis, so the near and
+far side of a box can be picked without comparing them. a zero direction component gives an infinite
+reciprocal, which the slab tests are written to tolerate.
+*/
+template<typename ftype>
+struct TraversalRay
+{
+    typedef Maths::Vector<ftype, 3> fvector;
+    typedef Geometry::Space<ftype, 1, 3> linef;
+
+    fvector origin;
+    fvector inv_direction;
+    unsigned char sign[3];                              //1 where the direction is negative
+
+    TraversalRay() = delete;
+
+    explicit TraversalRay(const linef& ray) :
+        origin(ray.get_origin()),
+        inv_direction(ftype(1) / ray.get_axis())
+    {
+        for (size_t i = 0; i < 3; i++)
+        {
+            sign[i] = inv_direction[i] < ftype(0);
+        }
+    }
+};
+
+
 template<typename ftype>
 struct RayInfo
 {
@@ -27,7 +57,9 @@ struct RayInfo
     const Optics::SpectrumInt m_bitfield;                //which colours this ray is computing for
     const unsigned char m_generation;                        //where the data needs to end up?
     const ftype m_refractive_index;                      //current medium's refractive index.
+    const ftype m_throughput;                            //how much the ray's light can be scaled by on its way to the camera (see PathTermination)
     const linef m_ray;                                   //the geometric ray
+    const TraversalRay<ftype> m_traversal;               //m_ray, set up for the acceleration structures
 
     RayInfo() = delete;
 
@@ -35,12 +67,15 @@ struct RayInfo
         const linef& ray,                                                       // the geometric line
         const Optics::SpectrumInt bits_set = Optics::all_colours,               // bitset
         const unsigned char gen = 0,                                            // generation
-        const ftype index = 1.0) :                                              // refractive index
+        const ftype index = 1.0,                                                // refractive index
+        const ftype throughput = 1.0) :                                         // path throughput
 
         m_ray(ray),
         m_bitfield(bits_set),
         m_generation(gen),
-        m_refractive_index(index)
+        m_refractive_index(index),
+        m_throughput(throughput),
+        m_traversal(m_ray)
     {
         rays_created++;
     }
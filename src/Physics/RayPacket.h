@@ -0,0 +1,221 @@
+#ifndef RAY_PACKET_H
+#define RAY_PACKET_H
+
+#include "Physics/Intersection.h"
+#include "Physics/RayInfo.h"
+#include "Surfaces/Surface.h"
+
+#include <cassert>
+#include <stdint.h>
+
+/*
+a group of rays that start in the same place and point in nearly the same direction, such as the
+primary rays of a small block of pixels, so they can be traced through the accelerator together.
+
+the rays are kept in structure-of-arrays form: a box or a primitive is tested against every lane in one
+plain loop the compiler can vectorize, and each node is fetched once for the packet rather than once
+per ray. the lanes that hold a ray are marked in active; accelerators narrow that mask down as they go,
+and hand the lanes that have split off from the others to their single ray traversal.
+
+RAY_PACKET_SIZE picks the number of lanes: 4 for SSE, 8 for AVX, 16 for AVX-512.
+*/
+
+#ifndef RAY_PACKET_SIZE
+#define RAY_PACKET_SIZE 8
+#endif
+
+//float packets are tested 4 lanes at a time with SSE when the lanes come in fours
+#if (defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)) && (RAY_PACKET_SIZE % 4 == 0)
+#define RAY_PACKET_SSE
+#include <immintrin.h>
+#endif
+
+template<typename ftype>
+struct RayPacket
+{
+    typedef Geometry::Space<ftype, 1, 3> linef;
+
+    static constexpr size_t size = RAY_PACKET_SIZE;
+    static_assert(size >= 1 && size <= 32, "lane masks are 32 bits");
+
+    ftype origin_x[size]{};
+    ftype origin_y[size]{};
+    ftype origin_z[size]{};
+    ftype direction_x[size]{};
+    ftype direction_y[size]{};
+    ftype direction_z[size]{};
+    ftype inv_direction_x[size]{};                       //as in TraversalRay, so the slab tests agree
+    ftype inv_direction_y[size]{};
+    ftype inv_direction_z[size]{};
+
+    linef rays[size];                                   //the lanes' lines, for the surfaces that aren't packed
+    Intersection<ftype> hits[size];                     //the closest hit of each lane so far
+    uint32_t active;                                    //bit i is set if lane i holds a ray
+    size_t n_rays;
+
+    RayPacket() :
+        active(0),
+        n_rays(0)
+    {}
+
+    RayPacket(const RayPacket& other) = delete;
+
+    void clear()
+    {
+        active = 0;
+        n_rays = 0;
+    }
+
+    //puts the ray in the next free lane, with no hit yet; returns the lane
+    size_t add(const linef& ray)
+    {
+        assert(n_rays < size && "the packet is full");
+        const size_t lane = n_rays;
+        const Maths::Vector<ftype, 3>& origin = ray.get_origin();
+        const Maths::Vector<ftype, 3>& axis = ray.get_axis();
+
+        rays[lane] = ray;
+        origin_x[lane] = origin.x;
+        origin_y[lane] = origin.y;
+        origin_z[lane] = origin.z;
+        direction_x[lane] = axis.x;
+        direction_y[lane] = axis.y;
+        direction_z[lane] = axis.z;
+        inv_direction_x[lane] = ftype(1) / axis.x;
+        inv_direction_y[lane] = ftype(1) / axis.y;
+        inv_direction_z[lane] = ftype(1) / axis.z;
+        hits[lane] = Intersection<ftype>();
+
+        active |= 1u << lane;
+        n_rays++;
+        return lane;
+    }
+
+    inline const size_t& ray_count()const { return n_rays; }
+
+    /*
+    * the slab test of WideNode, for the lanes set in lanes against the box [lower, upper], each lane with its
+    * own max_distance[lane]. returns the lanes that enter the box, and sets t_min to the nearest distance
+    * any of them enters it at
+    */
+    inline uint32_t enter_box(
+        const ftype lower_x, const ftype lower_y, const ftype lower_z,
+        const ftype upper_x, const ftype upper_y, const ftype upper_z,
+        const uint32_t lanes,
+        const ftype* max_distance,
+        ftype& t_min)const
+    {
+        uint32_t hit_lanes = 0;
+        t_min = INFINITY;
+        for (size_t l = 0; l < size; l++)
+        {
+            const bool neg_x = inv_direction_x[l] < ftype(0);
+            const bool neg_y = inv_direction_y[l] < ftype(0);
+            const bool neg_z = inv_direction_z[l] < ftype(0);
+
+            ftype t0 = Maths::max(((neg_x ? upper_x : lower_x) - origin_x[l]) * inv_direction_x[l], ftype(0));
+            t0 = Maths::max(((neg_y ? upper_y : lower_y) - origin_y[l]) * inv_direction_y[l], t0);
+            t0 = Maths::max(((neg_z ? upper_z : lower_z) - origin_z[l]) * inv_direction_z[l], t0);
+            ftype t1 = Maths::min(((neg_x ? lower_x : upper_x) - origin_x[l]) * inv_direction_x[l], max_distance[l]);
+            t1 = Maths::min(((neg_y ? lower_y : upper_y) - origin_y[l]) * inv_direction_y[l], t1);
+            t1 = Maths::min(((neg_z ? lower_z : upper_z) - origin_z[l]) * inv_direction_z[l], t1);
+
+            if (((lanes >> l) & 1u) && t0 <= t1 / Surface<ftype>::rtolerance)
+            {
+                hit_lanes |= 1u << l;
+                t_min = Maths::min(t0, t_min);
+            }
+        }
+        return hit_lanes;
+    }
+
+    //the number of lanes set in mask
+    static inline size_t lane_count(uint32_t mask)
+    {
+        size_t count = 0;
+        for (; mask; count++)
+        {
+            mask &= mask - 1;
+        }
+        return count;
+    }
+
+    //calls function(lane) for every lane set in mask, lowest first
+    template<typename function_type>
+    static inline void for_each_lane(uint32_t mask, function_type function)
+    {
+        for (size_t lane = 0; mask; lane++, mask >>= 1)
+        {
+            if (mask & 1u)
+            {
+                function(lane);
+            }
+        }
+    }
+};
+
+#ifdef RAY_PACKET_SSE
+//picks a where mask is set and b elsewhere
+inline __m128 select_ps(const __m128 mask, const __m128 a, const __m128 b)
+{
+    return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+template<>
+inline uint32_t RayPacket<float>::enter_box(
+    const float lower_x, const float lower_y, const float lower_z,
+    const float upper_x, const float upper_y, const float upper_z,
+    const uint32_t lanes,
+    const float* max_distance,
+    float& t_min)const
+{
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 lx = _mm_set1_ps(lower_x);
+    const __m128 ly = _mm_set1_ps(lower_y);
+    const __m128 lz = _mm_set1_ps(lower_z);
+    const __m128 ux = _mm_set1_ps(upper_x);
+    const __m128 uy = _mm_set1_ps(upper_y);
+    const __m128 uz = _mm_set1_ps(upper_z);
+    const __m128 rtolerance = _mm_set1_ps(Surface<float>::rtolerance);
+
+    uint32_t hit_lanes = 0;
+    __m128 nearest = _mm_set1_ps(INFINITY);
+    for (size_t l = 0; l < size; l += 4)
+    {
+        const __m128 ix = _mm_loadu_ps(inv_direction_x + l);
+        const __m128 iy = _mm_loadu_ps(inv_direction_y + l);
+        const __m128 iz = _mm_loadu_ps(inv_direction_z + l);
+        const __m128 neg_x = _mm_cmplt_ps(ix, zero);
+        const __m128 neg_y = _mm_cmplt_ps(iy, zero);
+        const __m128 neg_z = _mm_cmplt_ps(iz, zero);
+        const __m128 ox = _mm_loadu_ps(origin_x + l);
+        const __m128 oy = _mm_loadu_ps(origin_y + l);
+        const __m128 oz = _mm_loadu_ps(origin_z + l);
+
+        //_mm_max_ps and _mm_min_ps return their second argument when either is NaN, like Maths::max/min
+        __m128 t0 = _mm_max_ps(_mm_mul_ps(_mm_sub_ps(select_ps(neg_x, ux, lx), ox), ix), zero);
+        t0 = _mm_max_ps(_mm_mul_ps(_mm_sub_ps(select_ps(neg_y, uy, ly), oy), iy), t0);
+        t0 = _mm_max_ps(_mm_mul_ps(_mm_sub_ps(select_ps(neg_z, uz, lz), oz), iz), t0);
+        __m128 t1 = _mm_min_ps(_mm_mul_ps(_mm_sub_ps(select_ps(neg_x, lx, ux), ox), ix), _mm_loadu_ps(max_distance + l));
+        t1 = _mm_min_ps(_mm_mul_ps(_mm_sub_ps(select_ps(neg_y, ly, uy), oy), iy), t1);
+        t1 = _mm_min_ps(_mm_mul_ps(_mm_sub_ps(select_ps(neg_z, lz, uz), oz), iz), t1);
+
+        const __m128 hit = _mm_cmple_ps(t0, _mm_div_ps(t1, rtolerance));
+        const uint32_t block = uint32_t(_mm_movemask_ps(hit)) & (lanes >> l) & 0xfu;
+        if (block)
+        {
+            //widen the 4 bits back out to a lane mask, so lanes that are switched off don't count
+            const __m128i bits = _mm_and_si128(_mm_set1_epi32(int(block)), _mm_setr_epi32(1, 2, 4, 8));
+            const __m128 in_block = _mm_castsi128_ps(_mm_cmpgt_epi32(bits, _mm_setzero_si128()));
+            nearest = _mm_min_ps(select_ps(in_block, t0, _mm_set1_ps(INFINITY)), nearest);
+            hit_lanes |= block << l;
+        }
+    }
+    nearest = _mm_min_ps(nearest, _mm_shuffle_ps(nearest, nearest, _MM_SHUFFLE(2, 3, 0, 1)));
+    nearest = _mm_min_ps(nearest, _mm_shuffle_ps(nearest, nearest, _MM_SHUFFLE(1, 0, 3, 2)));
+    t_min = _mm_cvtss_f32(nearest);
+    return hit_lanes;
+}
+#endif
+
+#endif
@@ -0,0 +1,393 @@
+#ifndef RAY_STREAM_H
+#define RAY_STREAM_H
+
+#include "Physics/Interaction.h"
+#include "Maths/Morton.h"
+
+#include <stdint.h>
+
+/*
+traces the secondary rays of a batch of primary rays a generation at a time, rather than depth first.
+
+find_ray_intensity follows each specular and refracted ray down to the end of its path before it
+looks at the next, so the rays it traces one after the other start on different surfaces and head
+off in different directions, and each one finds a cold part of the accelerator. The stream instead
+collects every ray of a generation in a queue, sorts the queue by the octant of the ray's direction
+and then by the cell of a morton curve its origin is in, and traces it in that order. Rays that
+start close together and head the same way then follow each other through the same nodes and
+primitives, and the shadow rays of the surfaces they hit do the same.
+
+every ray remembers where the rays it spawned were queued, and once the last generation is done the ray
+tree is summed from the leaves up, in the order find_ray_intensity would have added it up, so a pixel gets
+exactly the intensity find_ray_intensity gives it.
+
+a stream is only used by one thread at a time; it keeps its memory from one batch to the next.
+*/
+
+template<typename ftype>
+class RayStream
+{
+public:
+    typedef Maths::Vector<ftype, 3> fvector;
+    typedef Geometry::Space<ftype, 1, 3> linef;
+
+    //9 bits per axis for the origin's cell, and the octant above them
+    static constexpr uint32_t cell_bits = 9;
+
+private:
+    enum RecordFlags : uint8_t
+    {
+        HIT = 1,                    //the ray hit a surface
+        TRANSMITTING = 2,           //the surface it hit transmits light
+        SPECULAR_CHILD = 4          //the first child is the specular ray rather than a refracted one
+    };
+
+    struct Record
+    {
+        linef ray;
+        Optics::SpectrumInt bitfield;
+        unsigned char generation;
+        ftype refractive_index;
+        ftype throughput;
+        ftype compensation;                          //what the termination scales the ray's light up by
+
+        uint8_t flags;
+        uint32_t first_child;                        //children are stored together, the specular one first
+        uint32_t n_children;
+        const Optics::Material<ftype>* material;     //the material where the ray hit
+        Intersection<ftype> primary_hit;             //what a primary ray hit, as found by the caller
+        Optics::SpectrumArray<ftype> intensity;      //the diffuse light at the hit until the tree is summed, then everything
+    };
+
+    size_t n_records;
+    size_t capacity;
+    Record* records;
+
+    //the order a generation is traced in, and the keys it is sorted by
+    uint32_t* order;
+    uint32_t* order_buffer;
+    uint32_t* keys;
+    uint32_t* key_buffer;
+    size_t order_capacity;
+
+    uint32_t append(
+        const linef& ray,
+        const Optics::SpectrumInt bitfield,
+        const unsigned char generation,
+        const ftype refractive_index,
+        const ftype throughput,
+        const ftype compensation)
+    {
+        if (n_records == capacity)
+        {
+            capacity = capacity ? 2 * capacity : 256;
+            Record* grown = new Record[capacity];
+            for (size_t i = 0; i < n_records; i++)
+            {
+                grown[i] = records[i];
+            }
+            delete[] records;
+            records = grown;
+        }
+        Record& record = records[n_records];
+        record.ray = ray;
+        record.bitfield = bitfield;
+        record.generation = generation;
+        record.refractive_index = refractive_index;
+        record.throughput = throughput;
+        record.compensation = compensation;
+        record.flags = 0;
+        record.first_child = 0;
+        record.n_children = 0;
+        return uint32_t(n_records++);
+    }
+
+    void reserve_order(const size_t n)
+    {
+        if (n <= order_capacity)
+        {
+            return;
+        }
+        release_order();
+        order_capacity = n;
+        order = new uint32_t[n];
+        order_buffer = new uint32_t[n];
+        keys = new uint32_t[n];
+        key_buffer = new uint32_t[n];
+    }
+
+    void release_order()
+    {
+        delete[] order;
+        delete[] order_buffer;
+        delete[] keys;
+        delete[] key_buffer;
+        order = nullptr;
+        order_buffer = nullptr;
+        keys = nullptr;
+        key_buffer = nullptr;
+        order_capacity = 0;
+    }
+
+    /*
+    * works out the light at the hit of record r that doesn't need another ray, and queues the specular
+    * and refracted rays it does need; the same steps as find_ray_intensity(info, intersection_info)
+    */
+    void shade(const uint32_t r, RayInfo<ftype>& info, const Intersection<ftype>& intersection_info)
+    {
+        if (!intersection_info.closest)
+        {
+            records[r].intensity = Optics::SpectrumArray<ftype>();
+            return;
+        }
+
+        fvector position;
+        fvector normal;
+        const Optics::Material<ftype>* material = hit_point(info.m_ray, intersection_info, position, normal);
+
+        const Optics::SpectrumArray<const ftype*> diffusivity(material->get_diffusivity());
+        const Optics::SpectrumArray<const ftype*> specularity(material->get_specularity());
+        const Optics::SpectrumArray<const ftype*> transmissivity(material->get_transmissivity());
+
+        uint8_t flags = HIT;
+        Optics::SpectrumArray<ftype> diff;
+        if (diffusivity.threshold(threshold_value<ftype>))
+        {
+            diff = compute_diffusive_reflection<ftype>(info, position, normal) * diffusivity;
+        }
+
+        //rays past the last generation would give nothing, so they aren't queued
+        const unsigned char child_generation = info.m_generation + 1;
+        const bool spawn = child_generation < RayInfo<ftype>::max_generations;
+        const uint32_t first_child = uint32_t(n_records);
+        const PathTermination<ftype>& termination = PathTermination<ftype>::get_active();
+        ftype weight;
+        if (spawn && specularity.threshold(threshold_value<ftype>))
+        {
+            const ftype throughput = info.m_throughput * specularity.max();
+            if (termination.survives(throughput, position, PathTermination<ftype>::specular_salt, weight))
+            {
+                flags |= SPECULAR_CHILD;
+                append(reflected_ray(info.m_ray.get_axis(), position, normal), info.m_bitfield, child_generation, ftype(1.0), throughput * weight, weight);
+            }
+        }
+
+        if (spawn && transmissivity.threshold(threshold_value<ftype>))
+        {
+            flags |= TRANSMITTING;
+            const ftype throughput = info.m_throughput * transmissivity.max() * transmissivity.max();
+            const bool refract = termination.survives(throughput, position, PathTermination<ftype>::refraction_salt, weight);
+            for (size_t i = 0; refract && i < material->unique_refractions(); i++)
+            {
+                const Optics::SpectrumInt colours = info.m_bitfield & material->get_refractive_split(i);
+                if (colours)
+                {
+                    const ftype new_n = material->get_refractive_index(i);
+                    append(
+                        refracted_ray(info.m_ray.get_axis(), position, normal, info.m_refractive_index, new_n),
+                        colours,
+                        child_generation,
+                        new_n,
+                        throughput * weight,
+                        weight);
+                }
+            }
+        }
+
+        //append may have moved the records
+        Record& record = records[r];
+        record.flags = flags;
+        record.material = material;
+        record.first_child = first_child;
+        record.n_children = uint32_t(n_records) - first_child;
+        record.intensity = diff;
+    }
+
+    //the key rays [begin, end) are traced in: the octant of the direction, then the morton cell of the origin
+    void sort_generation(const size_t begin, const size_t end)
+    {
+        const size_t n = end - begin;
+        reserve_order(n);
+
+        fvector lower = records[begin].ray.get_origin();
+        fvector upper = lower;
+        for (size_t i = begin; i < end; i++)
+        {
+            const fvector& origin = records[i].ray.get_origin();
+            for (size_t k = 0; k < 3; k++)
+            {
+                lower[k] = Maths::min(lower[k], origin[k]);
+                upper[k] = Maths::max(upper[k], origin[k]);
+            }
+        }
+        constexpr uint32_t n_cells = 1u << cell_bits;
+        fvector scale;
+        for (size_t k = 0; k < 3; k++)
+        {
+            const ftype extent = upper[k] - lower[k];
+            scale[k] = extent > ftype(0) ? ftype(n_cells - 1) / extent : ftype(0);
+        }
+
+        for (size_t i = 0; i < n; i++)
+        {
+            const Record& record = records[begin + i];
+            const fvector& origin = record.ray.get_origin();
+            const fvector& axis = record.ray.get_axis();
+            uint32_t cell[3];
+            for (size_t k = 0; k < 3; k++)
+            {
+                cell[k] = Maths::min(uint32_t((origin[k] - lower[k]) * scale[k]), n_cells - 1);
+            }
+            const uint32_t octant = uint32_t(axis.x < ftype(0)) | (uint32_t(axis.y < ftype(0)) << 1) | (uint32_t(axis.z < ftype(0)) << 2);
+            keys[i] = (octant << (3 * cell_bits)) | Maths::morton_encode(cell[0], cell[1], cell[2]);
+            order[i] = uint32_t(begin + i);
+        }
+
+        //stable least-significant-digit radix sort, 8 bits at a time
+        constexpr uint32_t key_bits = 3 * cell_bits + 3;
+        for (uint32_t shift = 0; shift < key_bits; shift += 8)
+        {
+            size_t histogram[256] = {};
+            for (size_t i = 0; i < n; i++)
+            {
+                histogram[(keys[i] >> shift) & 0xff]++;
+            }
+            size_t offset = 0;
+            for (size_t b = 0; b < 256; b++)
+            {
+                const size_t count = histogram[b];
+                histogram[b] = offset;
+                offset += count;
+            }
+            for (size_t i = 0; i < n; i++)
+            {
+                const size_t destination = histogram[(keys[i] >> shift) & 0xff]++;
+                key_buffer[destination] = keys[i];
+                order_buffer[destination] = order[i];
+            }
+            Maths::swap(keys, key_buffer);
+            Maths::swap(order, order_buffer);
+        }
+    }
+
+    //adds the ray tree up from the leaves; children always come after their parents. a child that hit nothing
+    //delivers no light, so it is skipped rather than added as zero, which leaves every sum as it was
+    void sum_tree()
+    {
+        for (size_t r = n_records; r-- > 0;)
+        {
+            Record& record = records[r];
+            if (!(record.flags & HIT))
+            {
+                continue;
+            }
+            size_t child = record.first_child;
+            if (record.flags & SPECULAR_CHILD)
+            {
+                const Record& reflected = records[child];
+                if (reflected.flags & HIT)
+                {
+                    const Optics::SpectrumArray<ftype> spec = reflected.intensity * Optics::SpectrumArray<const ftype*>(record.material->get_specularity());
+                    record.intensity += reflected.compensation != ftype(1) ? spec * reflected.compensation : spec;
+                }
+                child++;
+            }
+            if (record.flags & TRANSMITTING)
+            {
+                const Optics::SpectrumArray<const ftype*> transmissivities = record.material->get_transmissivity();
+                Optics::SpectrumArray<ftype> refracted;
+                ftype compensation = ftype(1);      //the refracted rays all share one
+                bool any_light = false;
+                for (; child < size_t(record.first_child) + record.n_children; child++)
+                {
+                    if (records[child].flags & HIT)
+                    {
+                        refracted += (records[child].intensity * transmissivities);
+                        compensation = records[child].compensation;
+                        any_light = true;
+                    }
+                }
+                if (any_light)
+                {
+                    const Optics::SpectrumArray<ftype> trans = refracted * transmissivities;
+                    record.intensity += compensation != ftype(1) ? trans * compensation : trans;
+                }
+            }
+        }
+    }
+
+public:
+    RayStream() :
+        n_records(0),
+        capacity(0),
+        records(nullptr),
+        order(nullptr),
+        order_buffer(nullptr),
+        keys(nullptr),
+        key_buffer(nullptr),
+        order_capacity(0)
+    {}
+
+    RayStream(const RayStream& other) = delete;
+
+    ~RayStream()
+    {
+        delete[] records;
+        release_order();
+    }
+
+    //forgets every ray, keeping the memory
+    void clear()
+    {
+        n_records = 0;
+    }
+
+    //queues a primary ray whose first intersection has already been found, such as by a RayPacket.
+    //returns its index for intensity()
+    uint32_t add(const linef& ray, const Intersection<ftype>& intersection_info)
+    {
+        const uint32_t r = append(ray, Optics::all_colours, 0, ftype(1.0), ftype(1.0), ftype(1.0));
+        records[r].primary_hit = intersection_info;
+        return r;
+    }
+
+    //shades the primary rays, traces every generation of secondary rays they lead to, then sums up the ray trees
+    void trace()
+    {
+        size_t begin = 0;
+        while (begin < n_records)
+        {
+            //everything queued so far is one generation; shading it queues the next
+            const size_t end = n_records;
+            if (!begin)
+            {
+                //the primary rays are already in pixel order, which is as coherent as they get
+                for (size_t r = 0; r < end; r++)
+                {
+                    RayInfo<ftype> info(records[r].ray);
+                    shade(uint32_t(r), info, records[r].primary_hit);
+                }
+            }
+            else
+            {
+                sort_generation(begin, end);
+                for (size_t i = 0; i < end - begin; i++)
+                {
+                    const uint32_t r = order[i];
+                    const Record& record = records[r];
+                    RayInfo<ftype> info(record.ray, record.bitfield, record.generation, record.refractive_index, record.throughput);
+                    shade(r, info, first_intersection<ftype>(info.m_ray, info.m_traversal));
+                }
+            }
+            begin = end;
+        }
+        sum_tree();
+    }
+
+    //the light delivered along primary ray r, once trace() has been called
+    inline const Optics::SpectrumArray<ftype>& intensity(const uint32_t r)const { return records[r].intensity; }
+
+    inline const size_t& ray_count()const { return n_records; }
+};
+
+#endif
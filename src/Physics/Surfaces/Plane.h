@@ -56,10 +56,12 @@ public:
 
 	virtual const ftype first_intersection(const linef& ray)const override
 	{
-		return Geometry::intersection(static_cast<GPlane>(*this), ray);
+		return Geometry::intersection(GPlane::get_origin(), m_normal, ray);
 	};
 
 	virtual const fvector normal(const fvector& point)const { return m_normal; };
+
+	inline const fvector& get_normal()const { return m_normal; }
 };
 
 
@@ -50,6 +50,13 @@ public:
 		return Geometry::intersection(static_cast<spheref>(*this), ray, Surface<ftype>::tolerance);
 	}
 
+	//moves the sphere; accelerators pick the change up when they are next updated
+	void set_center(const fvector& center)
+	{
+		spheref::set_center(center);
+		Parent::mark_moved();
+	}
+
 	virtual const fvector normal(const fvector& point)const override
 	{
 		return Maths::unit(point - spheref::get_center());
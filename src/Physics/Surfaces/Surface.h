@@ -4,9 +4,13 @@
 #include "Maths/Linalg.h"
 #include "Geometry/Intersection.h"
 #include "Containers/Set.h"
+#include "Containers/Span.h"
 #include "MaterialComponents/MaterialComponent.h"
 
+#include <cmath>
 #include <iostream>
+#include <atomic>
+#include <stdint.h>
 /*
 * 
 * The base class that defines all the virtual functions that Surface types should possess;
@@ -22,6 +26,9 @@
 
 //#define CULL_SURFACES
 
+template <typename ftype>
+struct Intersection;
+
 template <typename ftype>
 class Surface
 {
@@ -32,6 +39,7 @@ public:
 	typedef Geometry::Space<ftype, 1, 3> linef;
 	typedef Geometry::AxisAlignedBoundingBox<ftype, 3> aabbf;
 	typedef Geometry::Sphere<ftype> spheref;
+	typedef Span<const Surface*> SurfaceSpan;
 
 
 	struct SurfaceInfo
@@ -60,6 +68,20 @@ public:
 
 		~SurfaceInfo() {}
 
+		//planes and the like have infinite bounds, which would ruin any spatial structure built from them;
+		//the accelerators keep these surfaces in a separate list and test them on every ray
+		inline bool is_bounded()const
+		{
+			for (size_t i = 0; i < 3; i++)
+			{
+				if (!std::isfinite(m_aabb.get_lower_bounds()[i]) || !std::isfinite(m_aabb.get_upper_bounds()[i]))
+				{
+					return false;
+				}
+			}
+			return std::isfinite(m_sphere.get_radius());
+		}
+
 		//test for equivaluence
 		friend bool operator==(const SurfaceInfo& surface, const SurfaceInfo& other)
 		{
@@ -72,7 +94,20 @@ public:
 	static constexpr ftype tolerance = 1e-4;  //1/10000
 	static constexpr ftype rtolerance = (1 - tolerance);
 private:
+	//counts every move of every surface; a surface remembers the count at its last move, so anything that
+	//keeps a copy of the geometry (each accelerator, the bounds in the manager) can find what moved since it
+	//last looked without clearing anything the others still need
+	static std::atomic<uint64_t> move_clock;
+	static uint64_t bounds_time;    //move_clock when refresh_moved_bounds last ran
+
 	const MaterialComponent<ftype> *const m_material;
+	uint64_t m_moved_at;            //move_clock at the last move, 0 if the surface never has
+protected:
+	//subclasses call this whenever they move or change shape, after the change
+	inline void mark_moved()
+	{
+		m_moved_at = ++move_clock;
+	}
 public:
 	Surface() = delete;
 
@@ -80,11 +115,13 @@ public:
 		const aabbf aabb,
 		const spheref sphere,
 		const MaterialComponent<ftype>* material):
-		m_material(material) 
+		m_material(material),
+		m_moved_at(0)
 	{
+		//a new surface can't be registered already, and searching the sets makes adding n surfaces quadratic
 		const SurfaceInfo info(this, aabb, sphere);
-		manager.add(info);
-		all_surfaces.add(this);
+		manager.append(info);
+		all_surfaces.append(this);
 	}
 
 	Surface(const Surface& other) = delete;
@@ -111,7 +148,63 @@ public:
 
 	virtual const fvector normal(const fvector& point)const = 0;
 
-	inline static SurfaceInfo* get_surface_infos()
+	//keeps this surface in info if the ray hits it closer than what info holds. surfaces made of
+	//other surfaces (instances) override this to record which of their parts was hit
+	virtual void intersect(Intersection<ftype>& info, const linef& ray)const
+	{
+		info.update(this, first_intersection(ray));
+	}
+
+	//true if the ray hits this surface between tolerance and max_distance
+	virtual bool occludes(const linef& ray, const ftype max_distance)const
+	{
+		const ftype dist = first_intersection(ray);
+		return dist > tolerance && dist < max_distance;
+	}
+
+	//the reading of the move clock now; a surface has moved since then once has_moved_since(time) is true
+	inline static uint64_t move_time()
+	{
+		return move_clock;
+	}
+
+	//true if the surface has moved after move_time() gave time
+	inline bool has_moved_since(const uint64_t time)const
+	{
+		return m_moved_at > time;
+	}
+
+	//brings the bounds in the manager up to date for every surface that has moved since the last call.
+	//the surfaces are left as they are, so any number of accelerators can still find what moved
+	static size_t refresh_moved_bounds()
+	{
+		const uint64_t now = move_time();
+		size_t n_moved = 0;
+		const size_t n = surface_count();
+		for (size_t i = 0; i < n; i++)
+		{
+			SurfaceInfo& info = manager[i];
+			if (info.m_surface->has_moved_since(bounds_time))
+			{
+				info.m_aabb = info.m_surface->make_aabb();
+				info.m_sphere = info.m_surface->make_bounding_sphere();
+				n_moved++;
+			}
+		}
+		bounds_time = now;
+		return n_moved;
+	}
+
+	//takes a surface out of the scene, so that it is only reached through whatever holds it
+	//(the shared geometry of instances); the surface itself is left alone
+	static void withdraw(Surface* surface)
+	{
+		const SurfaceInfo info(surface);
+		manager.remove(info);
+		all_surfaces.remove(surface);
+	}
+
+	inline static const SurfaceInfo* get_surface_infos()
 	{
 		return manager.get_objects();
 	}
@@ -121,37 +214,73 @@ public:
 		return manager.get_size();
 	}
 
+#ifdef CULL_SURFACES
+private:
+	//scratch space for the culls, so they never allocate once a thread has seen the whole scene
+	struct CullBuffer
+	{
+		const Surface** data = nullptr;
+		size_t capacity = 0;
+
+		const Surface** reserve(const size_t n)
+		{
+			if (n > capacity)
+			{
+				delete[] data;
+				data = new const Surface*[n];
+				capacity = n;
+			}
+			return data;
+		}
+
+		~CullBuffer() { delete[] data; }
+	};
+
+	static CullBuffer& cull_buffer()
+	{
+		static thread_local CullBuffer buffer;
+		return buffer;
+	}
+public:
+#endif
+
+	//a view of every registered surface; nothing is copied
+	inline static const SurfaceSpan surface_view()
+	{
+		return SurfaceSpan(all_surfaces.get_objects(), all_surfaces.get_size());
+	}
+
 	//given an aabb, we only add surfaces whose aabbs intersect with the input culling box.
-	static const Set<Surface*> surface_cull(const aabbf& culling_box)
+	//the result is a view, so it is only valid until the next cull on this thread or a surface is added/removed
+	static const SurfaceSpan surface_cull(const aabbf& culling_box)
 	{
 #ifdef CULL_SURFACES
-		Set<Surface*> out;
 		const size_t n = surface_count();
-		out.reserve(n); // to save allocation time, perhaps? we can try without this.
+		const Surface** out = cull_buffer().reserve(n);
+		size_t count = 0;
 
 		for (size_t i = 0; i < n; i++)
 		{
-			const SurfaceInfo info = manager[i];
+			const SurfaceInfo& info = manager[i];
 			if (Geometry::intersection(culling_box, info.m_aabb, true))
 			{
-				const Surface* const ptr = info.m_surface;
-				out.add(ptr);
+				out[count] = info.m_surface;
+				count++;
 			}
-	}
-		return out;
+		}
+		return SurfaceSpan(out, count);
 #else
-		return all_surfaces;
+		return surface_view();
 #endif 
 	}
 
-	static const Set<Surface*> surface_cull(const fvector& position, const fvector& direction, const float angle)
+	static const SurfaceSpan surface_cull(const fvector& position, const fvector& direction, const float angle)
 	{
 #ifdef CULL_SURFACES
-		Set<Surface*> out;
 		//needs modification
-		return out;
+		return SurfaceSpan();
 #else
-		return all_surfaces;
+		return surface_view();
 #endif 
 
 	}
@@ -169,6 +298,12 @@ Set<typename Surface<ftype>::SurfaceInfo> Surface<ftype>::manager;
 template<typename ftype>
 Set<Surface<ftype>*> Surface<ftype>::all_surfaces;
 
+template<typename ftype>
+std::atomic<uint64_t> Surface<ftype>::move_clock(0);
+
+template<typename ftype>
+uint64_t Surface<ftype>::bounds_time = 0;
+
 template<typename ftype>
 std::ostream& operator<<(std::ostream& out, const typename Surface<ftype>::SurfaceInfo& s)
 {
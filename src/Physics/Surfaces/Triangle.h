@@ -17,7 +17,17 @@ public:
 	typedef Geometry::Triangle<ftype, 3> trianglef;
 	typedef Surface<ftype> Parent;
 private:
+	//edges from vertex 0, kept so that every ray test doesn't have to rebuild them
+	fvector m_edge1;
+	fvector m_edge2;
 	fvector m_normal;
+
+	void precompute()
+	{
+		m_edge1 = trianglef::get_vertex(1) - trianglef::get_vertex(0);
+		m_edge2 = trianglef::get_vertex(2) - trianglef::get_vertex(0);
+		m_normal = Maths::unit(Maths::cross(m_edge1, m_edge2));
+	}
 public:
 	Triangle() = delete;
 
@@ -30,7 +40,7 @@ public:
 		trianglef(p1, p2, p3),
 		Parent(make_aabb(), make_bounding_sphere(), material)
 		{
-			m_normal = Maths::unit(Maths::cross(p1 - p2, p1-p3));
+			precompute();
 		}
 
 
@@ -38,7 +48,7 @@ public:
 	trianglef(triangle),
 	Parent(make_aabb(), make_bounding_sphere(), material)
 	{
-		m_normal = Maths::cross(m_triangle.get_vertex(0) - m_triangle.get_vertex(1), m_triangle.get_vertex(0)- m_triangle.get_vertex(2));
+		precompute();
 	}
 
 	Triangle(const Triangle& other) = delete;
@@ -59,7 +69,7 @@ public:
 
 	virtual const ftype first_intersection(const linef& ray)const override
 	{
-		return Geometry::intersection(static_cast<const trianglef>(*this), ray);
+		return Geometry::intersection(trianglef::get_vertex(0), m_edge1, m_edge2, ray);
 	};
 
 	virtual const fvector normal(const fvector& point)const override
@@ -67,6 +77,19 @@ public:
 		return m_normal;
 	}
 
+	//moves the triangle; accelerators pick the change up when they are next updated
+	void set_vertices(const fvector& p1, const fvector& p2, const fvector& p3)
+	{
+		trianglef::set_vertex(p1, 0);
+		trianglef::set_vertex(p2, 1);
+		trianglef::set_vertex(p3, 2);
+		precompute();
+		Parent::mark_moved();
+	}
+
+	inline const fvector& get_edge1()const { return m_edge1; }
+	inline const fvector& get_edge2()const { return m_edge2; }
+
 	virtual const Maths::Vector<ftype, 2> get_local_coordinates(const fvector& point)const
 	{
 		const fvector dir1 = Maths::unit(trianglef::get_center() - get_vertex(0));
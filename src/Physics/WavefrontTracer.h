@@ -0,0 +1,431 @@
+#ifndef WAVEFRONT_TRACER_H
+#define WAVEFRONT_TRACER_H
+
+#include "Physics/Interaction.h"
+
+#include <stdint.h>
+
+/*
+traces a batch of pixels as a wavefront: rather than following each ray through culling, intersection,
+shading, the lights and its children before starting the next, every ray of a generation goes through one
+stage at a time:
+
+    extend  - the closest hit of every ray in the queue
+    shade   - the hit point, normal and material of every ray that hit something
+    shadow  - one shadow ray per light for every diffusive hit, all tested together, then the light they let in
+    spawn   - the diffuse light is added to the pixel's running sum, and the specular and refracted rays go
+              into the queue for the next generation
+
+each stage is a plain loop over arrays, so the code and data it needs stay hot for the whole queue and the
+loops are open to SIMD. the camera is the generation stage: it adds the primary rays with add().
+
+a ray carries the weight its light is multiplied by on the way back to the camera, so nothing is kept on a
+stack and a pixel just adds up what each of its rays finds; the depth is only limited by max_generations.
+the sums are added in a different order from find_ray_intensity, so a pixel can differ from its value there
+in the last bits.
+
+a tracer is only used by one thread at a time; it keeps its memory from one batch to the next.
+*/
+
+template<typename ftype>
+class WavefrontTracer
+{
+public:
+    typedef Maths::Vector<ftype, 3> fvector;
+    typedef Geometry::Space<ftype, 1, 3> linef;
+    typedef Optics::SpectrumArray<ftype> sarray;
+
+private:
+    //grows an array to capacity, keeping its first n entries
+    template<typename type>
+    static void grow(type*& array, const size_t n, const size_t capacity)
+    {
+        type* grown = new type[capacity];
+        for (size_t i = 0; i < n; i++)
+        {
+            grown[i] = array[i];
+        }
+        delete[] array;
+        array = grown;
+    }
+
+    //the rays of one generation, a structure of arrays
+    struct RayQueue
+    {
+        ftype* origin_x = nullptr;
+        ftype* origin_y = nullptr;
+        ftype* origin_z = nullptr;
+        ftype* direction_x = nullptr;
+        ftype* direction_y = nullptr;
+        ftype* direction_z = nullptr;
+        Optics::SpectrumInt* bitfield = nullptr;
+        ftype* refractive_index = nullptr;
+        uint32_t* pixel = nullptr;                  //the pixel the ray's light goes to
+        sarray* weight = nullptr;                   //what the ray's light is multiplied by on its way to the pixel
+        ftype* throughput = nullptr;                //the RayInfo::m_throughput the ray would have in find_ray_intensity
+        size_t n = 0;
+        size_t capacity = 0;
+
+        RayQueue() {}
+
+        RayQueue(const RayQueue& other) = delete;
+
+        ~RayQueue()
+        {
+            delete[] origin_x;
+            delete[] origin_y;
+            delete[] origin_z;
+            delete[] direction_x;
+            delete[] direction_y;
+            delete[] direction_z;
+            delete[] bitfield;
+            delete[] refractive_index;
+            delete[] pixel;
+            delete[] weight;
+            delete[] throughput;
+        }
+
+        void push(
+            const linef& ray,
+            const Optics::SpectrumInt colours,
+            const ftype index,
+            const uint32_t target,
+            const sarray& ray_weight,
+            const ftype ray_throughput)
+        {
+            if (n == capacity)
+            {
+                capacity = capacity ? 2 * capacity : 1024;
+                grow(origin_x, n, capacity);
+                grow(origin_y, n, capacity);
+                grow(origin_z, n, capacity);
+                grow(direction_x, n, capacity);
+                grow(direction_y, n, capacity);
+                grow(direction_z, n, capacity);
+                grow(bitfield, n, capacity);
+                grow(refractive_index, n, capacity);
+                grow(pixel, n, capacity);
+                grow(weight, n, capacity);
+                grow(throughput, n, capacity);
+            }
+            const fvector& origin = ray.get_origin();
+            const fvector& axis = ray.get_axis();
+            origin_x[n] = origin.x;
+            origin_y[n] = origin.y;
+            origin_z[n] = origin.z;
+            direction_x[n] = axis.x;
+            direction_y[n] = axis.y;
+            direction_z[n] = axis.z;
+            bitfield[n] = colours;
+            refractive_index[n] = index;
+            pixel[n] = target;
+            weight[n] = ray_weight;
+            throughput[n] = ray_throughput;
+            n++;
+        }
+
+        //the line of ray i, with its axis exactly as it was pushed
+        inline linef ray(const size_t i)const
+        {
+            return linef(fvector{ origin_x[i], origin_y[i], origin_z[i] }, fvector{ direction_x[i], direction_y[i], direction_z[i] }, true);
+        }
+    };
+
+    unsigned int max_generations;
+
+    RayQueue queues[2];
+    RayQueue* current;
+    RayQueue* next;
+
+    //running sums of the light reaching each pixel of the batch
+    sarray* pixel_sums;
+    size_t n_pixels;
+    size_t pixel_capacity;
+
+    //what the current generation hit, one entry per ray in the queue
+    Intersection<ftype>* hits;
+    fvector* positions;
+    fvector* normals;
+    const Optics::Material<ftype>** materials;
+    size_t hit_capacity;
+
+    //the rays that hit a diffusive surface, the light they gather there, and their shadow rays for one light
+    uint32_t* diffuse_rays;
+    sarray* diffuse;
+    linef* shadow_rays;
+    ftype* shadow_distances;
+    ftype* illumination;
+    size_t n_diffuse;
+
+    RayPacket<ftype> packet;
+
+    void reserve_hits(const size_t n)
+    {
+        if (n <= hit_capacity)
+        {
+            return;
+        }
+        release_hits();
+        hit_capacity = n;
+        hits = new Intersection<ftype>[n];
+        positions = new fvector[n];
+        normals = new fvector[n];
+        materials = new const Optics::Material<ftype>*[n];
+        diffuse_rays = new uint32_t[n];
+        diffuse = new sarray[n];
+        shadow_rays = new linef[n];
+        shadow_distances = new ftype[n];
+        illumination = new ftype[n];
+    }
+
+    void release_hits()
+    {
+        delete[] hits;
+        delete[] positions;
+        delete[] normals;
+        delete[] materials;
+        delete[] diffuse_rays;
+        delete[] diffuse;
+        delete[] shadow_rays;
+        delete[] shadow_distances;
+        delete[] illumination;
+        hit_capacity = 0;
+    }
+
+    //the closest hit of every ray in the queue. primary rays leave the camera in neighbouring groups, so they are
+    //traced in packets; later generations are scattered and go one at a time
+    void extend(const bool coherent)
+    {
+        const RayQueue& queue = *current;
+        RayInfo<ftype>::rays_created += queue.n;
+        if (coherent)
+        {
+            for (size_t first = 0; first < queue.n; first += RayPacket<ftype>::size)
+            {
+                const size_t count = Maths::min(RayPacket<ftype>::size, queue.n - first);
+                packet.clear();
+                for (size_t i = 0; i < count; i++)
+                {
+                    packet.add(queue.ray(first + i));
+                }
+                first_intersection<ftype>(packet);
+                for (size_t i = 0; i < count; i++)
+                {
+                    hits[first + i] = packet.hits[i];
+                }
+            }
+            return;
+        }
+        for (size_t i = 0; i < queue.n; i++)
+        {
+            hits[i] = first_intersection<ftype>(queue.ray(i));
+        }
+    }
+
+    //where every ray hit and what it hit, and which of the hits are diffusive
+    void shade()
+    {
+        const RayQueue& queue = *current;
+        n_diffuse = 0;
+        for (size_t i = 0; i < queue.n; i++)
+        {
+            if (!hits[i].closest)
+            {
+                materials[i] = nullptr;
+                continue;
+            }
+            materials[i] = hit_point(queue.ray(i), hits[i], positions[i], normals[i]);
+            if (Optics::SpectrumArray<const ftype*>(materials[i]->get_diffusivity()).threshold(threshold_value<ftype>))
+            {
+                diffuse_rays[n_diffuse] = uint32_t(i);
+                diffuse[n_diffuse] = sarray();
+                n_diffuse++;
+            }
+        }
+    }
+
+    //the light each diffusive hit gets from every source, a source at a time so its shadow rays are tested together
+    void shadow()
+    {
+        const RayQueue& queue = *current;
+        const size_t n_lights = LightSource<ftype>::lights_count();
+        for (size_t l = 0; l < n_lights; l++)
+        {
+            //a negative illumination marks a shadow ray that is still to be tested
+            const LightSource<ftype>* light = LightSource<ftype>::get_light(l);
+            for (size_t d = 0; d < n_diffuse; d++)
+            {
+                const fvector& position = positions[diffuse_rays[d]];
+                illumination[d] = light->shadow_ray(position, shadow_rays[d], shadow_distances[d]) ? ftype(-1) : light->illumination(position);
+            }
+            for (size_t d = 0; d < n_diffuse; d++)
+            {
+                if (illumination[d] < ftype(0))
+                {
+                    illumination[d] = LightSource<ftype>::occluded(shadow_rays[d], shadow_distances[d]) ? ftype(0) : ftype(1);
+                }
+            }
+            for (size_t d = 0; d < n_diffuse; d++)
+            {
+                if (illumination[d])
+                {
+                    const uint32_t i = diffuse_rays[d];
+                    diffuse[d] += diffuse_light(light, queue.bitfield[i], positions[i], normals[i], illumination[d]);
+                }
+            }
+        }
+    }
+
+    //adds the diffuse light to the pixels and queues the next generation
+    void spawn(const bool children)
+    {
+        const RayQueue& queue = *current;
+        for (size_t d = 0; d < n_diffuse; d++)
+        {
+            const uint32_t i = diffuse_rays[d];
+            pixel_sums[queue.pixel[i]] += (diffuse[d] * Optics::SpectrumArray<const ftype*>(materials[i]->get_diffusivity())) * queue.weight[i];
+        }
+        if (!children)
+        {
+            return;
+        }
+
+        //the termination goes by the same throughput as in find_ray_intensity, the product of the largest
+        //component of every factor, rather than the weights, so every mode drops the same rays
+        const PathTermination<ftype>& termination = PathTermination<ftype>::get_active();
+
+        for (size_t i = 0; i < queue.n; i++)
+        {
+            const Optics::Material<ftype>* material = materials[i];
+            if (!material)
+            {
+                continue;
+            }
+            const Optics::SpectrumArray<const ftype*> specularity(material->get_specularity());
+            const Optics::SpectrumArray<const ftype*> transmissivity(material->get_transmissivity());
+            const fvector incident{ queue.direction_x[i], queue.direction_y[i], queue.direction_z[i] };
+            ftype compensation;
+
+            if (specularity.threshold(threshold_value<ftype>))
+            {
+                const ftype reflected_throughput = queue.throughput[i] * specularity.max();
+                if (termination.survives(reflected_throughput, positions[i], PathTermination<ftype>::specular_salt, compensation))
+                {
+                    sarray reflected_weight = queue.weight[i] * specularity;
+                    if (compensation != ftype(1))
+                    {
+                        reflected_weight = reflected_weight * compensation;
+                    }
+                    next->push(
+                        reflected_ray(incident, positions[i], normals[i]),
+                        queue.bitfield[i],
+                        ftype(1.0),
+                        queue.pixel[i],
+                        reflected_weight,
+                        reflected_throughput * compensation);
+                }
+            }
+
+            if (transmissivity.threshold(threshold_value<ftype>))
+            {
+                //find_ray_intensity multiplies a refracted ray's light by the transmissivity twice
+                sarray refracted_weight = (queue.weight[i] * transmissivity) * transmissivity;
+                const ftype refracted_throughput = queue.throughput[i] * transmissivity.max() * transmissivity.max();
+                const bool refract = termination.survives(refracted_throughput, positions[i], PathTermination<ftype>::refraction_salt, compensation);
+                if (compensation != ftype(1))
+                {
+                    refracted_weight = refracted_weight * compensation;
+                }
+                for (size_t r = 0; refract && r < material->unique_refractions(); r++)
+                {
+                    const Optics::SpectrumInt colours = queue.bitfield[i] & material->get_refractive_split(r);
+                    if (colours)
+                    {
+                        const ftype new_n = material->get_refractive_index(r);
+                        next->push(
+                            refracted_ray(incident, positions[i], normals[i], queue.refractive_index[i], new_n),
+                            colours,
+                            new_n,
+                            queue.pixel[i],
+                            refracted_weight,
+                            refracted_throughput * compensation);
+                    }
+                }
+            }
+        }
+    }
+
+public:
+    WavefrontTracer(const unsigned int generations = RayInfo<ftype>::max_generations) :
+        max_generations(generations),
+        current(queues),
+        next(queues + 1),
+        pixel_sums(nullptr),
+        n_pixels(0),
+        pixel_capacity(0),
+        hits(nullptr),
+        positions(nullptr),
+        normals(nullptr),
+        materials(nullptr),
+        hit_capacity(0),
+        diffuse_rays(nullptr),
+        diffuse(nullptr),
+        shadow_rays(nullptr),
+        shadow_distances(nullptr),
+        illumination(nullptr),
+        n_diffuse(0)
+    {}
+
+    WavefrontTracer(const WavefrontTracer& other) = delete;
+
+    ~WavefrontTracer()
+    {
+        delete[] pixel_sums;
+        release_hits();
+    }
+
+    //forgets every pixel and ray, keeping the memory
+    void clear()
+    {
+        current->n = 0;
+        next->n = 0;
+        n_pixels = 0;
+    }
+
+    //the generation stage: starts a new pixel with a primary ray. returns the pixel's index for intensity()
+    uint32_t add(const linef& ray)
+    {
+        if (n_pixels == pixel_capacity)
+        {
+            pixel_capacity = pixel_capacity ? 2 * pixel_capacity : 1024;
+            grow(pixel_sums, n_pixels, pixel_capacity);
+        }
+        pixel_sums[n_pixels] = sarray();
+        current->push(ray, Optics::all_colours, ftype(1.0), uint32_t(n_pixels), sarray(ftype(1)), ftype(1));
+        return uint32_t(n_pixels++);
+    }
+
+    //runs the stages over each generation in turn until no rays are left
+    void trace()
+    {
+        for (unsigned int generation = 0; current->n && generation < max_generations; generation++)
+        {
+            reserve_hits(current->n);
+            extend(!generation);
+            shade();
+            shadow();
+            spawn(generation + 1 < max_generations);
+
+            Maths::swap(current, next);
+            next->n = 0;
+        }
+        current->n = 0;
+    }
+
+    //the light reaching pixel p, once trace() has been called
+    inline const sarray& intensity(const uint32_t p)const { return pixel_sums[p]; }
+
+    inline const size_t& pixel_count()const { return n_pixels; }
+};
+
+#endif
@@ -225,7 +225,7 @@ void surfaces_test()
 
 	//test the surface cull
 	Geometry::AxisAlignedBoundingBox<float, 3>my_aabb({0, 0, 0}, {count >> 1, 3, 3});
-	Set<Surface<float>*> my_set = Surface<float>::surface_cull(my_aabb);
+	Span<const Surface<float>*> my_set = Surface<float>::surface_cull(my_aabb);
 	std::cout << "\n\nSurface cull ptrs: ";
 	for (size_t i = 0; i < my_set.get_size(); i++)
 	{
@@ -29,7 +29,7 @@
 template <typename ftype>
 void camera_tests(
 	const char filename[],
-	const unsigned char n_threads,
+	const size_t n_threads,
 	const unsigned short n_spheres,
 	const ftype sphere_radius = ftype(1.0),
 	const uint16_t h = 256,
@@ -28,29 +28,19 @@ public:
 	typedef Maths::Vector<ftype, 2> fvector2;
 	typedef Geometry::Space<ftype, 1, 3> linef;
 
+	//tiles that can see more surfaces than this leave their primary rays to the accelerator
+	static constexpr uint32_t max_primary_candidates = 16;
+
+	//the angles a surface's bounding sphere takes up as seen from the camera. longitude is measured
+	//from the forward axis towards the camera's y axis and latitude towards its z axis, each in the
+	//plane of that axis and the forward one, so the two are independent
 	struct SurfaceCoords
 	{
-		Surface<ftype>* surface;
+		const Surface<ftype>* surface;
 		ftype distance;
 		ftype distance2;
-		union
-		{
-			struct
-			{
-				ftype min_longitude;
-				ftype max_longitude;
-			};
-			fvector2 h_bounds;
-		};
-		union
-		{
-			struct
-			{
-				ftype min_latitude;
-				ftype max_latitude;
-			};
-			fvector2 v_bounds;
-		};
+		fvector2 h_bounds;   //the least and greatest longitude
+		fvector2 v_bounds;   //the least and greatest latitude
 	};
 
 private:
@@ -71,8 +61,18 @@ private:
 	fvector m_rotation; //in radians, ALWAYS
 	Maths::Matrix<ftype, 3, 3> directions;
 
-	//Set<SurfaceCoords> coords;  //we have no use for this yet
-	
+	//the angular bounds of every surface that could be in view, filled by find_surface_coordinates()
+	SurfaceCoords* coords = nullptr;
+	size_t n_coords = 0;
+
+	//the surfaces each tile's primary rays can hit, in registration order (see cull_tiles)
+	uint16_t cull_tile_size = 0;
+	uint16_t h_tiles = 0;
+	uint16_t v_tiles = 0;
+	uint32_t* tile_counts = nullptr;        //how many surfaces overlap each tile
+	uint32_t* tile_start = nullptr;         //where each tile's list starts in tile_surfaces
+	const Surface<ftype>** tile_surfaces = nullptr;
+
 	//where we send all our intensity data
 	Canvas<ftype> canvas;
 
@@ -86,11 +86,109 @@ private:
 	//we can get the ray by using the angle off the center that we look at
 	const linef get_ray_line()const 
 	{
-		const ftype delta_y = (ftype(h_counter << 1)/(h_res - 1) - 1)*tan_h; //replaced * 2 by  << 1
-        const ftype delta_z = (ftype(v_counter << 1)/(v_res - 1) - 1)*tan_v;
+		return get_ray_line(h_counter, v_counter);
+	}
 
-        const fvector axis = Maths::unit(directions[0] + delta_y*directions[1] + delta_z*directions[2]);
-        return linef(m_position, axis);
+	/*
+	* the angles a sphere can be seen at in the plane of the forward axis and one other, where forward and
+	* side are its centre's coordinates along those axes and forward_axis and side_axis the vectors that
+	* measure them. The rays with tan(angle) = u lie in the plane through the camera where side = u*forward,
+	* and that plane touches the sphere for the u on one side of the roots of a quadratic. Only the angles
+	* within the view, tan(angle) in [-tan_half, tan_half], are kept track of; false if there are none
+	*/
+	static bool angular_bounds(
+		const ftype forward,
+		const ftype side,
+		const fvector& forward_axis,
+		const fvector& side_axis,
+		const ftype radius,
+		const ftype tan_half,
+		fvector2& bounds)
+	{
+		constexpr ftype half_pi = ftype(0.5) * Maths::pi<ftype>;
+		const ftype radius2 = radius * radius;
+		const ftype a = forward * forward - radius2 * Maths::dot(forward_axis, forward_axis);
+		const ftype b = forward * side - radius2 * Maths::dot(forward_axis, side_axis);
+		const ftype c = side * side - radius2 * Maths::dot(side_axis, side_axis);
+		const ftype discriminant = b * b - a * c;
+		if (a > 0)
+		{
+			//the sphere is all in front of the camera or all behind it, and seen between the roots
+			if (forward < 0)
+			{
+				return false;
+			}
+			const ftype root = sqrt(Maths::max(discriminant, ftype(0)));
+			bounds = fvector2(atan((b - root) / a), atan((b + root) / a));
+			return true;
+		}
+		if (!(a < 0 && discriminant > 0))
+		{
+			bounds = fvector2(-half_pi, half_pi);
+			return true;
+		}
+
+		//the sphere reaches past the side of the camera, and can only be missed between the roots
+		const ftype root = sqrt(discriminant);
+		const ftype lower = (b + root) / a;
+		const ftype upper = (b - root) / a;
+		const bool seen_below = lower >= -tan_half;
+		const bool seen_above = upper <= tan_half;
+		if (!seen_below && !seen_above)
+		{
+			return false;
+		}
+		bounds = fvector2(seen_below ? -half_pi : atan(upper), seen_above ? half_pi : atan(lower));
+		return true;
+	}
+
+	/*
+	* the pixels along one axis whose rays lie within bounds. The rays along an axis are spread evenly in
+	* tangent, from -tan_half to tan_half over res pixels. Rounded outwards so none are missed; false if
+	* there are none
+	*/
+	static bool pixel_range(const fvector2& bounds, const ftype tan_half, const uint16_t res, uint16_t& first, uint16_t& last)
+	{
+		constexpr ftype half_pi = ftype(0.5) * Maths::pi<ftype>;
+		const ftype scale = ftype(0.5) * ftype(res - 1);
+		const ftype lower = bounds.x <= -half_pi ? ftype(-INFINITY) : floor((tan(bounds.x) / tan_half + 1) * scale);
+		const ftype upper = bounds.y >= half_pi ? ftype(INFINITY) : ceil((tan(bounds.y) / tan_half + 1) * scale);
+		if (upper < 0 || lower > ftype(res - 1) || !(lower <= upper))
+		{
+			return false;
+		}
+		first = lower < 0 ? 0 : uint16_t(lower);
+		last = upper > ftype(res - 1) ? uint16_t(res - 1) : uint16_t(upper);
+		return true;
+	}
+
+	//the tiles the pixels of c cover; false if it covers none
+	bool tile_range(const SurfaceCoords& c, uint16_t& tx0, uint16_t& ty0, uint16_t& tx1, uint16_t& ty1)const
+	{
+		uint16_t x0, x1, y0, y1;
+		if (!pixel_range(c.h_bounds, tan_h, h_res, x0, x1) || !pixel_range(c.v_bounds, tan_v, v_res, y0, y1))
+		{
+			return false;
+		}
+		tx0 = x0 / cull_tile_size;
+		tx1 = x1 / cull_tile_size;
+		ty0 = y0 / cull_tile_size;
+		ty1 = y1 / cull_tile_size;
+		return true;
+	}
+
+	void clear_culling()
+	{
+		delete[] coords;
+		delete[] tile_counts;
+		delete[] tile_start;
+		delete[] tile_surfaces;
+		coords = nullptr;
+		tile_counts = nullptr;
+		tile_start = nullptr;
+		tile_surfaces = nullptr;
+		n_coords = 0;
+		cull_tile_size = 0;
 	}
 
 public:
@@ -115,8 +213,6 @@ public:
 	canvas(h_res, v_res)
 	{
 		compute_rotation();
-		//coords.reserve(Surface<ftype>::surface_count());
-		//find_surface_coordinates();
 #ifdef CAMERA_DEBUG
 #define PRINT_MEMBER(member)\
 std::cout << "\n" #member ": " << member;
@@ -135,6 +231,13 @@ PRINT_MEMBER(tan_v)
 #endif
 	}
 
+	Camera(const Camera& other) = delete;
+
+	~Camera()
+	{
+		clear_culling();
+	}
+
 	const uint16_t get_horizontal_resolution()const
 	{
 		return h_res;
@@ -161,16 +264,41 @@ PRINT_MEMBER(tan_v)
 		return canvas;
 	}
 
-	const Set<SurfaceCoords>& get_surface_coords()const
+	const SurfaceCoords* get_surface_coords()const
 	{
 		return coords;
 	}
 
+	const size_t& surface_coords_count()const
+	{
+		return n_coords;
+	}
+
 	const size_t n_pixels()const
 	{
 		return size_t(v_res) * size_t(h_res);
 	}
 
+	//the ray through pixel (x, y). this doesn't touch any state, so any number of threads can call it at once
+	const linef get_ray_line(const uint16_t x, const uint16_t y)const
+	{
+		const ftype delta_y = (ftype(x << 1)/(h_res - 1) - 1)*tan_h; //replaced * 2 by  << 1
+        const ftype delta_z = (ftype(y << 1)/(v_res - 1) - 1)*tan_v;
+
+        const fvector axis = Maths::unit(directions[0] + delta_y*directions[1] + delta_z*directions[2]);
+        return linef(m_position, axis);
+	}
+
+	const size_t pixel_address(const uint16_t x, const uint16_t y)const
+	{
+		return size_t(x) + (size_t(h_res) * size_t(y));
+	}
+
+	const RayInfo<ftype> spawn_ray(const uint16_t x, const uint16_t y, const Optics::SpectrumInt bits_set = Optics::all_colours)const
+	{
+		return RayInfo<ftype>(get_ray_line(x, y), bits_set, 0, ftype(1.0));
+	}
+
 	//we could also get the line for the ray by specifying the x, y
 	const RayInfo<ftype> spawn_ray(size_t& rel_address, const Optics::SpectrumInt bits_set = Optics::all_colours)
 	{
@@ -196,7 +324,7 @@ PRINT_MEMBER(tan_v)
 		return out;
 	}
 
-	inline void write_to_canvas(const ftype* input_data, const size_t relative_address)
+	inline ftype write_to_canvas(const ftype* input_data, const size_t relative_address)
 	{
 #ifdef CAMERA_DEBUG
 		if (relative_address > h_res * v_res)
@@ -209,48 +337,159 @@ PRINT_MEMBER(tan_v)
 			m.unlock();
 		}
 #endif CAMERA_DEBUG
-		canvas.write_to_canvas(input_data, relative_address);
+		return canvas.write_to_canvas(input_data, relative_address);
+	}
+
+	inline void merge_max_intensity(const ftype value)
+	{
+		canvas.merge_max_intensity(value);
 	}
 
 	/*
-	we should use this to construct the relative angular bounds. can run at initalialisation
-	and when position/rotation changes
-	as planes are the only objects with infs in their suurface, we can use that information
-	to downcast and find the actual angular co-ordinates.
+	* finds the angular bounds of every registered surface's bounding sphere, for ray_cull() and
+	* cull_tiles(). Surfaces entirely behind the camera or outside its view are left out, and unbounded
+	* ones (planes) are given the whole view. Must be run again whenever the camera or a surface moves
 	*/
 	void find_surface_coordinates()
 	{
-		//loop over all surfaces
-		Set<Surface<ftype>*> out;
+		constexpr ftype half_pi = ftype(0.5) * Maths::pi<ftype>;
+		clear_culling();
 		const size_t n_surfaces = Surface<ftype>::surface_count();
+		const typename Surface<ftype>::SurfaceInfo* infos = Surface<ftype>::get_surface_infos();
+		coords = new SurfaceCoords[n_surfaces];
+
+		//a ray leaves along directions[0] + u*directions[1] + v*directions[2]. These measure a displacement
+		//in that basis, which isn't quite orthonormal for every rotation, so they aren't the directions themselves
+		const ftype determinant = Maths::dot(directions[0], Maths::cross(directions[1], directions[2]));
+		const fvector axes[3] = {
+			Maths::cross(directions[1], directions[2]) / determinant,
+			Maths::cross(directions[2], directions[0]) / determinant,
+			Maths::cross(directions[0], directions[1]) / determinant };
+		for (size_t i = 0; i < n_surfaces; i++)
+		{
+			const typename Surface<ftype>::SurfaceInfo& info = infos[i];
+			SurfaceCoords& c = coords[n_coords];
+			c.surface = info.m_surface;
+			if (!info.is_bounded())
+			{
+				c.distance = c.distance2 = ftype(INFINITY);
+				c.h_bounds = fvector2(-half_pi, half_pi);
+				c.v_bounds = fvector2(-half_pi, half_pi);
+				n_coords++;
+				continue;
+			}
+
+			const fvector displacement = info.m_sphere.get_center() - m_position;
+			const ftype forward = Maths::dot(axes[0], displacement);
+			const ftype radius = info.m_sphere.get_radius();
+			c.distance2 = Maths::dot(displacement, displacement);
+			c.distance = sqrt(c.distance2);
+			uint16_t first, last;
+			if (angular_bounds(forward, Maths::dot(axes[1], displacement), axes[0], axes[1], radius, tan_h, c.h_bounds) &&
+				angular_bounds(forward, Maths::dot(axes[2], displacement), axes[0], axes[2], radius, tan_v, c.v_bounds) &&
+				pixel_range(c.h_bounds, tan_h, h_res, first, last) &&
+				pixel_range(c.v_bounds, tan_v, v_res, first, last))
+			{
+				n_coords++;
+			}
+		}
 	}
 
-	//we can call this to loop over the surfaces when it's ready lol.
-	Set<Surface<ftype>*> ray_cull() const
+	//writes the surfaces whose bounds overlap pixels [x0, x1) x [y0, y1) to out, in registration order,
+	//and returns how many there were. out must have room for surface_coords_count() of them
+	size_t ray_cull(const uint16_t x0, const uint16_t y0, const uint16_t x1, const uint16_t y1, const Surface<ftype>** out) const
 	{
-		typedef Maths::Vector<ftype, 3> fvector;
-		// we know the displacement from each surface sphere to the camera, we just need to find the
-		//angle to the transformed y & z axes.
+		size_t count = 0;
+		for (size_t i = 0; i < n_coords; i++)
+		{
+			uint16_t first_x, last_x, first_y, last_y;
+			if (pixel_range(coords[i].h_bounds, tan_h, h_res, first_x, last_x) && first_x < x1 && last_x >= x0 &&
+				pixel_range(coords[i].v_bounds, tan_v, v_res, first_y, last_y) && first_y < y1 && last_y >= y0)
+			{
+				out[count] = coords[i].surface;
+				count++;
+			}
+		}
+		return count;
+	}
 
-		//loop over all surfaces
-		Set<Surface<ftype>*> out;
-		const size_t n_surfaces = Surface<ftype>::surface_count();
-		for (size_t i = 0; i < n_surfaces; i++)
+	/*
+	* the pre-pass for the primary rays: finds the surface coordinates, then lists the surfaces that can
+	* be seen in each tile_size x tile_size tile. Only tiles with at most max_primary_candidates surfaces
+	* keep their list, as the others are better served by the accelerator
+	*/
+	void cull_tiles(const uint16_t tile_size)
+	{
+		find_surface_coordinates();
+		cull_tile_size = tile_size;
+		h_tiles = (h_res + tile_size - 1) / tile_size;
+		v_tiles = (v_res + tile_size - 1) / tile_size;
+		const size_t n_tiles = size_t(h_tiles) * size_t(v_tiles);
+
+		tile_counts = new uint32_t[n_tiles]();
+		for (size_t i = 0; i < n_coords; i++)
 		{
-			//find the displacement vector and things
-			auto info = Surface<ftype>::get_surface_infos()[i];
-			if(info.m_sphere.get_radius() == INFINITY)
+			uint16_t tx0, ty0, tx1, ty1;
+			if (tile_range(coords[i], tx0, ty0, tx1, ty1))
 			{
-				out.add(info.m_surface)
+				for (size_t ty = ty0; ty <= ty1; ty++)
+				{
+					for (size_t tx = tx0; tx <= tx1; tx++)
+					{
+						tile_counts[tx + h_tiles * ty]++;
+					}
+				}
 			}
+		}
 
-			const fvector displacement = info.m_sphere.get_center() - m_position;
-			const fvector on_z = displacement - directions[1]*(Maths::dot(directions[1], displacement));
-			const fvector on_y = displacement - directions[2]*(Maths::dot(directions[2], displacement));
+		tile_start = new uint32_t[n_tiles + 1];
+		tile_start[0] = 0;
+		for (size_t i = 0; i < n_tiles; i++)
+		{
+			const uint32_t kept = tile_counts[i] <= max_primary_candidates ? tile_counts[i] : 0;
+			tile_start[i + 1] = tile_start[i] + kept;
+		}
 
-			//see if any of this object would be in view:
+		//filled in coords order, which is registration order
+		tile_surfaces = new const Surface<ftype>*[tile_start[n_tiles]];
+		uint32_t* filled = new uint32_t[n_tiles]();
+		for (size_t i = 0; i < n_coords; i++)
+		{
+			uint16_t tx0, ty0, tx1, ty1;
+			if (tile_range(coords[i], tx0, ty0, tx1, ty1))
+			{
+				for (size_t ty = ty0; ty <= ty1; ty++)
+				{
+					for (size_t tx = tx0; tx <= tx1; tx++)
+					{
+						const size_t tile = tx + h_tiles * ty;
+						if (tile_counts[tile] <= max_primary_candidates)
+						{
+							tile_surfaces[tile_start[tile] + filled[tile]] = coords[i].surface;
+							filled[tile]++;
+						}
+					}
+				}
+			}
 		}
-		return out;
+		delete[] filled;
+	}
+
+	//the surfaces the primary rays of the tile starting at pixel (x0, y0) can hit. false if the tile has
+	//too many to list or cull_tiles() hasn't been run, in which case its rays should use the accelerator
+	bool primary_candidates(const uint16_t x0, const uint16_t y0, Span<const Surface<ftype>*>& candidates)const
+	{
+		if (!tile_counts)
+		{
+			return false;
+		}
+		const size_t tile = size_t(x0 / cull_tile_size) + size_t(h_tiles) * size_t(y0 / cull_tile_size);
+		if (tile_counts[tile] > max_primary_candidates)
+		{
+			return false;
+		}
+		candidates = Span<const Surface<ftype>*>(tile_surfaces + tile_start[tile], tile_counts[tile]);
+		return true;
 	}
 
 	void reset()
@@ -64,17 +64,28 @@ public:
 	void reset()
 	{
 		counter = 0;
+		max_intensity = 0;
 		memset(data, 0, n_fragments * sizeof(ftype) * Optics::Spectrum::n());
 	}
 
-	inline void write_to_canvas(const ftype* input_data, const size_t relative_address)
+	//writes one fragment and returns the largest value in it. each fragment belongs to one thread, so
+	//this is safe to call concurrently; the shared max_intensity is left to merge_max_intensity
+	inline ftype write_to_canvas(const ftype* input_data, const size_t relative_address)
 	{
+		ftype fragment_max = 0;
 		ftype* ptr = data + (Optics::Spectrum::n()*relative_address);
 		BEGIN_SPECTRUM_LOOP(i)
-			max_intensity = Maths::max(max_intensity, input_data[i]);
+			fragment_max = Maths::max(fragment_max, input_data[i]);
 			*ptr = input_data[i];
 			ptr++;
 		END_SPECTRUM_LOOP
+		return fragment_max;
+	}
+
+	//folds a max found by a render thread (or tile) into the canvas; only call once the writers are done
+	void merge_max_intensity(const ftype value)
+	{
+		max_intensity = Maths::max(max_intensity, value);
 	}
 
 	ftype get_max_intensity()const 
@@ -0,0 +1,134 @@
+#ifndef RENDER_POOL_H
+#define RENDER_POOL_H
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+/*
+a set of worker threads that stay alive between renders, so a sequence of frames (or lots of small
+renders) doesn't pay for creating and joining threads every time.
+
+run(job) calls job(thread_index) once on every thread in the pool and returns when they have all finished.
+the calling thread takes part as thread 0, so a pool of n threads only owns n - 1 workers and a pool
+of one thread runs everything inline. run should only be called from one thread at a time.
+*/
+
+class RenderPool
+{
+public:
+	typedef std::function<void(const size_t)> Job;
+private:
+	size_t n_threads;
+	std::thread* workers;                   //n_threads - 1 of them
+
+	std::mutex mutex;
+	std::condition_variable start_signal;
+	std::condition_variable done_signal;
+	const Job* job;
+	size_t generation;                      //bumped for every job so the workers can tell a new one has arrived
+	size_t n_running;
+	bool stopping;
+
+	void worker_loop(const size_t thread_index)
+	{
+		size_t seen = 0;
+		for (;;)
+		{
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				start_signal.wait(lock, [this, &seen]() { return stopping || generation != seen; });
+				if (stopping)
+				{
+					return;
+				}
+				seen = generation;
+			}
+
+			(*job)(thread_index);
+
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				n_running--;
+				if (!n_running)
+				{
+					done_signal.notify_one();
+				}
+			}
+		}
+	}
+
+public:
+	static size_t default_thread_count()
+	{
+		const size_t n = std::thread::hardware_concurrency();
+		return n ? n : 1;
+	}
+
+	explicit RenderPool(const size_t thread_count = default_thread_count()) :
+		n_threads(thread_count ? thread_count : 1),
+		workers(nullptr),
+		job(nullptr),
+		generation(0),
+		n_running(0),
+		stopping(false)
+	{
+		if (n_threads > 1)
+		{
+			workers = new std::thread[n_threads - 1];
+			for (size_t i = 1; i < n_threads; i++)
+			{
+				workers[i - 1] = std::thread(&RenderPool::worker_loop, this, i);
+			}
+		}
+	}
+
+	RenderPool(const RenderPool& other) = delete;
+
+	~RenderPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		start_signal.notify_all();
+		for (size_t i = 1; i < n_threads; i++)
+		{
+			workers[i - 1].join();
+		}
+		delete[] workers;
+	}
+
+	inline const size_t& thread_count()const { return n_threads; }
+
+	//runs new_job on every thread in the pool, including this one, and waits for all of them
+	void run(const Job& new_job)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			job = &new_job;
+			n_running = n_threads - 1;
+			generation++;
+		}
+		start_signal.notify_all();
+
+		//waits for the workers and forgets the job on the way out, even if this thread's share throws,
+		//so no worker is left running a job that has gone out of scope
+		struct JobGuard
+		{
+			RenderPool& pool;
+
+			~JobGuard()
+			{
+				std::unique_lock<std::mutex> lock(pool.mutex);
+				pool.done_signal.wait(lock, [this]() { return !pool.n_running; });
+				pool.job = nullptr;
+			}
+		} guard{ *this };
+
+		new_job(0);
+	}
+};
+
+#endif
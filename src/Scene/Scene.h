@@ -2,11 +2,19 @@
 #define SCENE_H
 
 #include "Physics/Interaction.h"
+#include "Physics/RayStream.h"
+#include "Physics/WavefrontTracer.h"
+#include "Physics/IterativeTracer.h"
+#include "Acceleration/WideBoundingVolumeHierarchy.h"
+#include "Acceleration/UniformGrid.h"
+#include "Acceleration/CompactBoundingVolumeHierarchy.h"
 #include "Camera.h"
+#include "Tiles.h"
+#include "RenderPool.h"
 #include "SDL.h"
 
-#include <thread>
-#include <mutex>
+#include <cassert>
+
 
 
 
@@ -16,66 +24,270 @@ calculations
 */
 namespace Scene
 {
+	//the accelerator render builds when the caller hasn't set one up. an animated scene does better to set up
+	//its own, build it once and update() it between frames; the binary and wide bvhs can be refitted that
+	//way, but the grid and the compact bvh have to be built again
+	enum AcceleratorType
+	{
+		AUTOMATIC_ACCELERATOR,  //a grid if UniformGrid::suits_scene(), a bvh otherwise
+		BVH_ACCELERATOR,        //a 4-wide bvh, the default
+		GRID_ACCELERATOR,
+		COMPACT_BVH_ACCELERATOR  //a bvh with quantized nodes, for scenes too big for the caches. slower than the
+		                         //4-wide bvh otherwise, so only used when asked for
+	};
+
+	//how the rays that follow the primary ones are traced
+	enum TracingMode
+	{
+		RECURSIVE_TRACING,       //each path depth first, by find_ray_intensity
+		STREAMED_TRACING,        //a tile's secondary rays a generation at a time, in the order RayStream sorts them into
+		WAVEFRONT_TRACING,       //several tiles at once, each stage over every ray of a generation, by WavefrontTracer
+		ITERATIVE_TRACING        //each path depth first off a fixed stack, by IterativeTracer, within the ray budget
+	};
+
+	//how many tiles a thread puts through a WavefrontTracer together
+	constexpr size_t tiles_per_wavefront = 16;
+
+	//how render goes about a frame; left as they are, the settings render the way it always has
+	template<typename ftype>
+	struct RenderSettings
+	{
+		AcceleratorType accelerator = BVH_ACCELERATOR;
+		TracingMode mode = RECURSIVE_TRACING;
+		//the most rays a pixel may trace, its primary one included. only ITERATIVE_TRACING can stop a path
+		//part way, so any other budget than unlimited needs that mode
+		size_t ray_budget = IterativeTracer<ftype>::unlimited;
+		//which of the dim specular and refracted rays are traced, in every mode
+		PathTermination<ftype> termination;
+	};
+
+	//an array render works in, freed however the render ends
+	template<typename type>
+	struct ScratchArray
+	{
+		type* const data;
+
+		explicit ScratchArray(const size_t n) : data(new type[n]{}) {}
+
+		ScratchArray(const ScratchArray& other) = delete;
+
+		~ScratchArray() { delete[] data; }
+	};
+
+	//renders on the threads of a pool the caller keeps alive, so it can be reused for the next frame
 	template<typename ftype>
-	void render(Camera<ftype>& camera, unsigned char n_threads)
+	void render(Camera<ftype>& camera, RenderPool& pool, const RenderSettings<ftype>& settings = RenderSettings<ftype>())
 	{
-		const size_t n = camera.n_pixels();
+		assert((settings.ray_budget == IterativeTracer<ftype>::unlimited || settings.mode == ITERATIVE_TRACING) &&
+			"a ray budget is only kept to by ITERATIVE_TRACING");
+		const AcceleratorType type = settings.accelerator;
+		const TracingMode mode = settings.mode;
+		const size_t ray_budget = settings.ray_budget;
+
+		//if the caller hasn't set up an accelerator, build one over the scene for this render
+		BoundingVolumeHierarchy4<ftype> bvh;
+		UniformGrid<ftype> grid;
+		CompactBoundingVolumeHierarchy<ftype> compact;
+		const bool default_accelerator = !Accelerator<ftype>::get_active();
+
+		//the accelerator built here dies with this call, so it stops being the active one however the call ends
+		struct AcceleratorGuard
+		{
+			const bool reset;
+
+			~AcceleratorGuard()
+			{
+				if (reset)
+				{
+					Accelerator<ftype>::set_active(nullptr);
+				}
+			}
+		} accelerator_guard{ default_accelerator };
+
+		if (default_accelerator)
+		{
+			const bool use_grid = (type == GRID_ACCELERATOR) ||
+				(type == AUTOMATIC_ACCELERATOR && UniformGrid<ftype>::suits_scene());
+			if (use_grid)
+			{
+				grid.build(pool);
+				Accelerator<ftype>::set_active(&grid);
+			}
+			else if (type == COMPACT_BVH_ACCELERATOR)
+			{
+				compact.build();
+				Accelerator<ftype>::set_active(&compact);
+			}
+			else
+			{
+				bvh.build();
+				Accelerator<ftype>::set_active(&bvh);
+			}
+		}
 		
-		if (n_threads > 1)
+		//threads take whole tiles from the scheduler and trace every pixel in them; nothing is locked.
+		//each tile keeps its own max intensity, and they are merged in tile order once every thread is done
+		//so the exposure doesn't depend on how many threads there were
+		TileScheduler tiles(camera.get_horizontal_resolution(), camera.get_vertical_resolution());
+		const ScratchArray<ftype> tile_maxima(tiles.tile_count());
+		ftype* const tile_max = tile_maxima.data;
+
+		//tiles that can only see a few surfaces test their primary rays against just those
+		camera.cull_tiles(tiles.get_tile_size());
+
+		//the termination only holds for this render; whatever was active before comes back however the call ends
+		struct TerminationGuard
 		{
-			std::thread** thread_ptrs = new std::thread * [n_threads];
-			std::mutex guard;
-			for (unsigned char i = 0; i < n_threads; i++)
+			const PathTermination<ftype> previous;
+
+			~TerminationGuard()
 			{
-				std::cout << "\ninitialising thread " << int(i);
-				//define a lambda that a bunch of threads can run...
-				thread_ptrs[i] = new std::thread(
-					[&camera, &guard, n, i, thread_ptrs]()
+				PathTermination<ftype>::set_active(previous);
+			}
+		} termination_guard{ PathTermination<ftype>::get_active() };
+		PathTermination<ftype>::set_active(settings.termination);
+
+		const auto render_tiles = [&camera, &tiles, tile_max, mode, ray_budget]()
+		{
+			Tile tile;
+			RayPacket<ftype> packet;
+			RayStream<ftype> stream;
+			IterativeTracer<ftype> iterative(ray_budget);
+			const ScratchArray<size_t> stream_pixel_array(size_t(tiles.get_tile_size()) * tiles.get_tile_size());
+			size_t* const stream_pixels = stream_pixel_array.data;
+			while (tiles.next_tile(tile))
+			{
+				ftype local_max = 0;
+				stream.clear();
+
+				//shades a primary ray straight away, or queues it to be traced with the rest of the tile
+				const auto deliver = [&camera, &local_max, &stream, &iterative, stream_pixels, mode](
+					const uint16_t x, const uint16_t y, const Geometry::Space<ftype, 1, 3>& ray, const Intersection<ftype>& hit)
+				{
+					if (mode == STREAMED_TRACING)
+					{
+						stream_pixels[stream.add(ray, hit)] = camera.pixel_address(x, y);
+						return;
+					}
+					Optics::SpectrumArray<ftype> intensity;
+					if (mode == ITERATIVE_TRACING)
+					{
+						intensity = iterative.intensity(ray, hit);
+					}
+					else
+					{
+						RayInfo<ftype> my_ray(ray);
+						intensity = find_ray_intensity(my_ray, hit);
+					}
+					const ftype fragment_max = camera.write_to_canvas(intensity.get_data(), camera.pixel_address(x, y));
+					local_max = Maths::max(local_max, fragment_max);
+				};
+
+				Span<const Surface<ftype>*> candidates;
+				if (camera.primary_candidates(tile.x0, tile.y0, candidates))
+				{
+					tile.for_each_pixel(tiles.get_tile_size(), [&camera, &candidates, &deliver](const uint16_t x, const uint16_t y)
+					{
+						const Geometry::Space<ftype, 1, 3> ray = camera.get_ray_line(x, y);
+						deliver(x, y, ray, first_intersection<ftype>(ray, candidates));
+					});
+				}
+				else
+				{
+					//neighbouring primary rays are traced through the accelerator together, then shaded one by one
+					tile.template for_each_group<RayPacket<ftype>::size>(tiles.get_tile_size(),
+						[&camera, &packet, &deliver](const uint16_t* xs, const uint16_t* ys, const size_t n)
 					{
-						std::thread* current = thread_ptrs[i];
-						for (;;)
+						packet.clear();
+						for (size_t i = 0; i < n; i++)
 						{
-							size_t rel_mem = 0;
-							guard.lock();
-							RayInfo<ftype> my_ray = camera.spawn_ray(rel_mem);
-							guard.unlock();
-
-							if (rel_mem >= n)
-							{
-								return;
-							}
-							camera.write_to_canvas(find_ray_intensity(my_ray).get_data(), rel_mem);
+							packet.add(camera.get_ray_line(xs[i], ys[i]));
+						}
+						first_intersection<ftype>(packet);
+						for (size_t i = 0; i < n; i++)
+						{
+							deliver(xs[i], ys[i], packet.rays[i], packet.hits[i]);
 						}
 					});
+				}
+
+				if (mode == STREAMED_TRACING)
+				{
+					stream.trace();
+					const size_t n_pixels = size_t(tile.x1 - tile.x0) * size_t(tile.y1 - tile.y0);
+					for (size_t i = 0; i < n_pixels; i++)
+					{
+						const ftype fragment_max = camera.write_to_canvas(stream.intensity(uint32_t(i)).get_data(), stream_pixels[i]);
+						local_max = Maths::max(local_max, fragment_max);
+					}
+				}
+				tile_max[tile.index] = local_max;
 			}
-			//we need to ensure all threads are done
+		};
 
-			for (unsigned char i = 0; i < n_threads; i++)
+		//takes tiles_per_wavefront tiles at a time and generates all their primary rays before tracing any of them
+		const auto render_wavefronts = [&camera, &tiles, tile_max]()
+		{
+			const size_t tile_pixels = size_t(tiles.get_tile_size()) * tiles.get_tile_size();
+			WavefrontTracer<ftype> wavefront;
+			Tile batch[tiles_per_wavefront];
+			const ScratchArray<size_t> pixel_address_array(tiles_per_wavefront * tile_pixels);
+			size_t* const pixel_addresses = pixel_address_array.data;
+			size_t n_batch = tiles_per_wavefront;
+			while (n_batch == tiles_per_wavefront)
 			{
-				std::cout << "\njoining thread " << int(i);
-				thread_ptrs[i]->join();
-				delete thread_ptrs[i];
-				std::cout << "\ndeleted thread " << int(i);
-				thread_ptrs[i] = nullptr;
-				//we need to see if all are joined
+				wavefront.clear();
+				for (n_batch = 0; n_batch < tiles_per_wavefront && tiles.next_tile(batch[n_batch]); n_batch++)
+				{
+					batch[n_batch].for_each_pixel(tiles.get_tile_size(), [&camera, &wavefront, pixel_addresses](const uint16_t x, const uint16_t y)
+					{
+						pixel_addresses[wavefront.add(camera.get_ray_line(x, y))] = camera.pixel_address(x, y);
+					});
+				}
+				wavefront.trace();
 
+				//the pixels were added a tile at a time, so each tile's are together
+				size_t pixel = 0;
+				for (size_t t = 0; t < n_batch; t++)
+				{
+					ftype local_max = 0;
+					const size_t n_pixels = size_t(batch[t].x1 - batch[t].x0) * size_t(batch[t].y1 - batch[t].y0);
+					for (size_t i = 0; i < n_pixels; i++, pixel++)
+					{
+						const ftype fragment_max = camera.write_to_canvas(wavefront.intensity(uint32_t(pixel)).get_data(), pixel_addresses[pixel]);
+						local_max = Maths::max(local_max, fragment_max);
+					}
+					tile_max[batch[t].index] = local_max;
+				}
 			}
-			delete[] thread_ptrs;
-			//we should delete all the thread objects
+		};
+
+		if (mode == WAVEFRONT_TRACING)
+		{
+			pool.run([&render_wavefronts](const size_t) { render_wavefronts(); });
 		}
 		else
 		{
-			for(;;)
-			{
-				size_t rel_mem = 0;
-				RayInfo<ftype> my_ray = camera.spawn_ray(rel_mem);
-				if (rel_mem >= n)
-				{
-					return;
-				}
-				camera.write_to_canvas(find_ray_intensity(my_ray).get_data(), rel_mem);	
-			}
+			pool.run([&render_tiles](const size_t) { render_tiles(); });
+		}
+
+		ftype max_intensity = 0;
+		for (size_t i = 0; i < tiles.tile_count(); i++)
+		{
+			max_intensity = Maths::max(max_intensity, tile_max[i]);
 		}
+		camera.merge_max_intensity(max_intensity);
+	}
+
+	//renders on a pool that only lives for this call
+	template<typename ftype>
+	void render(
+		Camera<ftype>& camera,
+		const size_t n_threads = RenderPool::default_thread_count(),
+		const RenderSettings<ftype>& settings = RenderSettings<ftype>())
+	{
+		RenderPool pool(n_threads);
+		render(camera, pool, settings);
 	}
 
 	//makes an SDL window and displays the tting
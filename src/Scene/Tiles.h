@@ -0,0 +1,166 @@
+#ifndef TILES_H
+#define TILES_H
+
+#include "Maths/Morton.h"
+
+#include <atomic>
+#include <cassert>
+#include <stdint.h>
+
+/*
+splits the canvas into square tiles that the render threads take from a shared atomic counter,
+so handing out work never takes a lock.
+
+tiles are handed out in morton order, and the pixels inside a tile are walked in morton order too,
+so the rays a thread traces one after the other look at the same part of the scene.
+*/
+
+struct Tile
+{
+	uint16_t x0;     //first column in the tile
+	uint16_t y0;     //first row in the tile
+	uint16_t x1;     //one past the last column
+	uint16_t y1;     //one past the last row
+	size_t index;    //position in the hand-out order
+
+	//calls function(x, y) for every pixel in the tile
+	template<typename function_type>
+	void for_each_pixel(const uint16_t tile_size, function_type function)const
+	{
+		const uint32_t n_codes = uint32_t(tile_size) * uint32_t(tile_size);
+		for (uint32_t code = 0; code < n_codes; code++)
+		{
+			uint16_t dx, dy;
+			Maths::morton_decode(code, dx, dy);
+			const uint16_t x = x0 + dx;
+			const uint16_t y = y0 + dy;
+			if (x < x1 && y < y1)
+			{
+				function(x, y);
+			}
+		}
+	}
+
+	//calls function(xs, ys, n) for the pixels of the tile in the same order, group_size of them at a time
+	//(fewer for the last group). runs of morton codes are small blocks, so the pixels of a group are neighbours
+	template<size_t group_size, typename function_type>
+	void for_each_group(const uint16_t tile_size, function_type function)const
+	{
+		uint16_t xs[group_size];
+		uint16_t ys[group_size];
+		size_t n = 0;
+		for_each_pixel(tile_size, [&xs, &ys, &n, &function](const uint16_t x, const uint16_t y)
+		{
+			xs[n] = x;
+			ys[n] = y;
+			n++;
+			if (n == group_size)
+			{
+				function(xs, ys, n);
+				n = 0;
+			}
+		});
+		if (n)
+		{
+			function(xs, ys, n);
+		}
+	}
+};
+
+class TileScheduler
+{
+public:
+	static constexpr uint16_t default_tile_size = 16;
+private:
+	const uint16_t h_res;
+	const uint16_t v_res;
+	const uint16_t tile_size;
+	const uint16_t h_tiles;
+	const uint16_t v_tiles;
+	size_t n_tiles;
+	uint32_t* order;               //tile numbers (x + h_tiles*y) in the order they are handed out
+	std::atomic<size_t> next;
+
+	static inline bool is_power_of_two(const uint16_t value)
+	{
+		return value && !(value & (value - 1));
+	}
+
+	void make_order()
+	{
+		//walk every morton code of the smallest square power-of-two grid that covers the tiles
+		//in size_t, as a side of 65536 tiles has 2^32 codes
+		size_t side = 1;
+		while (side < h_tiles || side < v_tiles)
+		{
+			side <<= 1;
+		}
+
+		n_tiles = 0;
+		order = new uint32_t[size_t(h_tiles) * size_t(v_tiles)];
+		for (size_t code = 0; code < side * side; code++)
+		{
+			uint16_t x, y;
+			Maths::morton_decode(uint32_t(code), x, y);
+			if (x < h_tiles && y < v_tiles)
+			{
+				order[n_tiles] = uint32_t(x) + uint32_t(h_tiles) * uint32_t(y);
+				n_tiles++;
+			}
+		}
+	}
+
+public:
+	TileScheduler() = delete;
+
+	TileScheduler(const uint16_t horizontal_res, const uint16_t vertical_res, const uint16_t tile_size_ = default_tile_size) :
+		h_res(horizontal_res),
+		v_res(vertical_res),
+		tile_size(tile_size_),
+		h_tiles((horizontal_res + tile_size_ - 1) / tile_size_),
+		v_tiles((vertical_res + tile_size_ - 1) / tile_size_),
+		n_tiles(0),
+		order(nullptr),
+		next(0)
+	{
+		assert(is_power_of_two(tile_size) && "tiles are walked in morton order, so their size must be a power of two");
+		make_order();
+	}
+
+	TileScheduler(const TileScheduler& other) = delete;
+
+	~TileScheduler()
+	{
+		delete[] order;
+	}
+
+	//takes the next tile; returns false once every tile has been handed out. safe to call from any thread
+	bool next_tile(Tile& tile)
+	{
+		const size_t index = next.fetch_add(1, std::memory_order_relaxed);
+		if (index >= n_tiles)
+		{
+			return false;
+		}
+		const uint32_t number = order[index];
+		const uint16_t tx = uint16_t(number % h_tiles);
+		const uint16_t ty = uint16_t(number / h_tiles);
+
+		tile.x0 = tx * tile_size;
+		tile.y0 = ty * tile_size;
+		tile.x1 = (tile.x0 + tile_size < h_res) ? tile.x0 + tile_size : h_res;
+		tile.y1 = (tile.y0 + tile_size < v_res) ? tile.y0 + tile_size : v_res;
+		tile.index = index;
+		return true;
+	}
+
+	void reset()
+	{
+		next.store(0, std::memory_order_relaxed);
+	}
+
+	inline const size_t& tile_count()const { return n_tiles; }
+	inline const uint16_t& get_tile_size()const { return tile_size; }
+};
+
+#endif
@@ -79,10 +79,19 @@ public:
         return index;
     }
 
+    //adds a value the caller knows isn't in the set yet, without looking for it first; returns the index
+    const size_t append(const type& value)
+    {
+        Container::grow();
+        const size_t index = Container::get_size() - 1;
+        Container::set_object(value, index);
+        return index;
+    }
+
+    //looks from the back, so values removed in the reverse of the order they were added are found straight away
     void remove(const type value)
     {
-        const size_t count = Container::get_size();
-        for (size_t i = 0; i < count; i++)
+        for (size_t i = Container::get_size(); i-- > 0;)
         {
             if(Container::get_object(i) == value)
             {
@@ -220,18 +229,24 @@ public:
         return index;
     }
 
+    //adds a value the caller knows isn't in the set yet, without looking for it first; returns the index
+    const size_t append(const type *const value)
+    {
+        Container::grow();
+        const size_t index = Container::get_size() - 1;
+        Container::set_object(value, index);
+        return index;
+    }
+
+    //looks from the back, so values removed in the reverse of the order they were added are found straight away
     void remove(const type *const value)
     {
-        const size_t count = Container::get_size();
-        for (size_t i = 0; i < count; i++)
+        for (size_t i = Container::get_size(); i-- > 0;)
         {
             if(Container::get_object(i) == value)
             {
-                const type* a = Container::operator[](i);
-                const type* b = Container::operator[](Container::get_size() - 1);
-                const type* temp = b;
-                a = b;
-                b = temp;
+                //the last value takes its place
+                Container::set_object(Container::get_object(Container::get_size() - 1), i);
                 Container::shrink();
                 return;
             }
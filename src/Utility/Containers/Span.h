@@ -0,0 +1,54 @@
+#ifndef SPAN_H
+#define SPAN_H
+
+#include <cassert>
+#include <cstddef>
+
+/*
+A non-owning view of a contiguous run of objects, such as the contents of a DynamicContainer.
+It never allocates or copies what it views, so it is cheap to hand out once per ray.
+
+the memory it views must outlive it, and must not be reallocated while the span is in use
+*/
+
+template<typename ObjectType>
+class Span
+{
+private:
+    const ObjectType *objects;
+    size_t size;
+
+public:
+    Span(): objects(nullptr), size(0) {}
+
+    Span(const ObjectType *const objects_, const size_t n_objects): objects(objects_), size(n_objects) {}
+
+    Span(const Span& other): objects(other.objects), size(other.size) {}
+
+    Span& operator=(const Span& other)
+    {
+        objects = other.objects;
+        size = other.size;
+        return *this;
+    }
+
+    ~Span(){}
+
+    inline const size_t &get_size()const{return size;}
+
+    inline const ObjectType *get_objects()const{return objects;}
+
+    inline const ObjectType &operator[](const size_t index)const
+    {
+        assert(index < size);
+        return objects[index];
+    }
+
+    inline const ObjectType *begin()const{return objects;}
+
+    inline const ObjectType *end()const{return objects + size;}
+
+    inline operator bool()const{return size;}
+};
+
+#endif
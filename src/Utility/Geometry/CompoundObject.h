@@ -4,9 +4,12 @@
 /*
 This file defines a class that holds a number of the same types of object with set relative displacements
 this will require a 2D and 3D version for obvious reasons
+
+the 3D version is built on Placement, which is also how instances (Physics/Acceleration/Instance.h) are put in the scene
 */
 
 #include "Maths/Linalg.h"
+#include "Maths/Quarternion.h"
 
 namespace Geometry
 {
@@ -31,7 +34,7 @@ namespace Geometry
 
     Compound2d() = delete;
 
-    Compound2d(const object_type *objects_, const fvector *rel_pos, const size_t n): n_objects(n), angle(0), position({})
+    Compound2d(const object_type *objects_, const fvector *rel_pos, const size_t n): n_objects(n), rotation(0), position({})
     {
         allocate();
         for (size_t i = 0; i < n; i++)
@@ -41,7 +44,7 @@ namespace Geometry
         }
     }
 
-    Compound2d(const Compound2d& other): n_objects(other.n_objects), angle(other.angle), position(other.position)
+    Compound2d(const Compound2d& other): n_objects(other.n_objects), rotation(other.rotation), position(other.position)
     {
         allocate();
         for (size_t i = 0; i < n_objects; i++)
@@ -60,6 +63,117 @@ namespace Geometry
 
     //is there a way we can call a function on all the objects in this wrapper easily?
     };
+
+
+    /*
+    where something sits in 3D: a uniform scale, then a rotation, then a translation.
+    the rotation is a unit quarternion as made by Maths::rotation
+    */
+    template<typename ftype>
+    class Placement
+    {
+        typedef Maths::Vector<ftype, 3> fvector;
+        typedef Maths::Quarternion<ftype> quarternion;
+    protected:
+        fvector position;
+        quarternion rotation;
+        ftype scale;
+    public:
+        Placement(): position({}), rotation(1), scale(1) {}
+
+        Placement(const fvector& position_, const quarternion& rotation_, const ftype scale_ = 1):
+            position(position_), rotation(rotation_), scale(scale_) {}
+
+        void set_placement(const fvector& position_, const quarternion& rotation_, const ftype scale_ = 1)
+        {
+            position = position_;
+            rotation = rotation_;
+            scale = scale_;
+        }
+
+        inline const fvector to_world(const fvector& point)const
+        {
+            return Maths::rotate(rotation, point * scale) + position;
+        }
+
+        inline const fvector to_local(const fvector& point)const
+        {
+            return Maths::rotate(rotation.conjugate(), point - position) / scale;
+        }
+
+        //directions only rotate, so unit vectors stay unit vectors
+        inline const fvector direction_to_world(const fvector& direction)const
+        {
+            return Maths::rotate(rotation, direction);
+        }
+
+        inline const fvector direction_to_local(const fvector& direction)const
+        {
+            return Maths::rotate(rotation.conjugate(), direction);
+        }
+
+        const fvector& get_position()const { return position; }
+        const quarternion& get_rotation()const { return rotation; }
+        const ftype& get_scale()const { return scale; }
+    };
+
+
+    //the 3D version of Compound2d: the objects keep their displacements relative to the compound as it is moved and turned
+    template<typename object_type, typename ftype>
+    class Compound3d : public Placement<ftype>
+    {
+        typedef Maths::Vector<ftype, 3> fvector;
+    private:
+        size_t n_objects;
+        fvector *relative_positions;
+        object_type *objects;
+
+    private:
+        void allocate()
+        {
+            relative_positions = new fvector[n_objects];
+            objects = new object_type[n_objects];
+        }
+    public:
+
+    Compound3d() = delete;
+
+    Compound3d(const object_type *objects_, const fvector *rel_pos, const size_t n): Placement<ftype>(), n_objects(n)
+    {
+        allocate();
+        for (size_t i = 0; i < n; i++)
+        {
+            relative_positions[i] = rel_pos[i];
+            objects[i] = objects_[i];
+        }
+    }
+
+    Compound3d(const Compound3d& other): Placement<ftype>(other), n_objects(other.n_objects)
+    {
+        allocate();
+        for (size_t i = 0; i < n_objects; i++)
+        {
+            relative_positions[i] = other.relative_positions[i];
+            objects[i] = other.objects[i];
+        }
+    }
+
+    ~Compound3d()
+    {
+        delete [] relative_positions;
+        delete [] objects;
+    }
+
+    const size_t& get_size()const { return n_objects; }
+    const object_type& get_object(const size_t i)const { return objects[i]; }
+    const fvector& get_relative_position(const size_t i)const { return relative_positions[i]; }
+
+    //where object i is once the compound's placement is applied
+    const fvector get_world_position(const size_t i)const
+    {
+        return Placement<ftype>::to_world(relative_positions[i]);
+    }
+    };
 }
 
 
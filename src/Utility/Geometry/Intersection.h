@@ -162,9 +162,14 @@ namespace Geometry
 	}
 
 
-	//sphere - ray intersection; tells us where the first positive intesection is
+	//intersection between a ray and the sphere with the given center and squared radius; tells us where the
+	//first intesection further than tolerance is, or -1.0 if the ray misses
 	template<typename ftype>
-	const ftype intersection(const Sphere<ftype>& sphere, const Space<ftype, 1, 3>& ray, const ftype tolerance)
+	const ftype intersection(
+		const Maths::Vector<ftype, 3>& center,
+		const ftype r2,
+		const Space<ftype, 1, 3>& ray,
+		const ftype tolerance)
 	{
 		typedef Maths::Vector<ftype, 3> fvector;
 		/*
@@ -173,59 +178,102 @@ namespace Geometry
 
 		we should find the linear distance along the line that the thing gives
 		*/
-		const fvector& position = sphere.get_center();
-		const ftype local_projected_point = ray.project(position);
+		const ftype local_projected_point = ray.project(center);
 		const fvector ray_point = ray.local_to_global(local_projected_point);
 
 		//this is the minimum squared distance from info.ray
-		const ftype seperation2 = Maths::mag2(position - ray_point);
+		const ftype seperation2 = Maths::mag2(center - ray_point);
 
 		// if abs(sep2) > radius, or if it's negative, it never intersects
-		if (seperation2 > sphere.get_r2())
+		if (seperation2 > r2)
 		{
 			return -1.0;
 		}
 
 		// we want to find out how much further forward or backward the intersecting points lie.
-		const ftype intersection_distance = sqrt(sphere.get_r2() - seperation2); //we need this to be sqrt, trust me.
+		const ftype intersection_distance = sqrt(r2 - seperation2); //we need this to be sqrt, trust me.
 		return ((local_projected_point - intersection_distance > tolerance) ?
 			local_projected_point - intersection_distance :
 			local_projected_point + intersection_distance);
 	}
 
+	//sphere - ray intersection; tells us where the first positive intesection is
+	template<typename ftype>
+	const ftype intersection(const Sphere<ftype>& sphere, const Space<ftype, 1, 3>& ray, const ftype tolerance)
+	{
+		return intersection(sphere.get_center(), sphere.get_r2(), ray, tolerance);
+	}
+
+	//intersection between a ray and the plane through point with the given normal. this is closed form, so
+	//there's nothing to invert; a ray parallel to the plane gives -1.0 rather than an exception
+	template<typename ftype>
+	const ftype intersection(
+		const Maths::Vector<ftype, 3>& point,
+		const Maths::Vector<ftype, 3>& normal,
+		const Space<ftype, 1, 3>& ray)
+	{
+		const ftype denominator = Maths::dot(normal, ray.get_axis());
+		if (denominator == ftype(0))
+		{
+			return -1.0;
+		}
+		const ftype out = Maths::dot(normal, point - ray.get_origin()) / denominator;
+		return out ? out : -1.0;
+	}
+
 	//intersection between a plane and a ray
 	template<typename ftype>
 	const ftype intersection(const Space<ftype, 2, 3>& plane, const Space<ftype, 1, 3>& ray)
 	{
-		const Maths::Matrix<ftype, 3, 1> origins({ ray.get_origin() - plane.get_origin() });
+		return intersection(plane.get_origin(), Maths::cross(plane.get_axis(0), plane.get_axis(1)), ray);
+	}
 
-		const Maths::Matrix<ftype, 3, 3> axes({ plane.get_axis(0), plane.get_axis(1), -ray.get_axis() });
-		try
+	//Moller-Trumbore intersection between a ray and the triangle (vertex, vertex + edge1, vertex + edge2).
+	//the edges can be precomputed by the caller. there's one division and no matrix, and a ray that misses
+	//(or runs parallel to the triangle) gives -1.0 rather than an exception
+	template<typename ftype>
+	const ftype intersection(
+		const Maths::Vector<ftype, 3>& vertex,
+		const Maths::Vector<ftype, 3>& edge1,
+		const Maths::Vector<ftype, 3>& edge2,
+		const Space<ftype, 1, 3>& ray)
+	{
+		typedef Maths::Vector<ftype, 3> fvector;
+
+		const fvector p = Maths::cross(ray.get_axis(), edge2);
+		const ftype det = Maths::dot(edge1, p);
+		if (det == ftype(0))
 		{
-			const ftype out = Maths::matmul(origins, Maths::inv(axes))[0][2];
-			return out ? out : -1.0;
+			return -1.0;
 		}
-		catch (LINALG_ERRORS) 
+		const ftype inv_det = ftype(1) / det;
+
+		//barycentric coordinates of the hit; we can leave as soon as one is out of range
+		const fvector displacement = ray.get_origin() - vertex;
+		const ftype u = Maths::dot(displacement, p) * inv_det;
+		if (u < ftype(0) || u > ftype(1))
 		{
 			return -1.0;
 		}
+
+		const fvector q = Maths::cross(displacement, edge1);
+		const ftype v = Maths::dot(ray.get_axis(), q) * inv_det;
+		if (v < ftype(0) || u + v > ftype(1))
+		{
+			return -1.0;
+		}
+		return Maths::dot(edge2, q) * inv_det;
 	}
 
 	//intersection between a 3d triangle and a ray
 	template<typename ftype>
 	const ftype intersection(const Triangle<ftype, 3> &triangle, const Space<ftype, 1, 3>& ray)
 	{
-		Maths::Matrix<ftype, 3, 1> displacements({ ray.get_origin() - triangle.get_vertex(0) });
-		Maths::Matrix<ftype, 3, 3> dirs({ triangle.get_vertex(1) - triangle.get_vertex(0), triangle.get_vertex(2) - triangle.get_vertex(0), -ray.get_axis() });
-		try
-		{
-			Maths::Vector<ftype, 3> vars = Maths::matmul(displacements, Maths::inv(dirs))[0];
-			return ((vars[0] >= 0) && (vars[1] >= 0) && (vars[0] + vars[1] <= 1)) ? vars[2] : ftype(-1.0);
-		}
-		catch (LINALG_ERRORS)
-		{
-			return -1.0;
-		}
+		return intersection(
+			triangle.get_vertex(0),
+			triangle.get_vertex(1) - triangle.get_vertex(0),
+			triangle.get_vertex(2) - triangle.get_vertex(0),
+			ray);
 	}
 }
 
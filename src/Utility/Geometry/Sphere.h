@@ -37,6 +37,8 @@ namespace Geometry
 		const ftype& get_r2()const { return m_r2; }
 		const fvector& get_center()const { return m_center; }
 
+		void set_center(const fvector& center) { m_center = center; }
+
 		const AxisAlignedBoundingBox<ftype, 3> make_aabb()
 		{
 			return AxisAlignedBoundingBox(m_center - m_radius, m_center + m_radius);
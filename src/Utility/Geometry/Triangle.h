@@ -113,6 +113,13 @@ namespace Geometry
 		}
 
 		inline const fvector& get_vertex(const size_t index)const { return vertices[index]; }
+
+		inline void set_vertex(const fvector& vertex, const size_t index)
+		{
+			assert(index < 3);
+			vertices[index] = vertex;
+		}
+
 		inline fvector& get_normal()const
 		{
 			return Maths::unit(Maths::cross(p1 - p2, p1 - p3));
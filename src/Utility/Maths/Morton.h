@@ -0,0 +1,105 @@
+#ifndef MORTON_H
+#define MORTON_H
+
+#include <stdint.h>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+/*
+Morton (z-order) codes: interleave the bits of integer coordinates so that points that are close
+together in space tend to be close together in the code. Walking things in code order therefore
+keeps neighbouring work on neighbouring memory, and sorting things by code groups them spatially.
+*/
+
+namespace Maths
+{
+	//spreads the lower 16 bits of x out so there is a zero bit between each of them
+	inline uint32_t part1by1(uint32_t x)
+	{
+		x &= 0x0000ffff;
+		x = (x | (x << 8)) & 0x00ff00ff;
+		x = (x | (x << 4)) & 0x0f0f0f0f;
+		x = (x | (x << 2)) & 0x33333333;
+		x = (x | (x << 1)) & 0x55555555;
+		return x;
+	}
+
+	//the inverse of part1by1; gathers every other bit back into the lower 16 bits
+	inline uint32_t compact1by1(uint32_t x)
+	{
+		x &= 0x55555555;
+		x = (x | (x >> 1)) & 0x33333333;
+		x = (x | (x >> 2)) & 0x0f0f0f0f;
+		x = (x | (x >> 4)) & 0x00ff00ff;
+		x = (x | (x >> 8)) & 0x0000ffff;
+		return x;
+	}
+
+	inline uint32_t morton_encode(const uint16_t x, const uint16_t y)
+	{
+		return part1by1(x) | (part1by1(y) << 1);
+	}
+
+	inline void morton_decode(const uint32_t code, uint16_t& x, uint16_t& y)
+	{
+		x = uint16_t(compact1by1(code));
+		y = uint16_t(compact1by1(code >> 1));
+	}
+
+	//spreads the lower 10 bits of x out so there are two zero bits between each of them
+	inline uint32_t part1by2(uint32_t x)
+	{
+		x &= 0x000003ff;
+		x = (x | (x << 16)) & 0x030000ff;
+		x = (x | (x << 8)) & 0x0300f00f;
+		x = (x | (x << 4)) & 0x030c30c3;
+		x = (x | (x << 2)) & 0x09249249;
+		return x;
+	}
+
+	//the same for the lower 21 bits of x, spread over 63
+	inline uint64_t part1by2_wide(uint64_t x)
+	{
+		x &= 0x00000000001fffff;
+		x = (x | (x << 32)) & 0x001f00000000ffff;
+		x = (x | (x << 16)) & 0x001f0000ff0000ff;
+		x = (x | (x << 8)) & 0x100f00f00f00f00f;
+		x = (x | (x << 4)) & 0x10c30c30c30c30c3;
+		x = (x | (x << 2)) & 0x1249249249249249;
+		return x;
+	}
+
+	//30 bit code for 3d points; each coordinate must be below 1024
+	inline uint32_t morton_encode(const uint32_t x, const uint32_t y, const uint32_t z)
+	{
+		return part1by2(x) | (part1by2(y) << 1) | (part1by2(z) << 2);
+	}
+
+	//63 bit code for 3d points; each coordinate must be below 2^21
+	inline uint64_t morton_encode_wide(const uint32_t x, const uint32_t y, const uint32_t z)
+	{
+		return part1by2_wide(x) | (part1by2_wide(y) << 1) | (part1by2_wide(z) << 2);
+	}
+
+	//the number of zero bits above the highest set bit; 64 for 0
+	inline unsigned int leading_zeros(const uint64_t x)
+	{
+#if defined(__GNUC__) || defined(__clang__)
+		return x ? unsigned(__builtin_clzll(x)) : 64;
+#elif defined(_MSC_VER) && defined(_M_X64)
+		unsigned long index;
+		return _BitScanReverse64(&index, x) ? 63 - unsigned(index) : 64;
+#else
+		unsigned int n = 0;
+		for (uint64_t bit = uint64_t(1) << 63; bit && !(x & bit); bit >>= 1)
+		{
+			n++;
+		}
+		return n;
+#endif
+	}
+}
+
+#endif
@@ -247,10 +247,19 @@ namespace Maths
 	Quarternion<ftype> rotation(const Vector<ftype, 3>& unit_axis, const ftype angle)
 	{
 		const ftype half_angle = 0.5 * angle;
-		const ftype scalar = cos(half_angle);
-		const Vector<ftype, 3> vector = unit_axis * -sin(half_angle);
+		const ftype scalar = ftype(cos(half_angle));
+		const Vector<ftype, 3> vector = unit_axis * -ftype(sin(half_angle));
 		return Quarternion<ftype>(scalar, vector);
 	}
+
+	//rotates v by a unit quarternion made by rotation(), anticlockwise about its axis. this is q* v q expanded,
+	//which skips the scalar part of the products; rotate(q.conjugate(), v) undoes it
+	template <typename ftype>
+	Vector<ftype, 3> rotate(const Quarternion<ftype>& q, const Vector<ftype, 3>& v)
+	{
+		const Vector<ftype, 3> t = cross(q.vector, v) - q.scalar * v;
+		return v + ftype(2) * cross(q.vector, t);
+	}
 }
 
 